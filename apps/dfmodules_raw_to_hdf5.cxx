@@ -0,0 +1,127 @@
+/**
+ * @file dfmodules_raw_to_hdf5.cxx
+ *
+ * Converts the raw data files written by the RawDataStore into HDF5 files,
+ * using the HDF5DataStore with the given DataStoreConf for the file layout,
+ * names and rotation.
+ *
+ * Usage: dfmodules_raw_to_hdf5 <config> <session> <application> <DataStoreConf UID> <raw files...>
+ * e.g. dfmodules_raw_to_hdf5 oksconflibs:config/session.data.xml my-session dataflow-0 dw-ds-0 run*.raw
+ *
+ * Consecutive files of the same run and writer are written through the same HDF5DataStore,
+ * so they should be given in the order of their file index.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DataStore.hpp"
+#include "dfmodules/RawDataFile.hpp"
+
+#include "appfwk/ModuleConfiguration.hpp"
+#include "daqdataformats/Fragment.hpp"
+#include "daqdataformats/TimeSlice.hpp"
+#include "daqdataformats/TriggerRecord.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+// Adds the fragments that follow a record header of header_size bytes
+template<typename Record>
+void
+add_fragments(Record& record, std::vector<char>& bytes, size_t header_size)
+{
+  size_t offset = header_size;
+  while (offset < bytes.size()) {
+    auto fragment = std::make_unique<daqdataformats::Fragment>(bytes.data() + offset,
+                                                               daqdataformats::Fragment::BufferAdoptionMode::kCopyFromBuffer);
+    offset += fragment->get_size();
+    record.add_fragment(std::move(fragment));
+  }
+}
+
+void
+convert_record(DataStore& data_store, RawDataFileReader& reader, const RawIndexEntry& entry)
+{
+  auto bytes = reader.read(entry);
+  if (entry.record_type == RawRecordType::kTriggerRecord) {
+    daqdataformats::TriggerRecordHeader header(bytes.data(), true);
+    daqdataformats::TriggerRecord record(header);
+    add_fragments(record, bytes, header.get_total_size_bytes());
+    data_store.write(record);
+  } else {
+    daqdataformats::TimeSliceHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    daqdataformats::TimeSlice slice(header);
+    add_fragments(slice, bytes, sizeof(header));
+    data_store.write(slice);
+  }
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  if (argc < 6) {
+    std::cout << "Usage: " << argv[0] << " <config> <session> <application> <DataStoreConf UID> <raw files...>"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string config_spec = argv[1];
+  std::string session_name = argv[2];
+  std::string application_name = argv[3];
+  std::string data_store_uid = argv[4];
+  setenv("DUNEDAQ_SESSION", session_name.c_str(), 1);
+
+  std::shared_ptr<DataStore> data_store;
+  std::string current_writer;
+  daqdataformats::run_number_t current_run = 0;
+
+  try {
+    auto configuration_manager = std::make_shared<appfwk::ConfigurationManager>(config_spec, application_name, session_name);
+    auto module_configuration = std::make_shared<appfwk::ModuleConfiguration>(configuration_manager);
+
+    for (int i = 5; i < argc; ++i) {
+      RawDataFileReader reader(argv[i]);
+      const auto& header = reader.get_header();
+      std::string writer_identifier(header.writer_identifier);
+
+      if (!data_store || writer_identifier != current_writer || header.run_number != current_run) {
+        if (data_store) {
+          data_store->finish_with_run(current_run);
+        }
+        data_store = make_data_store("HDF5DataStore", data_store_uid, module_configuration, writer_identifier);
+        data_store->set_stream_info(header.stream_index, header.stream_count);
+        data_store->prepare_for_run(header.run_number, header.run_was_for_test_purposes != 0);
+        current_writer = writer_identifier;
+        current_run = header.run_number;
+      }
+
+      for (auto& entry : reader.get_index()) {
+        convert_record(*data_store, reader, entry);
+      }
+      std::cout << argv[i] << ": converted " << reader.get_index().size() << " records" << std::endl;
+    }
+
+    if (data_store) {
+      data_store->finish_with_run(current_run);
+    }
+  } catch (const std::exception& excpt) {
+    std::cerr << "Conversion failed: " << excpt.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
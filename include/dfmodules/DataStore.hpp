@@ -29,6 +29,7 @@
 
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -146,6 +147,37 @@ public:
    */
   virtual void finish_with_run(daqdataformats::run_number_t run_number) = 0;
 
+  /**
+   * @brief Returns the fraction of free space on the storage system, as seen
+   * at the time of the latest write, or a negative value if it is not known.
+   */
+  virtual float get_free_space_fraction() const { return -1.; }
+
+  /**
+   * @brief Tells the DataStore that it is one of stream_count instances sharing the output
+   * of a single writer, so that it can record the information needed to merge the streams.
+   */
+  virtual void set_stream_info(size_t /*stream_index*/, size_t /*stream_count*/) {}
+
+  /**
+   * @brief Tells whether write() may return before the data is written. Such DataStores
+   * report the progress of the writes with get_completed_writes().
+   */
+  virtual bool writes_asynchronously() const { return false; }
+
+  /**
+   * @brief Returns the number of successful write() calls whose data has been written,
+   * since the DataStore was created. Only meaningful if writes_asynchronously().
+   * It may be called from any thread.
+   */
+  virtual uint64_t get_completed_writes() const { return 0; } // NOLINT(build/unsigned)
+
+  /**
+   * @brief Starts writing the data that is held back waiting for more, so that all
+   * the previous write() calls eventually complete.
+   */
+  virtual void flush() {}
+
 private:
   DataStore(const DataStore&) = delete;
   DataStore& operator=(const DataStore&) = delete;
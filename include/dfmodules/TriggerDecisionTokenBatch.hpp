@@ -0,0 +1,61 @@
+/**
+ * @file TriggerDecisionTokenBatch.hpp
+ *
+ * The TriggerDecisionTokenBatch message is used by the DataWriterModule to
+ * report to the DFO the completion of several TriggerDecisions at once,
+ * as an alternative to sending one TriggerDecisionToken per decision.
+ * Each batch also carries the current health of the writer, which the DFO uses
+ * to steer new decisions away from writers that are about to stall.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
+#define DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
+
+#include "daqdataformats/Types.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief State of a DataWriterModule at the time a batch is sent
+ */
+struct WriterHealth
+{
+  /// Average time to write a record since the previous batch
+  uint32_t write_latency_us{ 0 }; // NOLINT(build/unsigned)
+  /// Free fraction of the output filesystem, negative if unknown
+  float disk_free_fraction{ -1. };
+  /// Records received and not yet completed
+  uint32_t queue_depth{ 0 }; // NOLINT(build/unsigned)
+
+  DUNE_DAQ_SERIALIZE(WriterHealth, write_latency_us, disk_free_fraction, queue_depth);
+};
+
+/**
+ * @brief Completion of a set of TriggerDecisions assigned to the same dataflow application
+ */
+struct TriggerDecisionTokenBatch
+{
+  daqdataformats::run_number_t run_number{ 0 };
+  std::string decision_destination{};                           ///< Same as in TriggerDecisionToken
+  std::vector<daqdataformats::trigger_number_t> trigger_numbers; ///< In order of completion, can be empty
+  WriterHealth health;
+
+  DUNE_DAQ_SERIALIZE(TriggerDecisionTokenBatch, run_number, decision_destination, trigger_numbers, health);
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+DUNE_DAQ_SERIALIZABLE(dunedaq::dfmodules::TriggerDecisionTokenBatch, "TriggerDecisionTokenBatch");
+
+#endif // DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
@@ -12,10 +12,13 @@
 #include "dfmodules/opmon/DFOModule.pb.h"
 
 #include "appmodel/DFOModule.hpp"
+#include "appmodel/DataVolumeEstimate.hpp"
+#include "appmodel/TriggerRoutingClass.hpp"
 #include "confmodel/Connection.hpp"
 #include "iomanager/IOManager.hpp"
 #include "logging/Logging.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <future>
@@ -47,8 +50,11 @@ namespace dunedaq::dfmodules {
 
 DFOModule::DFOModule(const std::string& name)
   : dunedaq::appfwk::DAQModule(name)
+  , m_dataflow_availability(std::make_shared<data_structure_t>())
+  , m_occupancy(std::make_shared<TRBOccupancy>())
   , m_queue_timeout(100)
   , m_run_number(0)
+  , m_dispatcher(std::bind(&DFOModule::do_dispatch, this, std::placeholders::_1))
 {
   register_command("conf", &DFOModule::do_conf);
   register_command("start", &DFOModule::do_start);
@@ -74,6 +80,9 @@ DFOModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
     if (con->get_data_type() == datatype_to_string<dfmessages::TriggerDecision>()) {
       m_td_connection = con->UID();
     }
+    if (con->get_data_type() == datatype_to_string<TriggerDecisionTokenBatch>()) {
+      m_token_batch_connection = con->UID();
+    }
   }
   for (auto con : mdal->get_outputs()) {
     if (con->get_data_type() == datatype_to_string<dfmessages::TriggerInhibit>()) {
@@ -100,6 +109,9 @@ DFOModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   // these are just tests to check if the connections are ok
   iom->get_receiver<dfmessages::TriggerDecisionToken>(m_token_connection);
   iom->get_receiver<dfmessages::TriggerDecision>(m_td_connection);
+  if (m_token_batch_connection != "") {
+    iom->get_receiver<TriggerDecisionTokenBatch>(m_token_batch_connection);
+  }
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
 }
@@ -110,14 +122,90 @@ DFOModule::do_conf(const data_t&)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_conf() method";
 
   m_queue_timeout = std::chrono::milliseconds(m_dfo_conf->get_general_queue_timeout_ms());
-  m_stop_timeout = std::chrono::microseconds(m_dfo_conf->get_stop_timeout_ms());
+  m_stop_timeout = std::chrono::milliseconds(m_dfo_conf->get_stop_timeout_ms());
   m_busy_threshold = m_dfo_conf->get_busy_threshold();
   m_free_threshold = m_dfo_conf->get_free_threshold();
+  m_busy_threshold_bytes = m_dfo_conf->get_busy_threshold_bytes();
+  m_free_threshold_bytes = m_dfo_conf->get_free_threshold_bytes();
+
+  m_writer_health_limits.max_write_latency = std::chrono::microseconds(m_dfo_conf->get_writer_max_write_latency_us());
+  m_writer_health_limits.min_disk_free_fraction = m_dfo_conf->get_writer_min_disk_free_fraction();
+  m_writer_health_limits.max_queue_depth = m_dfo_conf->get_writer_max_queue_depth();
+  m_writer_health_limits.hold_time = std::chrono::milliseconds(m_dfo_conf->get_writer_health_hold_ms());
+
+  m_liveness_limits.max_assignment_age = std::chrono::milliseconds(m_dfo_conf->get_max_assignment_age_ms());
+  m_liveness_limits.max_token_silence = std::chrono::milliseconds(m_dfo_conf->get_max_token_silence_ms());
+
+  m_threshold_tuning.target_delay = std::chrono::milliseconds(m_dfo_conf->get_threshold_tuning_target_ms());
+  m_threshold_tuning.min_busy_threshold = m_dfo_conf->get_min_busy_threshold();
+  m_threshold_tuning.max_busy_threshold = m_dfo_conf->get_max_busy_threshold() > 0
+                                            ? m_dfo_conf->get_max_busy_threshold()
+                                            : std::numeric_limits<size_t>::max();
+  m_threshold_tuning.free_fraction =
+    m_busy_threshold > 0 ? static_cast<double>(m_free_threshold) / m_busy_threshold : 1.;
+  m_tuning_interval = std::chrono::milliseconds(m_dfo_conf->get_threshold_tuning_interval_ms());
+  if (m_threshold_tuning.target_delay.count() > 0) {
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": busy thresholds tuned every " << m_tuning_interval.count()
+                            << " ms for a delay of " << m_threshold_tuning.target_delay.count() << " ms, between "
+                            << m_threshold_tuning.min_busy_threshold << " and "
+                            << m_threshold_tuning.max_busy_threshold;
+  }
+
+  m_volume_estimator.clear();
+  for (auto estimate : m_dfo_conf->get_data_volume_estimates()) {
+    auto subsystem = daqdataformats::SourceID::string_to_subsystem(estimate->get_subsystem());
+    m_volume_estimator.set_bytes_per_tick(subsystem, estimate->get_bytes_per_tick());
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": estimated data rate for subsystem " << estimate->get_subsystem()
+                            << " is " << estimate->get_bytes_per_tick() << " bytes per tick";
+  }
 
   m_td_send_retries = m_dfo_conf->get_td_send_retries();
 
+  m_router.clear();
+  auto type_names = dunedaq::trgdataformats::get_trigger_candidate_type_names();
+  for (auto rc : m_dfo_conf->get_routing_classes()) {
+    TriggerRouter::RoutingClass routing_class;
+    routing_class.name = rc->UID();
+    for (const auto& type_name : rc->get_trigger_types()) {
+      auto type_it = std::find_if(
+        type_names.begin(), type_names.end(), [&](const auto& entry) { return entry.second == type_name; });
+      if (type_it == type_names.end()) {
+        throw appfwk::CommandFailed(
+          ERS_HERE, "conf", get_name(), "Unknown trigger type " + type_name + " in routing class " + rc->UID());
+      }
+      routing_class.trigger_types |= TriggerRouter::trigger_type_t(1) << static_cast<size_t>(type_it->first);
+    }
+    // the applications are known by the connections their decisions are sent to
+    for (const auto& destination : rc->get_destinations()) {
+      if (std::find(m_trb_conn_ids.begin(), m_trb_conn_ids.end(), destination) == m_trb_conn_ids.end()) {
+        throw appfwk::CommandFailed(
+          ERS_HERE, "conf", get_name(), "Unknown destination " + destination + " in routing class " + rc->UID());
+      }
+      routing_class.destinations.insert(destination);
+    }
+    if (routing_class.destinations.empty()) {
+      throw appfwk::CommandFailed(ERS_HERE, "conf", get_name(), "Routing class " + rc->UID() + " has no destinations");
+    }
+    routing_class.fallback = rc->get_fallback();
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": routing class " << routing_class.name << " has trigger type mask 0x"
+                            << std::hex << routing_class.trigger_types << std::dec << " and "
+                            << routing_class.destinations.size() << " destinations";
+    m_router.add_class(std::move(routing_class));
+  }
+  m_router.update(*dataflow_availability());
+
+  InhibitPredictor::Config inhibit_config;
+  inhibit_config.horizon = std::chrono::milliseconds(m_dfo_conf->get_inhibit_horizon_ms());
+  inhibit_config.min_dwell = std::chrono::milliseconds(m_dfo_conf->get_inhibit_min_dwell_ms());
+  m_inhibit_predictor.configure(inhibit_config);
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": inhibit horizon is " << inhibit_config.horizon.count()
+                          << " ms, minimum dwell time is " << inhibit_config.min_dwell.count() << " ms";
+
+  m_scheduling_policy = make_scheduling_policy(m_dfo_conf->get_scheduling_policy());
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": using the " << m_scheduling_policy->name() << " scheduling policy";
+
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_conf() method, there are "
-                                      << m_dataflow_availability.size() << " TRB apps defined";
+                                      << dataflow_availability()->size() << " TRB apps defined";
 }
 
 void
@@ -130,9 +218,16 @@ DFOModule::do_start(const data_t& payload)
 
   m_running_status.store(true);
   m_last_notified_busy.store(false);
-  m_last_assignement_it = m_dataflow_availability.end();
+  {
+    std::lock_guard<std::mutex> guard(m_notify_trigger_mutex);
+    m_inhibit_predictor.reset(std::chrono::steady_clock::now());
+  }
+  m_scheduling_policy->reset();
 
-  m_last_token_received = m_last_td_received = std::chrono::steady_clock::now();
+  m_last_td_received = std::chrono::steady_clock::now();
+  m_last_token_received.store(m_last_td_received);
+  m_last_liveness_check = m_last_tuning = m_last_td_received;
+  m_dispatcher.start_working_thread("dfo-dispatch");
 
   auto iom = iomanager::IOManager::get();
   if (m_busy_sender != nullptr) {
@@ -148,6 +243,11 @@ DFOModule::do_start(const data_t& payload)
   }
   iom->add_callback<dfmessages::TriggerDecisionToken>(
     m_token_connection, std::bind(&DFOModule::receive_trigger_complete_token, this, std::placeholders::_1));
+  if (m_token_batch_connection != "") {
+    iom->add_callback<TriggerDecisionTokenBatch>(
+      m_token_batch_connection,
+      std::bind(&DFOModule::receive_trigger_complete_token_batch, this, std::placeholders::_1));
+  }
 
   iom->add_callback<dfmessages::TriggerDecision>(
     m_td_connection, std::bind(&DFOModule::receive_trigger_decision, this, std::placeholders::_1));
@@ -160,36 +260,53 @@ DFOModule::do_stop(const data_t& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
 
-  m_running_status.store(false);
+  // the flag is cleared under the queue lock, so that the dispatcher can not miss the notification
+  // between checking it and waiting
+  {
+    std::lock_guard<std::mutex> lk(m_pending_mutex);
+    m_running_status.store(false);
+  }
 
   auto iom = iomanager::IOManager::get();
   iom->remove_callback<dfmessages::TriggerDecision>(m_td_connection);
 
-  const int wait_steps = 20;
-  auto step_timeout = m_stop_timeout / wait_steps;
-  int step_counter = 0;
-  while (!is_empty() && step_counter < wait_steps) {
-    TLOG() << get_name() << ": stop delayed while waiting for " << used_slots() << " TDs to completed";
-    std::this_thread::sleep_for(step_timeout);
-    ++step_counter;
+  // the dispatcher makes a last attempt on the decisions still in the queue before exiting
+  m_pending_cv.notify_all();
+  m_dispatcher.stop_working_thread();
+
+  if (!is_empty()) {
+    TLOG() << get_name() << ": stop delayed while waiting for " << used_slots() << " TDs to complete";
+    std::unique_lock<std::mutex> lk(m_drain_mutex);
+    m_drain_cv.wait_for(lk, m_stop_timeout, [this]() { return is_empty(); });
   }
 
   iom->remove_callback<dfmessages::TriggerDecisionToken>(m_token_connection);
+  if (m_token_batch_connection != "") {
+    iom->remove_callback<TriggerDecisionTokenBatch>(m_token_batch_connection);
+  }
+
+  auto deadline = std::chrono::steady_clock::now();
+  for (auto& [name, app] : *dataflow_availability()) {
+    auto remnants = app->flush();
+    if (remnants.empty())
+      continue;
+
+    // the assignments are in order, the oldest is the first
+    auto age_ms = [&](const std::shared_ptr<AssignedTriggerDecision>& td) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(deadline - td->assigned_time).count();
+    };
+    ers::warning(
+      DecisionsNotDrained(ERS_HERE, name, remnants.size(), age_ms(remnants.back()), age_ms(remnants.front())));
 
-  std::list<std::shared_ptr<AssignedTriggerDecision>> remnants;
-  for (auto& app : m_dataflow_availability) {
-    auto temp = app.second->flush();
-    for (auto& td : temp) {
-      remnants.push_back(td);
+    for (auto& r : remnants) {
+      ers::error(IncompleteTriggerDecision(ERS_HERE, r->decision.trigger_number, m_run_number));
     }
   }
 
-  for (auto& r : remnants) {
-    ers::error(IncompleteTriggerDecision(ERS_HERE, r->decision.trigger_number, m_run_number));
+  for (size_t i = 0; i < s_max_trigger_types; ++i) {
+    m_received_by_type[i].value = 0;
+    m_completed_by_type[i].value = 0;
   }
-
-  std::lock_guard<std::mutex> guard(m_trigger_counters_mutex);
-  m_trigger_counters.clear();
   
   TLOG() << get_name() << " successfully stopped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
@@ -200,7 +317,12 @@ DFOModule::do_scrap(const data_t& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
 
-  m_dataflow_availability.clear();
+  {
+    std::lock_guard<std::mutex> lk(m_dataflow_availability_mutex);
+    std::atomic_store(&m_dataflow_availability, snapshot_t(std::make_shared<data_structure_t>()));
+    m_router.update(data_structure_t());
+  }
+  m_occupancy = std::make_shared<TRBOccupancy>();
 
   TLOG() << get_name() << " successfully scrapped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
@@ -220,19 +342,134 @@ DFOModule::receive_trigger_decision(const dfmessages::TriggerDecision& decision)
 
   auto decision_received = std::chrono::steady_clock::now();
   ++m_received_decisions;
-  auto trigger_types = unpack_types(decision.trigger_type);
-  for ( const auto t : trigger_types ) {
-    ++get_trigger_counter(t).received;
+  m_inhibit_predictor.record_arrivals();
+  for_each_trigger_type(decision.trigger_type, [this](size_t bit) { ++m_received_by_type[bit].value; });
+
+  {
+    std::lock_guard<std::mutex> lk(m_pending_mutex);
+    m_pending_decisions.push_back(PendingDecision{ decision, decision_received });
+    m_pending_size.store(m_pending_decisions.size());
   }
-  
-  std::chrono::steady_clock::time_point decision_assigned;
+  m_pending_cv.notify_one();
+
+  m_waiting_for_decision +=
+    std::chrono::duration_cast<std::chrono::microseconds>(decision_received - m_last_td_received).count();
+  m_last_td_received = std::chrono::steady_clock::now();
+}
+
+void
+DFOModule::do_dispatch(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_dispatch() method";
+
+  while (true) {
+    run_periodic_checks();
+
+    // at stop, m_running_status is cleared before the flag of the worker thread, which
+    // stop_working_thread() only clears when it joins the dispatcher
+    std::unique_lock<std::mutex> lk(m_pending_mutex);
+    auto stopping = [&]() { return !running_flag.load() || !m_running_status.load(); };
+    m_pending_cv.wait_for(lk, m_queue_timeout, [&]() { return !m_pending_decisions.empty() || stopping(); });
+
+    if (m_pending_decisions.empty()) {
+      if (stopping())
+        break;
+      lk.unlock();
+      // periodic evaluation, so that an inhibit held by the dwell time is released
+      // even if no more tokens arrive
+      notify_trigger_if_needed();
+      continue;
+    }
+
+    auto pending = std::move(m_pending_decisions.front());
+    m_pending_decisions.pop_front();
+    m_pending_size.store(m_pending_decisions.size());
+    lk.unlock();
+
+    dispatch_decision(pending);
+  }
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_dispatch() method";
+}
+
+void
+DFOModule::run_periodic_checks()
+{
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_last_liveness_check >= m_queue_timeout)
+    check_liveness();
+  if (m_threshold_tuning.target_delay.count() > 0 && now - m_last_tuning >= m_tuning_interval)
+    tune_thresholds();
+}
+
+void
+DFOModule::check_liveness()
+{
+  m_last_liveness_check = std::chrono::steady_clock::now();
+
+  bool changed = false;
+  auto apps = dataflow_availability();
+  for (const auto& [name, app] : *apps) {
+    if (!app->update_liveness(m_last_liveness_check))
+      continue;
+
+    changed = true;
+    if (app->is_quarantined()) {
+      ers::warning(DataflowAppQuarantined(ERS_HERE, name, to_string(app->quarantine_reason()), app->used_slots()));
+    } else {
+      TLOG() << TRBModuleAppUpdate(ERS_HERE, name, "Released from quarantine");
+    }
+  }
+
+  // a quarantined application counts as busy
+  if (changed)
+    notify_trigger_if_needed();
+}
+
+void
+DFOModule::tune_thresholds()
+{
+  m_last_tuning = std::chrono::steady_clock::now();
+
+  bool changed = false;
+  auto apps = dataflow_availability();
+  for (const auto& [name, app] : *apps) {
+    if (app->tune_thresholds(m_threshold_tuning, m_last_tuning)) {
+      changed = true;
+      TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": thresholds of " << name << " are now " << app->busy_threshold()
+                              << '/' << app->free_threshold();
+    }
+  }
+
+  // the capacity and possibly the busy state have changed
+  if (changed)
+    notify_trigger_if_needed();
+}
+
+void
+DFOModule::dispatch_decision(const PendingDecision& pending)
+{
+  const auto& decision = pending.decision;
+  auto dispatch_start = std::chrono::steady_clock::now();
+  m_queued_time +=
+    std::chrono::duration_cast<std::chrono::microseconds>(dispatch_start - pending.received).count();
+
+  std::chrono::steady_clock::time_point decision_assigned = dispatch_start;
+  size_t failed_attempts = 0;
+  std::chrono::steady_clock::time_point last_report;
   do {
 
     auto assignment = find_slot(decision);
 
-    if (assignment == nullptr) { // this can happen if all application are in error state
-      ers::error(UnableToAssign(ERS_HERE, decision.trigger_number));
+    if (assignment == nullptr) { // this can happen if all application are in error state or quarantined
+      // the quarantine is only lifted by the liveness check, so it has to keep running while we wait
+      auto now = std::chrono::steady_clock::now();
+      if (failed_attempts++ == 0 || now - last_report >= s_unable_to_assign_report_period) {
+        ers::error(UnableToAssign(ERS_HERE, decision.trigger_number, failed_attempts));
+        last_report = now;
+      }
       usleep(500);
+      run_periodic_checks();
       notify_trigger_if_needed();
       continue;
     }
@@ -251,84 +488,77 @@ DFOModule::receive_trigger_decision(const dfmessages::TriggerDecision& decision)
     } else {
       ers::error(
         TRBModuleAppUpdate(ERS_HERE, assignment->connection_name, "Could not send Trigger Decision"));
-      m_dataflow_availability[assignment->connection_name]->set_in_error(true);
+      auto app = get_dataflow_app(assignment->connection_name);
+      if (app)
+        app->set_in_error(true);
     }
 
   } while (m_running_status.load());
 
   notify_trigger_if_needed();
 
-  m_waiting_for_decision +=
-    std::chrono::duration_cast<std::chrono::microseconds>(decision_received - m_last_td_received).count();
-  m_last_td_received = std::chrono::steady_clock::now();
+  auto dispatch_end = std::chrono::steady_clock::now();
   m_deciding_destination +=
-    std::chrono::duration_cast<std::chrono::microseconds>(decision_assigned - decision_received).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(decision_assigned - dispatch_start).count();
   m_forwarding_decision +=
-    std::chrono::duration_cast<std::chrono::microseconds>(m_last_td_received - decision_assigned).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(dispatch_end - decision_assigned).count();
 }
 
 std::shared_ptr<AssignedTriggerDecision>
 DFOModule::find_slot(const dfmessages::TriggerDecision& decision)
 {
 
-  // this find_slot assings the decision with a round-robin logic
-  // across all the available applications.
-  // Applications in error are skipped.
-  // we only probe the applications once.
-  // if they are all unavailable the assignment is set to
-  // the application with the lowest used slots
+  // this find_slot delegates the choice of the application
+  // to the configured scheduling policy.
+  // Applications in error are never selected.
+  // If the decision belongs to a routing class, the choice is
+  // restricted to the applications of the class, unless none
+  // of them can take it and the class allows a fallback.
+  // If all the applications are busy, the policy can still
+  // select one of them, and a warning is issued
   // returning a nullptr will be considered as an error
   // from the upper level code
 
   std::shared_ptr<AssignedTriggerDecision> output = nullptr;
-  auto minimum_occupied = m_dataflow_availability.end();
-  size_t minimum = std::numeric_limits<size_t>::max();
-  unsigned int counter = 0;
 
-  auto candidate_it = m_last_assignement_it;
-  if (candidate_it == m_dataflow_availability.end())
-    candidate_it = m_dataflow_availability.begin();
+  auto apps = dataflow_availability();
+  auto estimated_bytes = m_volume_estimator.estimate(decision);
 
-  while (output == nullptr && counter < m_dataflow_availability.size()) {
-
-    ++counter;
-    ++candidate_it;
-    if (candidate_it == m_dataflow_availability.end())
-      candidate_it = m_dataflow_availability.begin();
-
-    // get rid of the applications in error state
-    if (candidate_it->second->is_in_error()) {
-      continue;
-    }
+  snapshot_t candidates = apps;
+  auto routing_class = m_router.classify(decision.trigger_type);
+  if (routing_class != TriggerRouter::s_no_class) {
+    ++m_routed_decisions;
+    candidates = m_router.applications(routing_class);
+  }
 
-    // monitor
-    auto slots = candidate_it->second->used_slots();
-    if (slots < minimum) {
-      minimum = slots;
-      minimum_occupied = candidate_it;
+  auto selection = m_scheduling_policy->select(*candidates, decision, estimated_bytes);
+  if (candidates != apps && (selection.app == candidates->cend() || selection.over_busy)) {
+    // when all the applications of the class are in error or quarantined, the decision goes to the
+    // others even without a fallback, rather than holding up the dispatcher until one of them recovers
+    const auto& rc = m_router.get_class(routing_class);
+    bool class_unavailable = selection.app == candidates->cend();
+    if (rc.fallback || class_unavailable) {
+      ++m_routing_fallbacks;
+      candidates = apps;
+      selection = m_scheduling_policy->select(*candidates, decision, estimated_bytes);
+      if (!rc.fallback && selection.app != candidates->cend()) {
+        ers::warning(RoutingClassUnavailable(ERS_HERE, decision.trigger_number, rc.name));
+      }
     }
-
-    if (candidate_it->second->is_busy())
-      continue;
-
-    output = candidate_it->second->make_assignment(decision);
-    m_last_assignement_it = candidate_it;
   }
 
-  if (!output) {
-    // in this case all applications were busy
-    // so we assign the decision to that with the lowest
-    // number of assignments
-    if (minimum_occupied != m_dataflow_availability.end()) {
-      output = minimum_occupied->second->make_assignment(decision);
-      m_last_assignement_it = minimum_occupied;
-      ers::warning(AssignedToBusyApp(ERS_HERE, decision.trigger_number, minimum_occupied->first, minimum));
+  if (selection.app != candidates->cend()) {
+    output = selection.app->second->make_assignment(decision, estimated_bytes);
+    if (selection.over_busy) {
+      ers::warning(AssignedToBusyApp(
+        ERS_HERE, decision.trigger_number, selection.app->first, selection.app->second->used_slots()));
     }
   }
 
   if (output != nullptr) {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Assigned TriggerDecision with trigger number " << decision.trigger_number
-                                << " to TRB at connection " << output->connection_name;
+                                << " to TRB at connection " << output->connection_name << ", estimated size is "
+                                << estimated_bytes << " bytes";
   }
   return output;
 }
@@ -339,37 +569,78 @@ DFOModule::generate_opmon_data()
 
   opmon::DFOInfo info;
   info.set_tokens_received( m_received_tokens.exchange(0) );
+  info.set_token_batches_received(m_received_token_batches.exchange(0));
+  info.set_routed_decisions(m_routed_decisions.exchange(0));
+  info.set_routing_fallbacks(m_routing_fallbacks.exchange(0));
   info.set_decisions_sent(m_sent_decisions.exchange(0));
   info.set_decisions_received(m_received_decisions.exchange(0));
   info.set_waiting_for_decision(m_waiting_for_decision.exchange(0));
   info.set_deciding_destination(m_deciding_destination.exchange(0));
   info.set_forwarding_decision(m_forwarding_decision.exchange(0));
+  info.set_queued_time(m_queued_time.exchange(0));
+  info.set_pending_decisions(m_pending_size.load());
   info.set_waiting_for_token(m_waiting_for_token.exchange(0));
   info.set_processing_token(m_processing_token.exchange(0));
+  {
+    std::lock_guard<std::mutex> guard(m_notify_trigger_mutex);
+    auto inhibit_stats = m_inhibit_predictor.collect_statistics(std::chrono::steady_clock::now());
+    info.set_inhibit_duty_cycle(inhibit_stats.duty_cycle);
+    info.set_inhibit_transitions(inhibit_stats.transitions);
+    info.set_decision_rate(m_inhibit_predictor.arrival_rate());
+    info.set_completion_rate(m_inhibit_predictor.completion_rate());
+  }
   publish( std::move(info) );
 
-  std::lock_guard<std::mutex>	guard(m_trigger_counters_mutex);
-  for ( auto & [type, counts] : m_trigger_counters ) {
+  std::map<std::string, uint64_t> assignments; // NOLINT(build/unsigned)
+  uint64_t total_assignments = 0;              // NOLINT(build/unsigned)
+  for (auto& [name, app] : *dataflow_availability()) {
+    total_assignments += assignments[name] = app->reset_assigned_counter();
+  }
+  for (auto& [name, assigned] : assignments) {
+    opmon::AssignmentInfo ai;
+    ai.set_assigned(assigned);
+    if (total_assignments > 0)
+      ai.set_share(static_cast<double>(assigned) / total_assignments);
+    publish( std::move(ai), {{"app", name}} );
+  }
+
+  auto type_names = dunedaq::trgdataformats::get_trigger_candidate_type_names();
+  for (size_t bit = 0; bit < s_max_trigger_types; ++bit) {
+    auto received = m_received_by_type[bit].value.exchange(0);
+    auto completed = m_completed_by_type[bit].value.exchange(0);
+    if (received == 0 && completed == 0)
+      continue;
+
     opmon::TriggerInfo ti;
-    ti.set_received(counts.received.exchange(0));
-    ti.set_completed(counts.completed.exchange(0));
-    auto name = dunedaq::trgdataformats::get_trigger_candidate_type_names()[type];
+    ti.set_received(received);
+    ti.set_completed(completed);
+    auto name = type_names[static_cast<trgdataformats::TriggerCandidateData::Type>(bit)];
     publish( std::move(ti), {{"type", name}} );
-   }
+  }
 }
 
 void
 DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken& token)
 {
   if (token.run_number == 0 && token.trigger_number == 0) {
-    if (m_dataflow_availability.count(token.decision_destination) == 0) {
+    std::lock_guard<std::mutex> lk(m_dataflow_availability_mutex);
+    auto current = dataflow_availability();
+    auto app_it = current->find(token.decision_destination);
+    if (app_it == current->end()) {
       TLOG_DEBUG(TLVL_CONFIG) << "Creating dataflow availability struct for uid " << token.decision_destination;
-      auto entry = m_dataflow_availability[token.decision_destination] =
+      auto entry =
         std::make_shared<TriggerRecordBuilderData>(token.decision_destination, m_busy_threshold, m_free_threshold);
+      entry->set_byte_thresholds(m_busy_threshold_bytes, m_free_threshold_bytes);
+      entry->set_writer_health_limits(m_writer_health_limits);
+      entry->set_liveness_limits(m_liveness_limits);
+      entry->set_occupancy_counters(m_occupancy);
       register_node(token.decision_destination, entry);
+      auto updated = std::make_shared<data_structure_t>(*current);
+      (*updated)[token.decision_destination] = entry;
+      std::atomic_store(&m_dataflow_availability, snapshot_t(updated));
+      m_router.update(*updated);
     } else {
       TLOG() << TRBModuleAppUpdate(ERS_HERE, token.decision_destination, "Has reconnected");
-      auto app_it = m_dataflow_availability.find(token.decision_destination);
       app_it->second->set_in_error(false);
     }
     return;
@@ -378,75 +649,107 @@ DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken
   TLOG_DEBUG(TLVL_TDTOKEN_RECEIVED) << get_name() << " Received TriggerDecisionToken for trigger_number "
                                     << token.trigger_number << " and run " << token.run_number
                                     << " (current run is " << m_run_number << ")";
+
+  complete_trigger_decisions(token.decision_destination, token.run_number, &token.trigger_number, 1, nullptr);
+}
+
+void
+DFOModule::receive_trigger_complete_token_batch(const TriggerDecisionTokenBatch& batch)
+{
+  TLOG_DEBUG(TLVL_TDTOKEN_RECEIVED) << get_name() << " Received a batch of " << batch.trigger_numbers.size()
+                                    << " TriggerDecisionTokens from " << batch.decision_destination << " for run "
+                                    << batch.run_number << " (current run is " << m_run_number << ")";
+  ++m_received_token_batches;
+  complete_trigger_decisions(batch.decision_destination,
+                             batch.run_number,
+                             batch.trigger_numbers.data(),
+                             batch.trigger_numbers.size(),
+                             &batch.health);
+}
+
+void
+DFOModule::complete_trigger_decisions(const std::string& decision_destination,
+                                      daqdataformats::run_number_t run_number,
+                                      const daqdataformats::trigger_number_t* trigger_numbers,
+                                      size_t n_tokens,
+                                      const WriterHealth* health)
+{
   // add a check to see if the application data found
-  if (token.run_number != m_run_number) {
+  if (run_number != m_run_number) {
     std::ostringstream oss_source;
-    oss_source << "TRB at connection " << token.decision_destination;
+    oss_source << "TRB at connection " << decision_destination;
     ers::error(DFOModuleRunNumberMismatch(
-      ERS_HERE, token.run_number, m_run_number, oss_source.str(), token.trigger_number));
+      ERS_HERE, run_number, m_run_number, oss_source.str(), n_tokens > 0 ? trigger_numbers[0] : 0));
     return;
   }
 
-  auto app_it = m_dataflow_availability.find(token.decision_destination);
+  auto app = get_dataflow_app(decision_destination);
   // check if application data exists;
-  if (app_it == m_dataflow_availability.end()) {
-    ers::error(UnknownTokenSource(ERS_HERE, token.decision_destination));
+  if (!app) {
+    ers::error(UnknownTokenSource(ERS_HERE, decision_destination));
     return;
   }
 
-  ++m_received_tokens;
+  m_received_tokens += n_tokens;
+  m_inhibit_predictor.record_completions(n_tokens);
   auto callback_start = std::chrono::steady_clock::now();
 
-  try {
-    auto dec_ptr = app_it->second->complete_assignment(token.trigger_number, m_metadata_function);
-    auto trigger_types = unpack_types(dec_ptr->decision.trigger_type);
-    for ( const auto t : trigger_types ) ++ get_trigger_counter(t).completed;
-  } catch (AssignedTriggerDecisionNotFound const& err) {
-    ers::error(err);
+  for (size_t i = 0; i < n_tokens; ++i) {
+    try {
+      auto dec_ptr = app->complete_assignment(trigger_numbers[i], m_metadata_function);
+      for_each_trigger_type(dec_ptr->decision.trigger_type,
+                            [this](size_t bit) { ++m_completed_by_type[bit].value; });
+    } catch (AssignedTriggerDecisionNotFound const& err) {
+      ers::error(err);
+    }
+  }
+
+  if (health != nullptr) {
+    app->update_writer_health(*health);
   }
 
-  if (app_it->second->is_in_error()) {
-    TLOG() << TRBModuleAppUpdate(ERS_HERE, token.decision_destination, "Has reconnected");
-    app_it->second->set_in_error(false);
+  if (app->is_in_error()) {
+    TLOG() << TRBModuleAppUpdate(ERS_HERE, decision_destination, "Has reconnected");
+    app->set_in_error(false);
   }
 
+  // a single busy evaluation for the whole batch
   notify_trigger_if_needed();
 
-  m_waiting_for_token +=
-    std::chrono::duration_cast<std::chrono::microseconds>(callback_start - m_last_token_received).count();
-  m_last_token_received = std::chrono::steady_clock::now();
+  if (!m_running_status.load() && is_empty()) {
+    // wakes up do_stop, the lock prevents the notification from being lost
+    std::lock_guard<std::mutex> lk(m_drain_mutex);
+    m_drain_cv.notify_all();
+  }
+
+  // the token and batch callbacks run in different threads, and may overlap
+  auto callback_end = std::chrono::steady_clock::now();
+  auto previous_end = m_last_token_received.exchange(callback_end);
+  if (callback_start > previous_end) {
+    m_waiting_for_token +=
+      std::chrono::duration_cast<std::chrono::microseconds>(callback_start - previous_end).count();
+  }
   m_processing_token +=
-    std::chrono::duration_cast<std::chrono::microseconds>(m_last_token_received - callback_start).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(callback_end - callback_start).count();
 }
 
 bool
 DFOModule::is_busy() const
 {
-  for (auto& dfapp : m_dataflow_availability) {
-    if (!dfapp.second->is_busy())
-      return false;
-  }
-  return true;
+  // the DFO is busy when all the applications are busy or in error
+  return m_occupancy->busy_apps.load() >= m_occupancy->apps.load();
 }
 
 bool
 DFOModule::is_empty() const
 {
-  for (auto& dfapp : m_dataflow_availability) {
-    if (dfapp.second->used_slots() != 0)
-      return false;
-  }
-  return true;
+  return m_occupancy->used_slots.load() == 0;
 }
 
 size_t
 DFOModule::used_slots() const
 {
-  size_t total = 0;
-  for (auto& dfapp : m_dataflow_availability) {
-    total += dfapp.second->used_slots();
-  }
-  return total;
+  return m_occupancy->used_slots.load();
 }
 
 void
@@ -459,7 +762,10 @@ DFOModule::notify_trigger_if_needed() const
   // has changed.
   std::lock_guard<std::mutex> guard(m_notify_trigger_mutex);
 
-  bool busy = is_busy();
+  size_t capacity = m_occupancy->slot_capacity.load();
+  size_t used = m_occupancy->used_slots.load();
+  size_t free_slots = capacity > used ? capacity - used : 0;
+  bool busy = m_inhibit_predictor.evaluate(is_busy(), free_slots, std::chrono::steady_clock::now());
   if (busy == m_last_notified_busy.load())
     return;
 
@@ -521,7 +827,24 @@ DFOModule::dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment)
 void
 DFOModule::assign_trigger_decision(const std::shared_ptr<AssignedTriggerDecision>& assignment)
 {
-  m_dataflow_availability[assignment->connection_name]->add_assignment(assignment);
+  auto app = get_dataflow_app(assignment->connection_name);
+  if (!app) {
+    ers::error(TRBModuleAppUpdate(ERS_HERE, assignment->connection_name, "Assignment to an unknown application"));
+    return;
+  }
+
+  app->add_assignment(assignment);
+}
+
+DFOModule::trbd_ptr_t
+DFOModule::get_dataflow_app(const std::string& connection_name) const
+{
+  auto apps = dataflow_availability();
+  auto app_it = apps->find(connection_name);
+  if (app_it == apps->end())
+    return nullptr;
+
+  return app_it->second;
 }
 
 } // namespace dunedaq::dfmodules
@@ -9,7 +9,12 @@
 #ifndef DFMODULES_PLUGINS_DATAFLOWORCHESTRATOR_HPP_
 #define DFMODULES_PLUGINS_DATAFLOWORCHESTRATOR_HPP_
 
+#include "dfmodules/DataVolumeEstimator.hpp"
+#include "dfmodules/InhibitPredictor.hpp"
+#include "dfmodules/SchedulingPolicy.hpp"
+#include "dfmodules/TriggerDecisionTokenBatch.hpp"
 #include "dfmodules/TriggerRecordBuilderData.hpp"
+#include "dfmodules/TriggerRouter.hpp"
 
 #include "appmodel/DFOConf.hpp"
 
@@ -24,7 +29,11 @@
 
 #include "appfwk/DAQModule.hpp"
 #include "logging/Logging.hpp"
+#include "utilities/WorkerThread.hpp"
 
+#include <array>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -56,13 +65,28 @@ ERS_DECLARE_ISSUE(dfmodules,
                   ((uint32_t)trigger_number)((uint32_t)run_number)) // NOLINT(build/unsigned)
 ERS_DECLARE_ISSUE(dfmodules,
                   UnableToAssign,
-                  "TriggerDecision " << trigger_number << " could not be assigned",
-                  ((uint32_t)trigger_number)) // NOLINT(build/unsigned)
+                  "TriggerDecision " << trigger_number << " could not be assigned after " << attempts << " attempts",
+                  ((uint32_t)trigger_number)((size_t)attempts)) // NOLINT(build/unsigned)
 ERS_DECLARE_ISSUE(dfmodules,
                   AssignedToBusyApp,
                   "TriggerDecision " << trigger_number << " was assigned to DF app " << app << " that was busy with "
                                      << used_slots << " TDs",
                   ((uint32_t)trigger_number)((std::string)app)((size_t)used_slots)) // NOLINT(build/unsigned)
+ERS_DECLARE_ISSUE(dfmodules,
+                  DecisionsNotDrained,
+                  "DF app " << app << " still held " << outstanding << " TDs at the stop deadline, assigned between "
+                            << newest_age_ms << " and " << oldest_age_ms << " ms ago",
+                  ((std::string)app)((size_t)outstanding)((int64_t)newest_age_ms)((int64_t)oldest_age_ms))
+ERS_DECLARE_ISSUE(dfmodules,
+                  DataflowAppQuarantined,
+                  "DF app " << app << " is quarantined because of " << reason << ", " << outstanding
+                            << " TDs stay assigned to it",
+                  ((std::string)app)((std::string)reason)((size_t)outstanding))
+ERS_DECLARE_ISSUE(dfmodules,
+                  RoutingClassUnavailable,
+                  "TriggerDecision " << trigger_number << " of routing class " << routing_class
+                                     << " was assigned outside of the class, none of whose DF apps can take it",
+                  ((uint32_t)trigger_number)((std::string)routing_class)) // NOLINT(build/unsigned)
 // Re-enable coverage checking LCOV_EXCL_STOP
 
 namespace dfmodules {
@@ -90,12 +114,23 @@ public:
 
 protected:
   virtual std::shared_ptr<AssignedTriggerDecision> find_slot(const dfmessages::TriggerDecision& decision);
-  // find_slot operates on a round-robin logic
+  // find_slot delegates the choice of the application to the configured scheduling policy
+
+  using trbd_ptr_t = SchedulingPolicy::trbd_ptr_t;
+  using data_structure_t = SchedulingPolicy::data_structure_t;
+  using snapshot_t = std::shared_ptr<const data_structure_t>;
+
+  // The registry of the dataflow applications is copy-on-write:
+  // readers take a snapshot, writers (serialised by the mutex) publish a new map.
+  // The state of each application is protected within its TriggerRecordBuilderData
+  snapshot_t dataflow_availability() const { return std::atomic_load(&m_dataflow_availability); }
+  trbd_ptr_t get_dataflow_app(const std::string& connection_name) const;
+  snapshot_t m_dataflow_availability;
+  std::mutex m_dataflow_availability_mutex;
 
-  using trbd_ptr_t = std::shared_ptr<TriggerRecordBuilderData>;
-  using data_structure_t = std::map<std::string, trbd_ptr_t>;
-  data_structure_t m_dataflow_availability;
-  data_structure_t::iterator m_last_assignement_it;
+  std::unique_ptr<SchedulingPolicy> m_scheduling_policy;
+  TriggerRouter m_router; // its subsets of applications are updated with the registry
+  std::shared_ptr<TRBOccupancy> m_occupancy;
   std::function<void(nlohmann::json&)> m_metadata_function;
 
 private:
@@ -108,6 +143,12 @@ private:
   void generate_opmon_data() override;
 
   virtual void receive_trigger_complete_token(const dfmessages::TriggerDecisionToken&);
+  void receive_trigger_complete_token_batch(const TriggerDecisionTokenBatch&);
+  void complete_trigger_decisions(const std::string& decision_destination,
+                                  daqdataformats::run_number_t run_number,
+                                  const daqdataformats::trigger_number_t* trigger_numbers,
+                                  size_t n_tokens,
+                                  const WriterHealth* health);
   void receive_trigger_decision(const dfmessages::TriggerDecision&);
   virtual bool is_busy() const;
   bool is_empty() const;
@@ -119,44 +160,87 @@ private:
   // Configuration
   const appmodel::DFOConf* m_dfo_conf;
   std::chrono::milliseconds m_queue_timeout;
-  std::chrono::microseconds m_stop_timeout;
+  std::chrono::milliseconds m_stop_timeout;
   dunedaq::daqdataformats::run_number_t m_run_number;
 
   // Connections
   std::shared_ptr<iomanager::SenderConcept<dfmessages::TriggerInhibit>> m_busy_sender;
   std::string m_token_connection;
+  std::string m_token_batch_connection; // optional
   std::string m_td_connection;
   size_t m_td_send_retries;
   size_t m_busy_threshold;
   size_t m_free_threshold;
+  uint64_t m_busy_threshold_bytes; // NOLINT(build/unsigned)
+  uint64_t m_free_threshold_bytes; // NOLINT(build/unsigned)
+  DataVolumeEstimator m_volume_estimator;
+  WriterHealthLimits m_writer_health_limits;
+  LivenessLimits m_liveness_limits;
+  ThresholdTuning m_threshold_tuning;
+  std::chrono::milliseconds m_tuning_interval;
   std::vector<std::string> m_trb_conn_ids;
 
   // Coordination
   std::atomic<bool> m_running_status{ false };
   mutable std::atomic<bool> m_last_notified_busy{ false };
-  std::chrono::steady_clock::time_point m_last_token_received;
+  std::atomic<std::chrono::steady_clock::time_point> m_last_token_received;
   std::chrono::steady_clock::time_point m_last_td_received;
   mutable std::mutex m_notify_trigger_mutex;
+  mutable InhibitPredictor m_inhibit_predictor; // protected by the mutex above, except its counters
 
-  // Struct for statistic
-  struct TriggerData {
-    std::atomic<uint64_t> received{0};
-    std::atomic<uint64_t> completed{0};
+  // signalled at stop, when the last outstanding decision completes
+  std::mutex m_drain_mutex;
+  std::condition_variable m_drain_cv;
+
+  // Dispatching
+  // The TD callback only queues the decisions, the dispatcher thread
+  // assigns them and sends them to the dataflow applications
+  struct PendingDecision
+  {
+    dfmessages::TriggerDecision decision;
+    std::chrono::steady_clock::time_point received;
+  };
+  void do_dispatch(std::atomic<bool>&);
+  void dispatch_decision(const PendingDecision& pending);
+  // quarantines the applications that stopped making progress, and releases those that recovered
+  void check_liveness();
+  std::chrono::steady_clock::time_point m_last_liveness_check; // used by the dispatcher thread only
+  // adjusts the thresholds of each application to its completion rate, if enabled
+  void tune_thresholds();
+  std::chrono::steady_clock::time_point m_last_tuning; // used by the dispatcher thread only
+  // runs the liveness check and the threshold tuning when they are due
+  void run_periodic_checks();
+  // while a decision can not be assigned, the error is repeated at most this often
+  static constexpr std::chrono::seconds s_unable_to_assign_report_period{ 1 };
+  dunedaq::utilities::WorkerThread m_dispatcher;
+  std::deque<PendingDecision> m_pending_decisions;
+  std::mutex m_pending_mutex;
+  std::condition_variable m_pending_cv;
+
+  // Per trigger type statistics, indexed by the bit of the type in the trigger_type mask.
+  // Each counter has its own cache line, since they are updated by different threads
+  struct alignas(64) PaddedCounter
+  {
+    std::atomic<uint64_t> value{ 0 }; // NOLINT (build/unsigned)
   };
-  static std::set<trgdataformats::TriggerCandidateData::Type>
-  unpack_types( decltype(dfmessages::TriggerDecision::trigger_type) t) {
-    std::set<trgdataformats::TriggerCandidateData::Type> results;
+  static constexpr size_t s_max_trigger_types = 64;
+  using trigger_type_t = decltype(dfmessages::TriggerDecision::trigger_type);
+  template<typename F>
+  static void for_each_trigger_type(trigger_type_t t, F&& f)
+  {
     if (t == dfmessages::TypeDefaults::s_invalid_trigger_type)
-      return results;
-    const std::bitset<64> bits(t);
-    for( size_t i = 0; i < bits.size(); ++i ) {
-      if ( bits[i] ) results.insert((trgdataformats::TriggerCandidateData::Type)i);
+      return;
+    while (t != 0) {
+      f(static_cast<size_t>(__builtin_ctzll(t)));
+      t &= t - 1; // clear the lowest set bit
     }
-    return results;
   }
   
   // Statistics
   std::atomic<uint64_t> m_received_tokens{ 0 };      // NOLINT (build/unsigned)
+  std::atomic<uint64_t> m_received_token_batches{ 0 }; // NOLINT (build/unsigned)
+  std::atomic<uint64_t> m_routed_decisions{ 0 };     // NOLINT (build/unsigned)
+  std::atomic<uint64_t> m_routing_fallbacks{ 0 };    // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_sent_decisions{ 0 };       // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_received_decisions{ 0 };   // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_waiting_for_decision{ 0 }; // NOLINT (build/unsigned)
@@ -164,16 +248,10 @@ private:
   std::atomic<uint64_t> m_forwarding_decision{ 0 };  // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_waiting_for_token{ 0 };    // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_processing_token{ 0 };     // NOLINT (build/unsigned)
-  std::map<dunedaq::trgdataformats::TriggerCandidateData::Type, TriggerData> m_trigger_counters;
-  std::mutex m_trigger_counters_mutex;  // used to safely handle the map above
-  TriggerData & get_trigger_counter(trgdataformats::TriggerCandidateData::Type type) {
-    auto it = m_trigger_counters.find(type);
-    if (it != m_trigger_counters.end()) return it->second;
-    
-    std::lock_guard<std::mutex> guard(m_trigger_counters_mutex);
-    return m_trigger_counters[type];
-  }
-  
+  std::atomic<uint64_t> m_queued_time{ 0 };          // NOLINT (build/unsigned)
+  std::atomic<size_t> m_pending_size{ 0 };
+  std::array<PaddedCounter, s_max_trigger_types> m_received_by_type;
+  std::array<PaddedCounter, s_max_trigger_types> m_completed_by_type;
 };
 } // namespace dfmodules
 } // namespace dunedaq
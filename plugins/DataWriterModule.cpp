@@ -23,8 +23,11 @@
 #include "iomanager/IOManager.hpp"
 #include "rcif/cmd/Nljs.hpp"
 
+#include <hdf5.h>
+
 #include <algorithm>
 #include <cstdlib>
+#include <deque>
 #include <memory>
 #include <string>
 #include <thread>
@@ -51,7 +54,11 @@ DataWriterModule::DataWriterModule(const std::string& name)
   : dunedaq::appfwk::DAQModule(name)
   , m_queue_timeout(100)
   , m_data_storage_is_enabled(true)
-  , m_thread(std::bind(&DataWriterModule::do_work, this, std::placeholders::_1))
+  , m_token_batch_size(0)
+  , m_token_batch_window(0)
+  , m_assign_streams_by_size(false)
+  , m_receive_thread(std::bind(&DataWriterModule::do_receive, this, std::placeholders::_1))
+  , m_token_thread(std::bind(&DataWriterModule::do_tokens, this, std::placeholders::_1))
 {
   register_command("conf", &DataWriterModule::do_conf);
   register_command("start", &DataWriterModule::do_start);
@@ -75,9 +82,9 @@ DataWriterModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   if (inputs.size() != 1) {
     throw appfwk::CommandFailed(ERS_HERE, "init", get_name(), "Expected 1 input, got " + std::to_string(inputs.size()));
   }
-  if (outputs.size() != 1) {
+  if (outputs.size() != 1 && outputs.size() != 2) {
     throw appfwk::CommandFailed(
-      ERS_HERE, "init", get_name(), "Expected 1 output, got " + std::to_string(outputs.size()));  
+      ERS_HERE, "init", get_name(), "Expected 1 or 2 outputs, got " + std::to_string(outputs.size()));
   }
 
   m_module_configuration = mcfg;
@@ -87,7 +94,16 @@ DataWriterModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   if (inputs[0]->get_data_type() != datatype_to_string<std::unique_ptr<daqdataformats::TriggerRecord>>()) {
     throw InvalidQueueFatalError(ERS_HERE, get_name(), "TriggerRecord Input queue"); 
   }
-  if (outputs[0]->get_data_type() != datatype_to_string<dfmessages::TriggerDecisionToken>()) {
+  std::string token_connection = "";
+  std::string token_batch_connection = "";
+  for (auto con : outputs) {
+    if (con->get_data_type() == datatype_to_string<dfmessages::TriggerDecisionToken>()) {
+      token_connection = con->UID();
+    } else if (con->get_data_type() == datatype_to_string<TriggerDecisionTokenBatch>()) {
+      token_batch_connection = con->UID();
+    }
+  }
+  if (token_connection == "") {
     throw InvalidQueueFatalError(ERS_HERE, get_name(), "TriggerDecisionToken Output queue"); 
   }
 
@@ -115,7 +131,10 @@ DataWriterModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   // try to create the receiver to see test the connection anyway
   m_tr_receiver = iom -> get_receiver<std::unique_ptr<daqdataformats::TriggerRecord>>(m_trigger_record_connection);
 
-  m_token_output = iom->get_sender<dfmessages::TriggerDecisionToken>(outputs[0]->UID());
+  m_token_output = iom->get_sender<dfmessages::TriggerDecisionToken>(token_connection);
+  if (token_batch_connection != "") {
+    m_token_batch_output = iom->get_sender<TriggerDecisionTokenBatch>(token_batch_connection);
+  }
   
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
 }
@@ -131,7 +150,19 @@ DataWriterModule::generate_opmon_data() {
   dwi.set_new_records_written(m_records_written.exchange(0));
 //   dwi.bytes_output = m_bytes_output_tot.load();  MR: byte writing to be delegated to DataStorage
 //   dwi.new_bytes_output = m_bytes_output.exchange(0);  
-  dwi.set_writing_time_us(m_writing_us.exchange(0));
+  dwi.set_receive_time_us(m_receive_us.exchange(0));
+  dwi.set_receive_blocked_time_us(m_receive_blocked_us.exchange(0));
+  dwi.set_write_time_us(m_write_us.exchange(0));
+  dwi.set_token_time_us(m_token_us.exchange(0));
+  size_t write_queue_occupancy = 0;
+  for (auto& stream : m_streams) {
+    write_queue_occupancy += stream->queue.size();
+  }
+  dwi.set_write_queue_occupancy(write_queue_occupancy);
+  dwi.set_token_queue_occupancy(m_token_queue.size());
+  dwi.set_records_in_flight(m_records_in_flight.load());
+  dwi.set_tokens_sent(m_tokens_sent.exchange(0));
+  dwi.set_token_batches_sent(m_token_batches_sent.exchange(0));
 
   publish(std::move(dwi));
 }
@@ -151,19 +182,70 @@ DataWriterModule::do_conf(const data_t&)
   m_max_write_retry_time_usec = m_data_writer_conf->get_max_write_retry_time_ms() * 1000;
   m_write_retry_time_increase_factor = m_data_writer_conf->get_write_retry_time_increase_factor();
 
-  // create the DataStore instance here
-  try {
-    m_data_writer = make_data_store(m_data_writer_conf->get_data_store_params()->get_type(),
-                                    m_data_writer_conf->get_data_store_params()->UID(),
-                                    m_module_configuration, m_writer_identifier);
-    register_node("data_writer", m_data_writer);
-  } catch (const ers::Issue& excpt) {
-    throw UnableToConfigure(ERS_HERE, get_name(), excpt);
+  // if the batch connection exists, all the tokens go through it since the batches also
+  // carry the health of the writer. The initial token announcing the writer is never batched
+  m_token_batch_size = m_token_batch_output ? std::max<size_t>(1, m_data_writer_conf->get_token_batch_size()) : 0;
+  m_token_batch_window = std::chrono::milliseconds(m_data_writer_conf->get_token_batch_window_ms());
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": token_batch_size is " << m_token_batch_size
+                          << ", token_batch_window is " << m_token_batch_window.count() << " ms";
+
+  m_token_queue.set_capacity(m_data_writer_conf->get_pipeline_queue_size());
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": pipeline_queue_size is " << m_token_queue.capacity();
+
+  // without an explicit list of streams, the writer has a single one using the main DataStore parameters
+  auto store_confs = m_data_writer_conf->get_stream_data_store_params();
+  if (store_confs.empty()) {
+    store_confs.push_back(m_data_writer_conf->get_data_store_params());
+  }
+  const std::string& assignment = m_data_writer_conf->get_stream_assignment();
+  if (assignment != "round-robin" && assignment != "size") {
+    throw appfwk::CommandFailed(ERS_HERE, "conf", get_name(), "Unknown stream assignment \"" + assignment + "\"");
   }
+  m_assign_streams_by_size = (assignment == "size");
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": " << store_confs.size() << " output stream(s), assigned by "
+                          << assignment;
+
+  // the streams call the HDF5 library from their own threads. A thread-safe build serialises
+  // these calls behind its global lock, so HDF5 streams do not write in parallel
+  if (store_confs.size() > 1 &&
+      std::any_of(store_confs.begin(), store_confs.end(), [](const appmodel::DataStoreConf* conf) {
+        return conf->get_type() == "HDF5DataStore";
+      })) {
+    hbool_t threadsafe = false;
+    if (H5is_library_threadsafe(&threadsafe) < 0 || !threadsafe) {
+      throw HDF5LibraryNotThreadSafe(ERS_HERE, get_name(), "writing several streams with HDF5DataStores");
+    }
+    TLOG() << get_name() << ": the HDF5 library serialises the writes of the " << store_confs.size()
+           << " streams, which only scale with the RawDataStore";
+  }
+
+  // create the DataStore instances here
+  m_streams.clear();
+  for (size_t i = 0; i < store_confs.size(); ++i) {
+    auto stream = std::make_unique<WriteStream>();
+    // the writer identifier is part of the file names, so the streams never write to the same file
+    std::string identifier = m_writer_identifier;
+    if (store_confs.size() > 1) {
+      identifier += "_stream" + std::to_string(i);
+    }
+    try {
+      stream->data_store =
+        make_data_store(store_confs[i]->get_type(), store_confs[i]->UID(), m_module_configuration, identifier);
+      register_node(i == 0 ? "data_writer" : "data_writer_" + std::to_string(i), stream->data_store);
+    } catch (const ers::Issue& excpt) {
+      throw UnableToConfigure(ERS_HERE, get_name(), excpt);
+    }
+
+    // ensure that we have a valid dataWriter instance
+    if (stream->data_store.get() == nullptr) {
+      throw InvalidDataWriterModule(ERS_HERE, get_name());
+    }
+    stream->data_store->set_stream_info(i, store_confs.size());
 
-  // ensure that we have a valid dataWriter instance
-  if (m_data_writer.get() == nullptr) {
-    throw InvalidDataWriterModule(ERS_HERE, get_name());
+    stream->queue.set_capacity(m_data_writer_conf->get_pipeline_queue_size());
+    stream->thread = std::make_unique<dunedaq::utilities::WorkerThread>(
+      std::bind(&DataWriterModule::do_write, this, i, std::placeholders::_1));
+    m_streams.push_back(std::move(stream));
   }
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_conf() method";
@@ -205,20 +287,24 @@ DataWriterModule::do_start(const data_t& payload)
   if (m_data_storage_is_enabled) {
 
     // ensure that we have a valid dataWriter instance
-    if (m_data_writer.get() == nullptr) {
+    if (m_streams.empty()) {
       // this check is done essentially to notify the user
       // in case the "start" has been called before the "conf"
       ers::fatal(InvalidDataWriterModule(ERS_HERE, get_name()));
     }
     
     try {
-      m_data_writer->prepare_for_run(m_run_number, (start_params.production_vs_test == "TEST"));
+      for (auto& stream : m_streams) {
+        stream->data_store->prepare_for_run(m_run_number, (start_params.production_vs_test == "TEST"));
+      }
     } catch (const ers::Issue& excpt) {
       throw UnableToStart(ERS_HERE, get_name(), m_run_number, excpt);
     }
   }
 
   m_seqno_counts.clear();
+  m_pending_tokens.clear();
+  m_pending_tokens.reserve(m_token_batch_size);
   
   m_records_received = 0;
   m_records_received_tot = 0;
@@ -227,9 +313,22 @@ DataWriterModule::do_start(const data_t& payload)
   m_bytes_output = 0;
   m_bytes_output_tot = 0;
 
+  m_records_in_flight = 0;
+  m_next_stream = 0;
+  for (auto& stream : m_streams) {
+    stream->queue.clear();
+    stream->queued_bytes = 0;
+  }
+  m_token_queue.clear();
+
   m_running.store(true);
 
-  m_thread.start_working_thread(get_name());
+  // the stages are started from the last one
+  m_token_thread.start_working_thread("dw-token");
+  for (size_t i = 0; i < m_streams.size(); ++i) {
+    m_streams[i]->thread->start_working_thread("dw-write-" + std::to_string(i));
+  }
+  m_receive_thread.start_working_thread("dw-receive");
   //iomanager::IOManager::get()->add_callback<std::unique_ptr<daqdataformats::TriggerRecord>>( m_trigger_record_connection,
   //											     bind( &DataWriterModule::receive_trigger_record, this, std::placeholders::_1) );
 
@@ -243,17 +342,24 @@ DataWriterModule::do_stop(const data_t& /*args*/)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
 
   m_running.store(false);
-  m_thread.stop_working_thread(); 
+  // the stages are stopped from the first one, each of them empties its input queue before exiting
+  m_receive_thread.stop_working_thread();
+  for (auto& stream : m_streams) {
+    stream->thread->stop_working_thread();
+  }
+  m_token_thread.stop_working_thread();
   //iomanager::IOManager::get()->remove_callback<std::unique_ptr<daqdataformats::TriggerRecord>>( m_trigger_record_connection );
 
   // 04-Feb-2021, KAB: added this call to allow DataStore to finish up with this run.
   // I've put this call fairly late in this method so that any draining of queues
   // (or whatever) can take place before we finalize things in the DataStore.
   if (m_data_storage_is_enabled) {
-    try {
-      m_data_writer->finish_with_run(m_run_number);
-    } catch (const std::exception& excpt) {
-      ers::error(ProblemDuringStop(ERS_HERE, get_name(), m_run_number, excpt));
+    for (auto& stream : m_streams) {
+      try {
+        stream->data_store->finish_with_run(m_run_number);
+      } catch (const std::exception& excpt) {
+        ers::error(ProblemDuringStop(ERS_HERE, get_name(), m_run_number, excpt));
+      }
     }
   }
 
@@ -266,8 +372,8 @@ DataWriterModule::do_scrap(const data_t& /*payload*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
 
-  // clear/reset the DataStore instance here
-  m_data_writer.reset();
+  // clear/reset the DataStore instances here
+  m_streams.clear();
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
 }
@@ -277,6 +383,8 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": receiving a new TR ptr";
 
+  auto start_time = std::chrono::steady_clock::now();
+  ++m_records_in_flight;
   ++m_records_received;
   ++m_records_received_tot;
   TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Obtained the TriggerRecord for trigger number "
@@ -289,6 +397,7 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
     ers::error(InvalidRunNumber(ERS_HERE, get_name(), "TriggerRecord", trigger_record_ptr->get_header_ref().get_run_number(),
                                 m_run_number, trigger_record_ptr->get_header_ref().get_trigger_number(),
                                 trigger_record_ptr->get_header_ref().get_sequence_number()));
+    --m_records_in_flight;
     return;
   }
 
@@ -296,54 +405,117 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
   // In this "if" statement, I deliberately compare the result of (N mod prescale) to 1
   // instead of zero, since I think that it would be nice to always get the first event
   // written out.
-  if (m_data_storage_prescale <= 1 || ((m_records_received_tot.load() % m_data_storage_prescale) == 1)) {
-    
-    if (m_data_storage_is_enabled) {
-
-      std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-      
-      bool should_retry = true;
-      size_t retry_wait_usec = m_min_write_retry_time_usec;
-      do {
-	should_retry = false;
-	try {
-	  m_data_writer->write(*trigger_record_ptr);
-	  ++m_records_written;
-	  ++m_records_written_tot;
-	  m_bytes_output += trigger_record_ptr->get_total_size_bytes();
-	  m_bytes_output_tot += trigger_record_ptr->get_total_size_bytes();
-	} catch (const RetryableDataStoreProblem& excpt) {
-	  should_retry = true;
-	  ers::error(DataWritingProblem(ERS_HERE,
-					get_name(),
-					trigger_record_ptr->get_header_ref().get_trigger_number(),
-					trigger_record_ptr->get_header_ref().get_sequence_number(),
-					trigger_record_ptr->get_header_ref().get_run_number(),
-					excpt));
-	  if (retry_wait_usec > m_max_write_retry_time_usec) {
-	    retry_wait_usec = m_max_write_retry_time_usec;
-	  }
-	  usleep(retry_wait_usec);
-	  retry_wait_usec *= m_write_retry_time_increase_factor;
-	} catch (const std::exception& excpt) {
-	  ers::error(DataWritingProblem(ERS_HERE,
-					get_name(),
-					trigger_record_ptr->get_header_ref().get_trigger_number(),
-					trigger_record_ptr->get_header_ref().get_sequence_number(),
-					trigger_record_ptr->get_header_ref().get_run_number(),
-					excpt));
-	}
-      } while (should_retry && m_running.load());
-
-      std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
-      auto writing_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-      m_writing_us += writing_time.count();
-    } //  if m_data_storage_is_enabled
+  PendingRecord pending;
+  pending.store = m_data_storage_is_enabled &&
+                  (m_data_storage_prescale <= 1 || ((m_records_received_tot.load() % m_data_storage_prescale) == 1));
+  pending.record = std::move(trigger_record_ptr);
+
+  auto push_time = std::chrono::steady_clock::now();
+  if (!pending.store) {
+    // nothing to write: the record goes straight to the token stage
+    const auto& header = pending.record->get_header_ref();
+    push_written_record(
+      WrittenRecord{ header.get_trigger_number(), header.get_sequence_number(), header.get_max_sequence_number() });
+  } else {
+    size_t record_size = pending.record->get_total_size_bytes();
+    auto& stream = *m_streams[select_stream(record_size)];
+    stream.queued_bytes += record_size;
+
+    // a full queue means that the write stage is behind: wait for it rather than dropping the record
+    while (!stream.queue.push(std::move(pending), m_queue_timeout)) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": the write queue is full, waiting for the write stage";
+    }
   }
-  
-  bool send_trigger_complete_message = m_running.load();
-  if (trigger_record_ptr->get_header_ref().get_max_sequence_number() > 0) {
-    daqdataformats::trigger_number_t trigno = trigger_record_ptr->get_header_ref().get_trigger_number();
+  auto end_time = std::chrono::steady_clock::now();
+
+  m_receive_blocked_us += std::chrono::duration_cast<std::chrono::microseconds>(end_time - push_time).count();
+  m_receive_us += std::chrono::duration_cast<std::chrono::microseconds>(push_time - start_time).count();
+}
+
+size_t
+DataWriterModule::select_stream(size_t record_size)
+{
+  if (m_streams.size() == 1) {
+    return 0;
+  }
+
+  // the stream with the least data waiting to be written. Ties go to the next one in round-robin order,
+  // which keeps the assignment even when the write stages keep up
+  size_t selected = m_next_stream;
+  if (m_assign_streams_by_size) {
+    uint64_t least_bytes = m_streams[selected]->queued_bytes.load(); // NOLINT(build/unsigned)
+    for (size_t i = 1; i < m_streams.size(); ++i) {
+      size_t candidate = (m_next_stream + i) % m_streams.size();
+      auto bytes = m_streams[candidate]->queued_bytes.load();
+      if (bytes < least_bytes) {
+        least_bytes = bytes;
+        selected = candidate;
+      }
+    }
+  }
+  m_next_stream = (selected + 1) % m_streams.size();
+
+  TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": assigning a record of " << record_size << " bytes to stream "
+                              << selected;
+  return selected;
+}
+
+bool
+DataWriterModule::write_trigger_record(DataStore& data_store, const daqdataformats::TriggerRecord& record)
+{
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+  bool stored = false;
+  bool should_retry = true;
+  size_t retry_wait_usec = m_min_write_retry_time_usec;
+  do {
+    should_retry = false;
+    try {
+      data_store.write(record);
+      stored = true;
+      ++m_records_written;
+      ++m_records_written_tot;
+      m_bytes_output += record.get_total_size_bytes();
+      m_bytes_output_tot += record.get_total_size_bytes();
+    } catch (const RetryableDataStoreProblem& excpt) {
+      should_retry = true;
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    record.get_header_ref().get_trigger_number(),
+                                    record.get_header_ref().get_sequence_number(),
+                                    record.get_header_ref().get_run_number(),
+                                    excpt));
+      if (retry_wait_usec > m_max_write_retry_time_usec) {
+        retry_wait_usec = m_max_write_retry_time_usec;
+      }
+      usleep(retry_wait_usec);
+      retry_wait_usec *= m_write_retry_time_increase_factor;
+    } catch (const std::exception& excpt) {
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    record.get_header_ref().get_trigger_number(),
+                                    record.get_header_ref().get_sequence_number(),
+                                    record.get_header_ref().get_run_number(),
+                                    excpt));
+    }
+  } while (should_retry && m_running.load());
+
+  std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+  auto writing_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+  m_write_us += writing_time.count();
+  m_health_writing_us += writing_time.count();
+  ++m_health_writes;
+  return stored;
+}
+
+void
+DataWriterModule::handle_written_record(const WrittenRecord& written)
+{
+  // the records still queued at stop are drained by the stages, and their tokens are sent like
+  // the others: the DFO would otherwise report their decisions as never completed
+  bool send_trigger_complete_message = true;
+  if (written.max_sequence_number > 0) {
+    daqdataformats::trigger_number_t trigno = written.trigger_number;
     if (m_seqno_counts.count(trigno) > 0) {
       ++m_seqno_counts[trigno];
     } else {
@@ -351,7 +523,7 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
     }
     // in the following comparison GT (>) is used since the counts are one-based and the
     // max sequence number is zero-based.
-    if (m_seqno_counts[trigno] > trigger_record_ptr->get_header_ref().get_max_sequence_number()) {
+    if (m_seqno_counts[trigno] > written.max_sequence_number) {
       m_seqno_counts.erase(trigno);
     } else {
       // Using const .count and .at to avoid reintroducing element to map
@@ -361,45 +533,198 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
       send_trigger_complete_message = false;
     }
   }
+  --m_records_in_flight;
   if (send_trigger_complete_message) {
     TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Pushing the TriggerDecisionToken for trigger number "
-				<< trigger_record_ptr->get_header_ref().get_trigger_number()
-				<< " onto the relevant output queue";
-    dfmessages::TriggerDecisionToken token;
-    token.run_number = m_run_number;
-    token.trigger_number = trigger_record_ptr->get_header_ref().get_trigger_number();
-    token.decision_destination = m_trigger_decision_connection;
-
-    bool wasSentSuccessfully = false;
-    do { 
+				<< written.trigger_number << " onto the relevant output queue";
+    complete_trigger_decision(written.trigger_number);
+  }
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": operations completed for TR";
+}
+
+void
+DataWriterModule::complete_trigger_decision(daqdataformats::trigger_number_t trigger_number)
+{
+  if (m_token_batch_size > 0) {
+    if (m_pending_tokens.empty()) {
+      m_first_pending_token_time = std::chrono::steady_clock::now();
+    }
+    m_pending_tokens.push_back(trigger_number);
+    if (m_pending_tokens.size() >= m_token_batch_size) {
+      send_token_batch();
+    }
+    return;
+  }
+
+  dfmessages::TriggerDecisionToken token;
+  token.run_number = m_run_number;
+  token.trigger_number = trigger_number;
+  token.decision_destination = m_trigger_decision_connection;
+
+  bool wasSentSuccessfully = false;
+  do { 
+    try {
+      m_token_output -> send( std::move(token), m_queue_timeout );
+      wasSentSuccessfully = true;
+      ++m_tokens_sent;
+    } catch (const ers::Issue& excpt) {
+      std::ostringstream oss_warn;
+      oss_warn << "Send with sender \"" << m_token_output -> get_name() << "\" failed";
+      ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+    }
+  } while (!wasSentSuccessfully && m_running.load());
+}
+
+void
+DataWriterModule::send_token_batch()
+{
+  if (m_pending_tokens.empty()) {
+    return;
+  }
+
+  TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Pushing a batch of " << m_pending_tokens.size()
+                              << " TriggerDecisionTokens onto the relevant output queue";
+  TriggerDecisionTokenBatch batch;
+  batch.run_number = m_run_number;
+  batch.decision_destination = m_trigger_decision_connection;
+  batch.trigger_numbers = m_pending_tokens;
+  auto n_tokens = m_pending_tokens.size();
+  m_pending_tokens.clear();
+
+  auto writes = m_health_writes.exchange(0);
+  auto writing_us = m_health_writing_us.exchange(0);
+  batch.health.write_latency_us = writes > 0 ? writing_us / writes : 0;
+  // the most constraining of the streams
+  batch.health.disk_free_fraction = -1.;
+  for (auto& stream : m_streams) {
+    float fraction = stream->data_store->get_free_space_fraction();
+    if (fraction >= 0. && (batch.health.disk_free_fraction < 0. || fraction < batch.health.disk_free_fraction)) {
+      batch.health.disk_free_fraction = fraction;
+    }
+  }
+  batch.health.queue_depth = m_records_in_flight.load();
+
+  bool wasSentSuccessfully = false;
+  do {
+    try {
+      m_token_batch_output->send(std::move(batch), m_queue_timeout);
+      wasSentSuccessfully = true;
+      m_tokens_sent += n_tokens;
+      ++m_token_batches_sent;
+    } catch (const ers::Issue& excpt) {
+      std::ostringstream oss_warn;
+      oss_warn << "Send with sender \"" << m_token_batch_output->get_name() << "\" failed";
+      ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+    }
+  } while (!wasSentSuccessfully && m_running.load());
+}
+
+void
+DataWriterModule::do_receive(std::atomic<bool>& running_flag)
+{
+  while (running_flag.load()) {
+    try {
+      std::unique_ptr<daqdataformats::TriggerRecord> tr = m_tr_receiver->receive(std::chrono::milliseconds(10));
+      receive_trigger_record(tr);
+    } catch (const iomanager::TimeoutExpired& excpt) {
+    } catch (const ers::Issue& excpt) {
+      ers::warning(excpt);
+    }
+  }
+}
+
+void
+DataWriterModule::push_written_record(WrittenRecord&& written)
+{
+  while (!m_token_queue.push(std::move(written), m_queue_timeout)) {
+    TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": the token queue is full, waiting for the token stage";
+  }
+}
+
+void
+DataWriterModule::release_completed_records(const DataStore& data_store, incomplete_records_t& records)
+{
+  if (records.empty())
+    return;
+  uint64_t completed_writes = data_store.get_completed_writes(); // NOLINT(build/unsigned)
+  while (!records.empty() && records.front().first <= completed_writes) {
+    push_written_record(std::move(records.front().second));
+    records.pop_front();
+  }
+}
+
+void
+DataWriterModule::do_write(size_t stream_index, std::atomic<bool>& running_flag)
+{
+  auto& stream = *m_streams[stream_index];
+  auto& data_store = *stream.data_store;
+  bool asynchronous = data_store.writes_asynchronously();
+  // the writes of the previous runs are all complete, the count continues from there
+  uint64_t stored_records = data_store.get_completed_writes(); // NOLINT(build/unsigned)
+  incomplete_records_t incomplete_records;
+
+  // the data held back by the DataStore is written out when there is nothing more to write for now,
+  // and at least every kFlushInterval, rather than waiting for more records
+  constexpr auto kFlushInterval = std::chrono::milliseconds(10);
+  auto last_flush_time = std::chrono::steady_clock::now();
+
+  PendingRecord pending;
+  while (running_flag.load() || !stream.queue.empty() || !incomplete_records.empty()) {
+    bool idle = !stream.queue.pop(pending, std::chrono::milliseconds(10));
+    if (!idle) {
+      const auto& header = pending.record->get_header_ref();
+      WrittenRecord written{ header.get_trigger_number(), header.get_sequence_number(), header.get_max_sequence_number() };
+      size_t record_size = pending.record->get_total_size_bytes();
+      bool stored = write_trigger_record(data_store, *pending.record);
+      stream.queued_bytes -= record_size;
+      // the record is not needed by the token stage
+      pending.record.reset();
+
+      if (asynchronous && stored) {
+        incomplete_records.emplace_back(++stored_records, std::move(written));
+      } else {
+        push_written_record(std::move(written));
+      }
+    }
+
+    if (!incomplete_records.empty() && (idle || std::chrono::steady_clock::now() - last_flush_time >= kFlushInterval)) {
+      last_flush_time = std::chrono::steady_clock::now();
       try {
-	m_token_output -> send( std::move(token), m_queue_timeout );
-	wasSentSuccessfully = true;
+        data_store.flush();
       } catch (const ers::Issue& excpt) {
-	std::ostringstream oss_warn;
-	oss_warn << "Send with sender \"" << m_token_output -> get_name() << "\" failed";
-	ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+        ers::error(excpt);
+        // the DataStore may never complete these writes
+        for (auto& record : incomplete_records) {
+          push_written_record(std::move(record.second));
+        }
+        incomplete_records.clear();
       }
-    } while (!wasSentSuccessfully && m_running.load());
-
+    }
+    release_completed_records(data_store, incomplete_records);
   }
-  
-  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": operations completed for TR";
-} // NOLINT(readability/fn_size)
+}
 
 void
-DataWriterModule::do_work(std::atomic<bool>& running_flag) {
-  while (running_flag.load()) {
-	  try {
-		std::unique_ptr<daqdataformats::TriggerRecord> tr = m_tr_receiver-> receive(std::chrono::milliseconds(10));   
-                receive_trigger_record(tr);
-	  }
-	  catch(const iomanager::TimeoutExpired& excpt) {
-	  }
-	  catch(const ers::Issue & excpt) {
-		ers::warning(excpt);
-	  }
+DataWriterModule::do_tokens(std::atomic<bool>& running_flag)
+{
+  WrittenRecord written;
+  while (running_flag.load() || !m_token_queue.empty()) {
+    if (m_token_queue.pop(written, std::chrono::milliseconds(10))) {
+      auto start_time = std::chrono::steady_clock::now();
+      handle_written_record(written);
+      m_token_us +=
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    // partially filled batches are sent once their oldest token reaches the time window
+    if (!m_pending_tokens.empty() &&
+        std::chrono::steady_clock::now() - m_first_pending_token_time >= m_token_batch_window) {
+      send_token_batch();
+    }
   }
+
+  send_token_batch();
 }
 
 } // namespace dfmodules
@@ -9,7 +9,9 @@
 #ifndef DFMODULES_PLUGINS_DATAWRITER_HPP_
 #define DFMODULES_PLUGINS_DATAWRITER_HPP_
 
+#include "dfmodules/BoundedQueue.hpp"
 #include "dfmodules/DataStore.hpp"
+#include "dfmodules/TriggerDecisionTokenBatch.hpp"
 
 #include "appfwk/DAQModule.hpp"
 #include "appmodel/DataWriterConf.hpp"
@@ -20,9 +22,11 @@
 #include "utilities/WorkerThread.hpp"
 
 #include <chrono>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace dunedaq {
@@ -55,8 +59,35 @@ private:
   void do_stop(const data_t&);
   void do_scrap(const data_t&);
 
-  // Callback
+  // Pipeline
+  // The records go through three stages, each in its own thread and linked by bounded queues:
+  // the receive stage takes them from the input connection and applies the prescale,
+  // the write stage stores them and the token stage tells the DFO about the completed decisions.
+  // There is one write stage per output stream, each with its own DataStore.
+  // The DataStores that write asynchronously return before the data is on disk: the write stage
+  // holds the records back until their writes complete, and only then passes them to the token stage.
+  struct PendingRecord
+  {
+    std::unique_ptr<daqdataformats::TriggerRecord> record;
+    bool store{ false };
+  };
+  struct WrittenRecord
+  {
+    daqdataformats::trigger_number_t trigger_number{ 0 };
+    daqdataformats::sequence_number_t sequence_number{ 0 };
+    daqdataformats::sequence_number_t max_sequence_number{ 0 };
+  };
+
   void receive_trigger_record(std::unique_ptr<daqdataformats::TriggerRecord>&);
+  // Returns whether the record was stored
+  bool write_trigger_record(DataStore& data_store, const daqdataformats::TriggerRecord& record);
+  void handle_written_record(const WrittenRecord& written);
+  void complete_trigger_decision(daqdataformats::trigger_number_t trigger_number);
+  void send_token_batch();
+  void push_written_record(WrittenRecord&& written);
+  // Records waiting for the completion of their writes, with the count of completed writes that includes them
+  using incomplete_records_t = std::deque<std::pair<uint64_t, WrittenRecord>>; // NOLINT(build/unsigned)
+  void release_completed_records(const DataStore& data_store, incomplete_records_t& records);
   std::atomic<bool> m_running = false;
 
   // Configuration
@@ -72,6 +103,9 @@ private:
   size_t m_min_write_retry_time_usec;
   size_t m_max_write_retry_time_usec;
   int m_write_retry_time_increase_factor;
+  size_t m_token_batch_size;                    // tokens are sent individually if <= 1
+  std::chrono::milliseconds m_token_batch_window; // maximum delay of a token in a batch
+  bool m_assign_streams_by_size;                  // round-robin otherwise
 
   // Connections
   std::string m_trigger_record_connection;
@@ -82,11 +116,30 @@ private:
   std::shared_ptr<token_sender_t> m_token_output;
   std::string m_trigger_decision_connection;
 
-  // Worker(s)
-  dunedaq::utilities::WorkerThread m_thread;
-  void do_work(std::atomic<bool>&);
+  using token_batch_sender_t = iomanager::SenderConcept<TriggerDecisionTokenBatch>;
+  std::shared_ptr<token_batch_sender_t> m_token_batch_output; // optional
+  std::vector<daqdataformats::trigger_number_t> m_pending_tokens;
+  std::chrono::steady_clock::time_point m_first_pending_token_time;
 
-  std::shared_ptr<DataStore> m_data_writer;
+  // Worker(s)
+  dunedaq::utilities::WorkerThread m_receive_thread;
+  dunedaq::utilities::WorkerThread m_token_thread;
+  void do_receive(std::atomic<bool>&);
+  void do_write(size_t stream_index, std::atomic<bool>&);
+  void do_tokens(std::atomic<bool>&);
+  BoundedQueue<WrittenRecord> m_token_queue;
+
+  // Output streams
+  struct WriteStream
+  {
+    std::shared_ptr<DataStore> data_store;
+    BoundedQueue<PendingRecord> queue;
+    std::unique_ptr<dunedaq::utilities::WorkerThread> thread;
+    std::atomic<uint64_t> queued_bytes = { 0 }; // NOLINT(build/unsigned)
+  };
+  std::vector<std::unique_ptr<WriteStream>> m_streams;
+  size_t m_next_stream = 0; // used by the receive stage only
+  size_t select_stream(size_t record_size);
 
   // Metrics
   std::atomic<uint64_t> m_records_received = { 0 };     // NOLINT(build/unsigned)
@@ -95,11 +148,21 @@ private:
   std::atomic<uint64_t> m_records_written_tot = { 0 };  // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_bytes_output = { 0 };         // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_bytes_output_tot = { 0 };     // NOLINT(build/unsigned)
-  std::atomic<uint64_t> m_writing_us = { 0 };           // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_receive_us = { 0 };           // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_receive_blocked_us = { 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_write_us = { 0 };             // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_token_us = { 0 };             // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_tokens_sent = { 0 };          // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_token_batches_sent = { 0 };   // NOLINT(build/unsigned)
+
+  // Health reported to the DFO with each batch of tokens
+  std::atomic<uint64_t> m_health_writing_us = { 0 };    // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_health_writes = { 0 };        // NOLINT(build/unsigned)
+  std::atomic<size_t> m_records_in_flight = { 0 };
 
   
   // Other
-  std::map<daqdataformats::trigger_number_t, size_t> m_seqno_counts;
+  std::map<daqdataformats::trigger_number_t, size_t> m_seqno_counts; // used by the token stage only
 
   inline double elapsed_seconds(std::chrono::steady_clock::time_point then,
                                 std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const
@@ -117,6 +180,13 @@ ERS_DECLARE_ISSUE_BASE(dfmodules,
                        ((std::string)name),
                        ERS_EMPTY)
 
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       HDF5LibraryNotThreadSafe,
+                       appfwk::GeneralDAQModuleIssue,
+                       "The HDF5 library is not thread-safe, which " << usage << " requires",
+                       ((std::string)name),
+                       ((std::string)usage))
+
 ERS_DECLARE_ISSUE_BASE(dfmodules,
                        DataWritingProblem,
                        appfwk::GeneralDAQModuleIssue,
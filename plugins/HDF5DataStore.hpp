@@ -13,13 +13,22 @@
 #define DFMODULES_PLUGINS_HDF5DATASTORE_HPP_
 
 #include "HDF5FileUtils.hpp"
+#include "dfmodules/CommonIssues.hpp"
 #include "dfmodules/DataStore.hpp"
+#include "dfmodules/FileNameTemplate.hpp"
+#include "dfmodules/FilePreallocation.hpp"
+#include "dfmodules/FileRotation.hpp"
+#include "dfmodules/FragmentCompressor.hpp"
+#include "dfmodules/FreeSpaceTracker.hpp"
+#include "dfmodules/HDF5FileTuning.hpp"
 #include "dfmodules/opmon/DataStore.pb.h"
 
 #include "hdf5libs/HDF5RawDataFile.hpp"
 
 #include "appmodel/DataStoreConf.hpp"
 #include "appmodel/FilenameParams.hpp"
+#include "appmodel/FragmentCompressionConf.hpp"
+#include "appmodel/HDF5TuningParams.hpp"
 #include "confmodel/DetectorConfig.hpp"
 #include "confmodel/Session.hpp"
 
@@ -29,7 +38,12 @@
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/lexical_cast.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <string>
@@ -43,21 +57,6 @@ namespace dunedaq {
 /**
  * @brief A ERS Issue to report an HDF5 exception
  */
-ERS_DECLARE_ISSUE_BASE(dfmodules,
-                       InvalidOperationMode,
-                       appfwk::GeneralDAQModuleIssue,
-                       "Selected operation mode \"" << selected_operation
-                                                    << "\" is NOT supported. Please update the configuration file.",
-                       ((std::string)name),
-                       ((std::string)selected_operation))
-
-ERS_DECLARE_ISSUE_BASE(dfmodules,
-                       FileOperationProblem,
-                       appfwk::GeneralDAQModuleIssue,
-                       "A problem was encountered when opening or closing file \"" << filename << "\"",
-                       ((std::string)name),
-                       ((std::string)filename))
-
 ERS_DECLARE_ISSUE_BASE(dfmodules,
                        InvalidHDF5Dataset,
                        appfwk::GeneralDAQModuleIssue,
@@ -66,23 +65,6 @@ ERS_DECLARE_ISSUE_BASE(dfmodules,
                        ((std::string)name),
                        ((std::string)data_set)((std::string)filename))
 
-ERS_DECLARE_ISSUE_BASE(dfmodules,
-                       InvalidOutputPath,
-                       appfwk::GeneralDAQModuleIssue,
-                       "The specified output destination, \"" << output_path
-                                                              << "\", is not a valid file system path on this server.",
-                       ((std::string)name),
-                       ((std::string)output_path))
-
-ERS_DECLARE_ISSUE_BASE(dfmodules,
-                       InsufficientDiskSpace,
-                       appfwk::GeneralDAQModuleIssue,
-                       "There is insufficient free space on the disk associated with output file path \""
-                         << path << "\". There are " << free_bytes << " bytes free, and the "
-                         << "required minimum is " << needed_bytes << " bytes based on " << criteria << ".",
-                       ((std::string)name),
-                       ((std::string)path)((size_t)free_bytes)((size_t)needed_bytes)((std::string)criteria))
-
 ERS_DECLARE_ISSUE_BASE(dfmodules,
                        EmptyDataBlockList,
                        appfwk::GeneralDAQModuleIssue,
@@ -119,6 +101,8 @@ public:
     : DataStore(name)
     , m_basic_name_of_open_file("")
     , m_open_flags_of_open_file(0)
+    , m_run_number_of_open_file(0)
+    , m_file_index_of_open_file(0)
     , m_run_number(0)
     , m_writer_identifier(writer_name)
   {
@@ -138,6 +122,72 @@ public:
     if (m_free_space_safety_factor_for_write < 1.1) {
       m_free_space_safety_factor_for_write = 1.1;
     }
+    m_free_space_config.refresh_interval =
+      std::chrono::milliseconds(m_config_params->get_free_space_refresh_interval_ms());
+
+    // the files are preallocated up to the size at which they are rotated. Unlike the raw files,
+    // only when asked for, as no gain was measured for the HDF5 files
+    m_preallocate_bytes =
+      m_config_params->get_preallocate_files() == "on" && m_operation_mode == "all-per-file" ? m_max_file_size : 0;
+
+    // optional compression of the fragment payloads, with a codec per fragment type
+    auto compression_confs = m_config_params->get_fragment_compression();
+    if (!compression_confs.empty()) {
+      FragmentCompressor::Config compression_config;
+      compression_config.threads = m_config_params->get_compression_threads();
+      for (auto compression_conf : compression_confs) {
+        auto type = daqdataformats::string_to_fragment_type(compression_conf->get_fragment_type());
+        if (type == daqdataformats::FragmentType::kUnknown) {
+          throw InvalidCompressionConfig(ERS_HERE,
+                                         "unknown fragment type \"" + compression_conf->get_fragment_type() + "\"");
+        }
+        compression_config.settings[type] = { FragmentCompressor::codec_from_string(compression_conf->get_codec()),
+                                              compression_conf->get_level() };
+      }
+      m_compressor = std::make_unique<FragmentCompressor>(compression_config);
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": compressing the fragments as " << m_compressor->describe();
+    }
+
+    // optional HDF5 file access properties, applied when the files are opened
+    auto tuning_params = m_config_params->get_hdf5_tuning_params();
+    if (tuning_params != nullptr) {
+      m_file_tuning.metadata_cache_size = tuning_params->get_metadata_cache_size();
+      m_file_tuning.alignment = tuning_params->get_alignment();
+      m_file_tuning.alignment_threshold = tuning_params->get_alignment_threshold();
+      m_file_tuning.metadata_block_size = tuning_params->get_metadata_block_size();
+      m_file_tuning.core_driver = tuning_params->get_core_driver();
+      m_file_tuning.core_driver_increment = tuning_params->get_core_driver_increment();
+      m_file_tuning.libver_low_bound = tuning_params->get_libver_low_bound();
+      m_file_tuning.validate();
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": HDF5 file tuning " << m_file_tuning.describe();
+    }
+
+    // the next file is opened, and the previous ones closed, in the background. The HDF5 library
+    // is then called from two threads, which needs a thread-safe build of it
+    if (m_config_params->get_background_file_rotation() && !library_is_threadsafe()) {
+      TLOG() << get_name() << ": the HDF5 library is not thread-safe, the files are opened and closed by the "
+             << "writing thread";
+    } else if (m_config_params->get_background_file_rotation()) {
+      m_file_rotation = std::make_unique<FileRotation<hdf5libs::HDF5RawDataFile>>(
+        [this](const FileKey& key) { return open_file(key); },
+        [this](std::unique_ptr<hdf5libs::HDF5RawDataFile> file_handle, bool unused) {
+          close_file(std::move(file_handle), unused);
+        });
+    }
+
+    // the parts of the file names that only depend on the configuration
+    auto filename_params = m_config_params->get_filename_params();
+    FileNameTemplate::Params name_params;
+    name_params.directory_path = m_path;
+    name_params.operational_environment = m_operational_environment;
+    name_params.file_type_prefix = filename_params->get_file_type_prefix();
+    name_params.run_number_prefix = filename_params->get_run_number_prefix();
+    name_params.digits_for_run_number = filename_params->get_digits_for_run_number();
+    name_params.file_index_prefix = filename_params->get_file_index_prefix();
+    name_params.digits_for_file_index = filename_params->get_digits_for_file_index();
+    name_params.writer_identifier = m_writer_identifier;
+    name_params.extension = ".hdf5";
+    m_file_name_template = FileNameTemplate(name_params);
 
     m_file_index = 0;
     m_recorded_size = 0;
@@ -157,6 +207,9 @@ public:
     if (retval != 0) {
       ers::warning(InvalidOutputPath(ERS_HERE, get_name(), m_path));
     }
+
+    // outside of runs, the free space is checked at every write
+    m_free_space.start(m_path, FreeSpaceTracker::Config());
   }
 
   /**
@@ -166,12 +219,12 @@ public:
    * defined in the configuration file.
    *
    */
-  virtual void write(const daqdataformats::TriggerRecord& tr)
+  virtual void write(const daqdataformats::TriggerRecord& record)
   {
-
-    // check if there is sufficient space for this record
-    size_t current_free_space = get_free_space(m_path);
-    size_t tr_size = tr.get_total_size_bytes();
+    // check if there is sufficient space for this record. The uncompressed size is an upper bound,
+    // which spares compressing the record again at every retry while the disk is full
+    size_t tr_size = record.get_total_size_bytes();
+    size_t current_free_space = m_free_space.available(m_free_space_safety_factor_for_write * tr_size);
     if (current_free_space < (m_free_space_safety_factor_for_write * tr_size)) {
       std::ostringstream msg_oss;
       msg_oss << "a safety factor of " << m_free_space_safety_factor_for_write << " times the trigger record size";
@@ -186,6 +239,14 @@ public:
       throw RetryableDataStoreProblem(ERS_HERE, get_name(), msg, issue);
     }
 
+    // the compressed copy shares the fragments that are not compressed with the original
+    std::unique_ptr<daqdataformats::TriggerRecord> compressed;
+    if (m_compressor) {
+      compressed = m_compressor->compress(record);
+    }
+    const auto& tr = compressed ? *compressed : record;
+    tr_size = tr.get_total_size_bytes();
+
     // check if a new file should be opened for this record
     if (! increment_file_index_if_needed(tr_size)) {
       if (m_operation_mode == "one-event-per-file") {
@@ -197,22 +258,22 @@ public:
     }
     m_current_record_number = tr.get_header_ref().get_trigger_number();
 
-    // determine the filename from Storage Key + configuration parameters
-    std::string full_filename = get_file_name(tr.get_header_ref().get_run_number());
-
     try {
-      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate);
+      open_file_if_needed(tr.get_header_ref().get_run_number(), HighFive::File::OpenOrCreate);
     } catch (std::exception const& excpt) {
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename, excpt);
+      throw FileOperationProblem(ERS_HERE, get_name(), get_file_name(tr.get_header_ref().get_run_number()), excpt);
     } catch (...) { // NOLINT(runtime/exceptions)
       // NOLINT here because we *ARE* re-throwing the exception!
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename);
+      throw FileOperationProblem(ERS_HERE, get_name(), get_file_name(tr.get_header_ref().get_run_number()));
     }
 
     // write the record
+    uint64_t reserved_bytes = // NOLINT(build/unsigned)
+      preallocated_part(m_file_handle->get_recorded_size(), tr_size, m_preallocate_bytes);
     m_file_handle->write(tr);
     m_recorded_size = m_file_handle->get_recorded_size();
 
+    m_free_space.record_written(tr_size, reserved_bytes);
     m_new_bytes += tr_size;
     ++m_new_objects;
   }
@@ -224,12 +285,11 @@ public:
    * defined in the configuration file.
    *
    */
-  virtual void write(const daqdataformats::TimeSlice& ts)
+  virtual void write(const daqdataformats::TimeSlice& slice)
   {
-
-    // check if there is sufficient space for this record
-    size_t current_free_space = get_free_space(m_path);
-    size_t ts_size = ts.get_total_size_bytes();
+    // check if there is sufficient space for this record, before compressing it
+    size_t ts_size = slice.get_total_size_bytes();
+    size_t current_free_space = m_free_space.available(m_free_space_safety_factor_for_write * ts_size);
     if (current_free_space < (m_free_space_safety_factor_for_write * ts_size)) {
       std::ostringstream msg_oss;
       msg_oss << "a safety factor of " << m_free_space_safety_factor_for_write << " times the time slice size";
@@ -243,6 +303,13 @@ public:
       throw RetryableDataStoreProblem(ERS_HERE, get_name(), msg, issue);
     }
 
+    std::unique_ptr<daqdataformats::TimeSlice> compressed;
+    if (m_compressor) {
+      compressed = m_compressor->compress(slice);
+    }
+    const auto& ts = compressed ? *compressed : slice;
+    ts_size = ts.get_total_size_bytes();
+
     // check if a new file should be opened for this record
     if (! increment_file_index_if_needed(ts_size)) {
       if (m_operation_mode == "one-event-per-file") {
@@ -254,19 +321,18 @@ public:
     }
     m_current_record_number = ts.get_header().timeslice_number;
 
-    // determine the filename from Storage Key + configuration parameters
-    std::string full_filename = get_file_name(ts.get_header().run_number);
-
     try {
-      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate);
+      open_file_if_needed(ts.get_header().run_number, HighFive::File::OpenOrCreate);
     } catch (std::exception const& excpt) {
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename, excpt);
+      throw FileOperationProblem(ERS_HERE, get_name(), get_file_name(ts.get_header().run_number), excpt);
     } catch (...) { // NOLINT(runtime/exceptions)
       // NOLINT here because we *ARE* re-throwing the exception!
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename);
+      throw FileOperationProblem(ERS_HERE, get_name(), get_file_name(ts.get_header().run_number));
     }
 
     // write the record
+    uint64_t reserved_bytes = // NOLINT(build/unsigned)
+      preallocated_part(m_file_handle->get_recorded_size(), ts_size, m_preallocate_bytes);
     try {
       m_file_handle->write(ts);
       m_recorded_size = m_file_handle->get_recorded_size();
@@ -275,6 +341,7 @@ public:
       throw IgnorableDataStoreProblem(ERS_HERE, get_name(), msg, excpt);
     }
 
+    m_free_space.record_written(ts_size, reserved_bytes);
     m_new_bytes += ts_size;
     ++m_new_objects;
   }
@@ -315,6 +382,15 @@ public:
     m_file_index = 0;
     m_recorded_size = 0;
     m_current_record_number = std::numeric_limits<size_t>::max();
+    // before the background thread builds the names of the run
+    m_file_name_template.set_run_number(run_number);
+
+    m_free_space.start(m_path, m_free_space_config);
+
+    // the first file of the run is opened before the first record arrives
+    if (m_file_rotation) {
+      m_file_rotation->prepare(FileKey{ run_number, 0, HighFive::File::OpenOrCreate });
+    }
   }
 
   /**
@@ -326,11 +402,20 @@ public:
    */
   void finish_with_run(daqdataformats::run_number_t /*run_number*/)
   {
+    m_free_space.stop();
+
+    // the files of the run are complete once this returns
+    if (m_file_rotation) {
+      m_file_rotation->cancel();
+      m_file_rotation->wait_until_idle();
+    }
+
     if (m_file_handle.get() != nullptr) {
       std::string open_filename = m_file_handle->get_file_name();
       try {
         m_file_handle.reset();
         m_run_number = 0;
+        release_preallocated_space(open_filename);
       } catch (std::exception const& excpt) {
         m_run_number = 0;
         throw FileOperationProblem(ERS_HERE, get_name(), open_filename, excpt);
@@ -342,6 +427,14 @@ public:
     }
   }
 
+  float get_free_space_fraction() const override { return m_free_space.free_fraction(); }
+
+  void set_stream_info(size_t stream_index, size_t stream_count) override
+  {
+    m_stream_index = stream_index;
+    m_stream_count = stream_count;
+  }
+
 protected:
   void generate_opmon_data() override
   {
@@ -352,6 +445,25 @@ protected:
     info.set_new_written_object(m_new_objects.exchange(0));
     info.set_bytes_in_file(m_recorded_size.load());
     info.set_written_files(m_file_index.load());
+    info.set_free_space_sync_checks(m_free_space.sync_refreshes());
+    info.set_free_space_async_checks(m_free_space.async_refreshes());
+    if (m_compressor) {
+      auto statistics = m_compressor->take_statistics();
+      info.set_compression_input_bytes(statistics.input_bytes);
+      info.set_compression_output_bytes(statistics.output_bytes);
+      if (statistics.output_bytes > 0) {
+        info.set_compression_ratio(static_cast<double>(statistics.input_bytes) / statistics.output_bytes);
+      }
+      info.set_compression_cpu_time_us(statistics.cpu_time_us);
+      info.set_compressed_fragments(statistics.compressed_fragments);
+      info.set_incompressible_fragments(statistics.incompressible_fragments);
+    }
+    info.set_file_switch_time_us(m_file_switch_time_us.exchange(0));
+    info.set_preopened_files_used(m_preopened_files_used.exchange(0));
+    info.set_synchronous_file_opens(m_synchronous_file_opens.exchange(0));
+    if (m_file_rotation) {
+      info.set_files_being_closed(m_file_rotation->get_pending_closes());
+    }
     publish(std::move(info), { { "path", m_path } });
   }
 
@@ -365,6 +477,8 @@ private:
   const appmodel::HDF5FileLayoutParams* m_file_layout_params;
   std::string m_basic_name_of_open_file;
   unsigned m_open_flags_of_open_file;
+  daqdataformats::run_number_t m_run_number_of_open_file;
+  size_t m_file_index_of_open_file;
   daqdataformats::run_number_t m_run_number;
   bool m_run_is_for_test_purposes;
   const confmodel::Session* m_session;
@@ -372,6 +486,10 @@ private:
   std::string m_offline_data_stream;
   std::string m_writer_identifier;
 
+  // Position of this DataStore among the parallel streams of its writer
+  size_t m_stream_index{ 0 };
+  size_t m_stream_count{ 1 };
+
   // Total number of generated files
   std::atomic<size_t> m_file_index;
 
@@ -393,37 +511,47 @@ private:
   std::string m_path;
   size_t m_max_file_size;
   bool m_disable_unique_suffix;
+  uint64_t m_preallocate_bytes{ 0 }; // NOLINT(build/unsigned)
   float m_free_space_safety_factor_for_write;
 
+  FileNameTemplate m_file_name_template;
+
+  // estimate of the free space, measured in the background during runs
+  FreeSpaceTracker::Config m_free_space_config;
+  FreeSpaceTracker m_free_space;
+
+  // optional
+  std::unique_ptr<FragmentCompressor> m_compressor;
+
+  HDF5FileTuning m_file_tuning;
+
+  // writer time spent moving on to new files, and how they were opened
+  std::atomic<uint64_t> m_file_switch_time_us{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_preopened_files_used{ 0 };  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_synchronous_file_opens{ 0 }; // NOLINT(build/unsigned)
+
+  // optional. Last, as its thread uses the other members until it is stopped
+  std::unique_ptr<FileRotation<hdf5libs::HDF5RawDataFile>> m_file_rotation;
+
   // std::unique_ptr<HDF5KeyTranslator> m_key_translator_ptr;
 
+  static bool library_is_threadsafe()
+  {
+    hbool_t threadsafe = false;
+    return H5is_library_threadsafe(&threadsafe) >= 0 && threadsafe;
+  }
+
   /**
    * @brief Translates the specified input parameters into the appropriate filename.
    */
-  std::string get_file_name(daqdataformats::run_number_t run_number)
+  std::string get_file_name(daqdataformats::run_number_t run_number) const
   {
-    std::ostringstream work_oss;
-    work_oss << m_config_params->get_directory_path();
-    if (work_oss.str().length() > 0) {
-      work_oss << "/";
-    }
-    work_oss << m_operational_environment + "_" + m_config_params->get_filename_params()->get_file_type_prefix();
-    if (work_oss.str().length() > 0) {
-      work_oss << "_";
-    }
-
-    work_oss << m_config_params->get_filename_params()->get_run_number_prefix();
-    work_oss << std::setw(m_config_params->get_filename_params()->get_digits_for_run_number()) << std::setfill('0')
-             << run_number;
-    work_oss << "_";
-
-    work_oss << m_config_params->get_filename_params()->get_file_index_prefix();
-    work_oss << std::setw(m_config_params->get_filename_params()->get_digits_for_file_index()) << std::setfill('0')
-             << m_file_index;
+    return get_file_name(run_number, m_file_index);
+  }
 
-    work_oss << "_" << m_writer_identifier;
-    work_oss << ".hdf5";
-    return work_oss.str();
+  std::string get_file_name(daqdataformats::run_number_t run_number, size_t file_index) const
+  {
+    return m_file_name_template.get_file_name(run_number, file_index);
   }
 
   bool increment_file_index_if_needed(size_t size_of_next_write)
@@ -436,86 +564,196 @@ private:
     return false;
   }
 
-  void open_file_if_needed(const std::string& file_name, unsigned open_flags = HighFive::File::ReadOnly)
+  void open_file_if_needed(daqdataformats::run_number_t run_number, unsigned open_flags = HighFive::File::ReadOnly)
   {
 
-    if (m_file_handle.get() == nullptr || m_basic_name_of_open_file.compare(file_name) ||
-        m_open_flags_of_open_file != open_flags) {
-
-      // 04-Feb-2021, KAB: adding unique substrings to the filename
-      std::string unique_filename = file_name;
-      time_t now = time(0);
-      std::string file_creation_timestamp = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(now));
-      if (!m_disable_unique_suffix) {
-        // timestamp substring
-        size_t ufn_len = unique_filename.length();
-        if (ufn_len > 6) { // len GT 6 gives us some confidence that we have at least x.hdf5
-          std::string timestamp_substring = "_" + file_creation_timestamp;
-          TLOG_DEBUG(TLVL_BASIC) << get_name() << ": timestamp substring for filename: " << timestamp_substring;
-          unique_filename.insert(ufn_len - 5, timestamp_substring);
-        }
-      }
+    // the file name only changes with the run number and the file index, so that there is no need to build it
+    // for every record
+    if (m_file_handle.get() == nullptr || m_run_number_of_open_file != run_number ||
+        m_file_index_of_open_file != m_file_index || m_open_flags_of_open_file != open_flags) {
+
+      auto switch_start = std::chrono::steady_clock::now();
+      FileKey key{ run_number, m_file_index, open_flags };
 
       // close an existing open file
       if (m_file_handle.get() != nullptr) {
-        std::string open_filename = m_file_handle->get_file_name();
-        try {
-          m_file_handle.reset();
-        } catch (std::exception const& excpt) {
-          throw FileOperationProblem(ERS_HERE, get_name(), open_filename, excpt);
-        } catch (...) { // NOLINT(runtime/exceptions)
-          // NOLINT here because we *ARE* re-throwing the exception!
-          throw FileOperationProblem(ERS_HERE, get_name(), open_filename);
+        if (m_file_rotation) {
+          m_file_rotation->close(std::move(m_file_handle));
+        } else {
+          std::string open_filename = m_file_handle->get_file_name();
+          try {
+            m_file_handle.reset();
+            release_preallocated_space(open_filename);
+          } catch (std::exception const& excpt) {
+            throw FileOperationProblem(ERS_HERE, get_name(), open_filename, excpt);
+          } catch (...) { // NOLINT(runtime/exceptions)
+            // NOLINT here because we *ARE* re-throwing the exception!
+            throw FileOperationProblem(ERS_HERE, get_name(), open_filename);
+          }
         }
       }
 
-      // opening file for the first time OR something changed in the name or the way of opening the file
-      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": going to open file " << unique_filename << " with open_flags "
-                             << std::to_string(open_flags);
-      m_basic_name_of_open_file = file_name;
-      m_open_flags_of_open_file = open_flags;
-      try {
-        m_file_handle.reset(
-          new hdf5libs::HDF5RawDataFile(unique_filename,
-                                        m_run_number,
-                                        m_file_index,
-                                        m_writer_identifier,
-                                        m_file_layout_params,
-                                        hdf5libs::HDF5SourceIDHandler::make_source_id_geo_id_map(m_session),
-                                        ".writing",
-                                        open_flags));
-      } catch (std::exception const& excpt) {
-        throw FileOperationProblem(ERS_HERE, get_name(), unique_filename, excpt);
-      } catch (...) { // NOLINT(runtime/exceptions)
-        // NOLINT here because we *ARE* re-throwing the exception!
-        throw FileOperationProblem(ERS_HERE, get_name(), unique_filename);
+      // opening file for the first time OR something changed in the name or the way of opening the file.
+      // The file prepared in the background is used if it is the right one
+      if (m_file_rotation) {
+        m_file_handle = m_file_rotation->take(key);
       }
-
-      if (open_flags == HighFive::File::ReadOnly) {
-        TLOG_DEBUG(TLVL_BASIC) << get_name() << "Opened HDF5 file read-only.";
+      if (m_file_handle) {
+        ++m_preopened_files_used;
       } else {
-        TLOG_DEBUG(TLVL_BASIC) << get_name() << "Created HDF5 file (" << unique_filename << ").";
+        m_file_handle = open_file(key);
+        ++m_synchronous_file_opens;
+      }
 
-        // write attributes that aren't being handled by the HDF5RawDataFile right now
-        // m_file_handle->write_attribute("data_format_version",(int)m_key_translator_ptr->get_current_version());
-        m_file_handle->write_attribute("operational_environment", (std::string)m_operational_environment);
-        m_file_handle->write_attribute("offline_data_stream", (std::string)m_offline_data_stream);
-        m_file_handle->write_attribute("run_was_for_test_purposes", (std::string)(m_run_is_for_test_purposes ? "true" : "false"));
+      m_basic_name_of_open_file = get_file_name(run_number, key.file_index);
+      m_open_flags_of_open_file = open_flags;
+      m_run_number_of_open_file = run_number;
+      m_file_index_of_open_file = key.file_index;
+
+      // the next file is prepared while this one is written
+      if (m_file_rotation && open_flags != HighFive::File::ReadOnly) {
+        m_file_rotation->prepare(FileKey{ run_number, key.file_index + 1, open_flags });
       }
+      m_file_switch_time_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - switch_start)
+                                 .count();
     } else {
       TLOG_DEBUG(TLVL_BASIC) << get_name() << ": Pointer file to  " << m_basic_name_of_open_file
                              << " was already opened with open_flags " << std::to_string(m_open_flags_of_open_file);
     }
   }
 
-  size_t get_free_space(const std::string& the_path)
+  /**
+   * @brief Creates or opens the file for key and writes its attributes. Called by the writing
+   * thread, or by the background thread of the FileRotation.
+   */
+  std::unique_ptr<hdf5libs::HDF5RawDataFile> open_file(const FileKey& key)
   {
-    struct statvfs vfs_results;
-    int retval = statvfs(the_path.c_str(), &vfs_results);
-    if (retval != 0) {
-      return 0;
+    std::string file_name = get_file_name(key.run_number, key.file_index);
+
+    // 04-Feb-2021, KAB: adding unique substrings to the filename.
+    // A file prepared in the background gets the time at which it is prepared, while the
+    // previous file is written, rather than the time of its first record
+    std::string unique_filename = file_name;
+    if (!m_disable_unique_suffix) {
+      unique_filename = m_file_name_template.make_unique(file_name, time(0));
+    }
+
+    TLOG_DEBUG(TLVL_BASIC) << get_name() << ": going to open file " << unique_filename << " with open_flags "
+                           << std::to_string(key.open_flags);
+    std::unique_ptr<hdf5libs::HDF5RawDataFile> file_handle;
+    try {
+      HighFive::FileAccessProps file_access_props;
+      file_access_props.add(m_file_tuning);
+      file_handle.reset(
+        new hdf5libs::HDF5RawDataFile(unique_filename,
+                                      key.run_number,
+                                      key.file_index,
+                                      m_writer_identifier,
+                                      m_file_layout_params,
+                                      hdf5libs::HDF5SourceIDHandler::make_source_id_geo_id_map(m_session),
+                                      ".writing",
+                                      key.open_flags,
+                                      file_access_props));
+    } catch (std::exception const& excpt) {
+      throw FileOperationProblem(ERS_HERE, get_name(), unique_filename, excpt);
+    } catch (...) { // NOLINT(runtime/exceptions)
+      // NOLINT here because we *ARE* re-throwing the exception!
+      throw FileOperationProblem(ERS_HERE, get_name(), unique_filename);
+    }
+
+    if (key.open_flags == HighFive::File::ReadOnly) {
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << "Opened HDF5 file read-only.";
+    } else {
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << "Created HDF5 file (" << unique_filename << ").";
+
+      // the preallocation is an optimisation: the file systems that do not support it are fine without
+      if (m_preallocate_bytes > 0) {
+        if (preallocate_file_space(unique_filename + ".writing", m_preallocate_bytes)) {
+          m_free_space.reserve(m_preallocate_bytes);
+        } else {
+          TLOG_DEBUG(TLVL_FILE_SIZE) << get_name() << ": unable to preallocate " << m_preallocate_bytes
+                                     << " bytes for " << unique_filename << ": " << std::strerror(errno);
+        }
+      }
+
+      // write attributes that aren't being handled by the HDF5RawDataFile right now
+      // file_handle->write_attribute("data_format_version",(int)m_key_translator_ptr->get_current_version());
+      file_handle->write_attribute("operational_environment", (std::string)m_operational_environment);
+      file_handle->write_attribute("offline_data_stream", (std::string)m_offline_data_stream);
+      file_handle->write_attribute("run_was_for_test_purposes", (std::string)(m_run_is_for_test_purposes ? "true" : "false"));
+
+      // the records of a striped writer are spread over the files of all its streams.
+      // Offline tools merge them using the record keys (trigger and sequence numbers)
+      if (m_stream_count > 1) {
+        file_handle->write_attribute("stream_index", m_stream_index);
+        file_handle->write_attribute("stream_count", m_stream_count);
+      }
+
+      // the compressed fragments are restored with FragmentCompressor::decompress()
+      if (m_compressor) {
+        file_handle->write_attribute("fragment_compression", m_compressor->describe());
+      }
+      if (!m_file_tuning.is_default()) {
+        file_handle->write_attribute("hdf5_tuning", m_file_tuning.describe());
+      }
+    }
+    return file_handle;
+  }
+
+  /**
+   * @brief Closes a file in the background thread of the FileRotation. A prepared file that was
+   * not used has no records, and is removed.
+   */
+  void close_file(std::unique_ptr<hdf5libs::HDF5RawDataFile> file_handle, bool unused)
+  {
+    std::string file_name = file_handle->get_file_name();
+    try {
+      file_handle.reset();
+    } catch (std::exception const& excpt) {
+      ers::error(FileOperationProblem(ERS_HERE, get_name(), file_name, excpt));
+      return;
+    } catch (...) { // NOLINT(runtime/exceptions)
+      ers::error(FileOperationProblem(ERS_HERE, get_name(), file_name));
+      return;
+    }
+
+    if (unused) {
+      if (m_preallocate_bytes > 0) {
+        m_free_space.release(std::min(allocated_file_space(closed_file_name(file_name)), m_preallocate_bytes));
+      }
+      std::error_code error;
+      std::filesystem::remove(closed_file_name(file_name), error);
+      std::filesystem::remove(file_name, error);
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": removed the unused file " << closed_file_name(file_name);
+    } else {
+      release_preallocated_space(file_name);
+    }
+  }
+
+  // The name of a file once it is closed, without the suffix it has while it is written
+  static std::string closed_file_name(std::string file_name)
+  {
+    const std::string suffix = ".writing";
+    if (file_name.size() > suffix.size() &&
+        file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      file_name.resize(file_name.size() - suffix.size());
+    }
+    return file_name;
+  }
+
+  // To be called once the file is closed, with the name it had while it was written
+  void release_preallocated_space(const std::string& file_name)
+  {
+    if (m_preallocate_bytes == 0) {
+      return;
+    }
+    uint64_t released_bytes = 0; // NOLINT(build/unsigned)
+    if (!release_file_space(closed_file_name(file_name), &released_bytes)) {
+      TLOG_DEBUG(TLVL_FILE_SIZE) << get_name() << ": unable to release the preallocated space of "
+                                 << closed_file_name(file_name) << ": " << std::strerror(errno);
     }
-    return vfs_results.f_bsize * vfs_results.f_bavail;
+    m_free_space.release(released_bytes);
   }
 };
 
@@ -0,0 +1,406 @@
+/**
+ * @file RawDataStore.hpp
+ *
+ * An implementation of the DataStore interface that writes the records
+ * in their native byte layout into append-only raw data files, for the
+ * highest write throughput. The files can be converted to HDF5 offline
+ * with the dfmodules_raw_to_hdf5 application.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_PLUGINS_RAWDATASTORE_HPP_
+#define DFMODULES_PLUGINS_RAWDATASTORE_HPP_
+
+#include "dfmodules/CommonIssues.hpp"
+#include "dfmodules/DataStore.hpp"
+#include "dfmodules/FileNameTemplate.hpp"
+#include "dfmodules/FilePreallocation.hpp"
+#include "dfmodules/FreeSpaceTracker.hpp"
+#include "dfmodules/RawDataFile.hpp"
+#include "dfmodules/opmon/DataStore.pb.h"
+
+#include "appmodel/DataStoreConf.hpp"
+#include "appmodel/FilenameParams.hpp"
+#include "confmodel/DetectorConfig.hpp"
+#include "confmodel/Session.hpp"
+
+#include "appfwk/DAQModule.hpp"
+#include "logging/Logging.hpp"
+
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <string>
+#include <sys/statvfs.h>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief RawDataStore writes the records into raw data files, see RawDataFile.hpp for their layout.
+ * The operation modes, file rotation and file names are the same as for the HDF5DataStore,
+ * with a ".raw" extension.
+ */
+class RawDataStore : public DataStore
+{
+
+public:
+  enum
+  {
+    TLVL_BASIC = 2,
+    TLVL_FILE_SIZE = 5
+  };
+
+  explicit RawDataStore(std::string const& name,
+                        std::shared_ptr<appfwk::ModuleConfiguration> mcfg,
+                        std::string const& writer_name)
+    : DataStore(name)
+    , m_run_number(0)
+    , m_run_is_for_test_purposes(false)
+    , m_writer_identifier(writer_name)
+    , m_file_index(0)
+    , m_current_record_number(std::numeric_limits<size_t>::max())
+  {
+    TLOG_DEBUG(TLVL_BASIC) << get_name();
+
+    m_config_params = mcfg->module<appmodel::DataStoreConf>(name);
+    auto detector_config = mcfg->configuration_manager()->session()->get_detector_configuration();
+    m_operational_environment = detector_config->get_op_env();
+    m_offline_data_stream = detector_config->get_offline_data_stream();
+
+    m_operation_mode = m_config_params->get_mode();
+    m_path = m_config_params->get_directory_path();
+    m_max_file_size = m_config_params->get_max_file_size();
+    m_disable_unique_suffix = m_config_params->get_disable_unique_filename_suffix();
+    m_free_space_safety_factor_for_write = m_config_params->get_free_space_safety_factor();
+    if (m_free_space_safety_factor_for_write < 1.1) {
+      m_free_space_safety_factor_for_write = 1.1;
+    }
+    m_free_space_config.refresh_interval =
+      std::chrono::milliseconds(m_config_params->get_free_space_refresh_interval_ms());
+
+    if (m_operation_mode != "one-event-per-file" && m_operation_mode != "all-per-file") {
+      throw InvalidOperationMode(ERS_HERE, get_name(), m_operation_mode);
+    }
+
+    auto filename_params = m_config_params->get_filename_params();
+    FileNameTemplate::Params name_params;
+    name_params.directory_path = m_path;
+    name_params.operational_environment = m_operational_environment;
+    name_params.file_type_prefix = filename_params->get_file_type_prefix();
+    name_params.run_number_prefix = filename_params->get_run_number_prefix();
+    name_params.digits_for_run_number = filename_params->get_digits_for_run_number();
+    name_params.file_index_prefix = filename_params->get_file_index_prefix();
+    name_params.digits_for_file_index = filename_params->get_digits_for_file_index();
+    name_params.writer_identifier = m_writer_identifier;
+    name_params.extension = ".raw";
+    m_file_name_template = FileNameTemplate(name_params);
+
+    // the files are preallocated up to the size at which they are rotated
+    RawDataFileWriter::Config writer_config;
+    writer_config.buffer_size = m_config_params->get_buffer_size();
+    writer_config.direct_io = m_config_params->get_direct_io();
+    writer_config.preallocate_bytes =
+      m_config_params->get_preallocate_files() != "off" && m_operation_mode == "all-per-file" ? m_max_file_size : 0;
+    writer_config.io_engine = m_config_params->get_io_engine();
+    writer_config.io_depth = m_config_params->get_io_depth();
+    m_writer = std::make_unique<RawDataFileWriter>(writer_config);
+    TLOG_DEBUG(TLVL_BASIC) << get_name() << ": using the " << m_writer->get_io_engine_type() << " write engine";
+
+    struct statvfs vfs_results;
+    if (statvfs(m_path.c_str(), &vfs_results) != 0) {
+      ers::warning(InvalidOutputPath(ERS_HERE, get_name(), m_path));
+    }
+    m_free_space.start(m_path, FreeSpaceTracker::Config());
+  }
+
+  void write(const daqdataformats::TriggerRecord& tr) override
+  {
+    const auto& header = tr.get_header_ref();
+    std::vector<RawDataFileWriter::piece_t> pieces;
+    pieces.reserve(tr.get_fragments_ref().size() + 1);
+    pieces.emplace_back(header.get_storage_location(), header.get_total_size_bytes());
+    for (auto& fragment : tr.get_fragments_ref()) {
+      pieces.emplace_back(fragment->get_storage_location(), fragment->get_size());
+    }
+
+    write_record(RawRecordType::kTriggerRecord,
+                 header.get_trigger_number(),
+                 header.get_sequence_number(),
+                 header.get_run_number(),
+                 tr.get_total_size_bytes(),
+                 pieces);
+  }
+
+  void write(const daqdataformats::TimeSlice& ts) override
+  {
+    const auto& header = ts.get_header();
+    std::vector<RawDataFileWriter::piece_t> pieces;
+    pieces.reserve(ts.get_fragments_ref().size() + 1);
+    pieces.emplace_back(&header, sizeof(header));
+    for (auto& fragment : ts.get_fragments_ref()) {
+      pieces.emplace_back(fragment->get_storage_location(), fragment->get_size());
+    }
+
+    write_record(
+      RawRecordType::kTimeSlice, header.timeslice_number, 0, header.run_number, ts.get_total_size_bytes(), pieces);
+  }
+
+  void prepare_for_run(daqdataformats::run_number_t run_number, bool run_is_for_test_purposes) override
+  {
+    m_run_number = run_number;
+    m_run_is_for_test_purposes = run_is_for_test_purposes;
+    m_file_name_template.set_run_number(run_number);
+
+    struct statvfs vfs_results;
+    if (statvfs(m_path.c_str(), &vfs_results) != 0) {
+      throw InvalidOutputPath(ERS_HERE, get_name(), m_path);
+    }
+    size_t free_space = vfs_results.f_bsize * vfs_results.f_bavail;
+    if (free_space < m_max_file_size) {
+      throw InsufficientDiskSpace(
+        ERS_HERE, get_name(), m_path, free_space, m_max_file_size, "the configured maximum size of a single file");
+    }
+
+    m_file_index = 0;
+    m_current_record_number = std::numeric_limits<size_t>::max();
+    m_abandoned_file.clear();
+    m_free_space.start(m_path, m_free_space_config);
+  }
+
+  void finish_with_run(daqdataformats::run_number_t /*run_number*/) override
+  {
+    m_free_space.stop();
+    m_run_number = 0;
+    close_file();
+  }
+
+  float get_free_space_fraction() const override { return m_free_space.free_fraction(); }
+
+  void set_stream_info(size_t stream_index, size_t stream_count) override
+  {
+    m_stream_index = stream_index;
+    m_stream_count = stream_count;
+  }
+
+  // each successful write appends one record to the file, which completes once it is on disk
+  bool writes_asynchronously() const override { return true; }
+  uint64_t get_completed_writes() const override { return m_writer->get_completed_records(); } // NOLINT
+
+  void flush() override
+  {
+    try {
+      m_writer->flush();
+    } catch (const RawDataFileProblem& excpt) {
+      std::string file_name = m_writer->get_file_name();
+      abandon_file();
+      throw FileOperationProblem(ERS_HERE, get_name(), file_name, excpt);
+    }
+    // the caller is waiting for records that went into a file given up since
+    if (!m_abandoned_file.empty()) {
+      std::string file_name;
+      std::swap(file_name, m_abandoned_file);
+      throw FileOperationProblem(ERS_HERE, get_name(), file_name + kRawFileWritingSuffix);
+    }
+  }
+
+protected:
+  void generate_opmon_data() override
+  {
+    opmon::RawDataStoreInfo info;
+
+    info.set_new_bytes_output(m_new_bytes.exchange(0));
+    info.set_new_written_object(m_new_objects.exchange(0));
+    info.set_bytes_in_file(m_recorded_size.load());
+    info.set_written_files(m_file_index.load());
+    info.set_buffer_wait_time_us(m_writer->get_buffer_wait_us());
+    info.set_direct_io(m_direct_io.load());
+    info.set_io_uring(m_writer->get_io_engine_type() == "io_uring");
+    uint64_t appended = m_writer->get_appended_records();   // NOLINT(build/unsigned)
+    uint64_t completed = m_writer->get_completed_records(); // NOLINT(build/unsigned)
+    info.set_incomplete_writes(appended > completed ? appended - completed : 0);
+    info.set_free_space_sync_checks(m_free_space.sync_refreshes());
+    info.set_free_space_async_checks(m_free_space.async_refreshes());
+    publish(std::move(info), { { "path", m_path } });
+  }
+
+private:
+  RawDataStore(const RawDataStore&) = delete;
+  RawDataStore& operator=(const RawDataStore&) = delete;
+  RawDataStore(RawDataStore&&) = delete;
+  RawDataStore& operator=(RawDataStore&&) = delete;
+
+  void write_record(RawRecordType type,
+                    uint64_t record_number,  // NOLINT(build/unsigned)
+                    uint16_t sequence_number, // NOLINT(build/unsigned)
+                    daqdataformats::run_number_t run_number,
+                    size_t size,
+                    const std::vector<RawDataFileWriter::piece_t>& pieces)
+  {
+    // check if there is sufficient space for this record
+    size_t current_free_space = m_free_space.available(m_free_space_safety_factor_for_write * size);
+    if (current_free_space < (m_free_space_safety_factor_for_write * size)) {
+      InsufficientDiskSpace issue(ERS_HERE,
+                                  get_name(),
+                                  m_path,
+                                  current_free_space,
+                                  (m_free_space_safety_factor_for_write * size),
+                                  "the free-space safety factor times the record size");
+      throw RetryableDataStoreProblem(ERS_HERE, get_name(), "writing a record to file " + m_writer->get_file_name(), issue);
+    }
+
+    // same rotation rules as the HDF5DataStore
+    if ((m_recorded_size + size) > m_max_file_size && m_recorded_size > 0) {
+      ++m_file_index;
+    } else if (m_operation_mode == "one-event-per-file" &&
+               m_current_record_number != std::numeric_limits<size_t>::max() &&
+               record_number != m_current_record_number) {
+      ++m_file_index;
+    }
+    m_current_record_number = record_number;
+
+    if (!m_writer->is_open() || m_run_number_of_open_file != run_number || m_file_index_of_open_file != m_file_index) {
+      open_file(run_number);
+    }
+
+    // the data starts after the header block
+    uint64_t reserved_bytes = // NOLINT(build/unsigned)
+      preallocated_part(kRawFileBlockSize + m_writer->get_data_bytes(), size, m_writer->get_preallocated_bytes());
+    try {
+      m_writer->append(type, record_number, sequence_number, pieces);
+    } catch (const RawDataFileProblem& excpt) {
+      std::string file_name = m_writer->get_file_name();
+      abandon_file();
+      throw FileOperationProblem(ERS_HERE, get_name(), file_name, excpt);
+    }
+    m_recorded_size += size;
+
+    m_unwritten_preallocation -= reserved_bytes;
+    m_free_space.record_written(size, reserved_bytes);
+    m_new_bytes += size;
+    ++m_new_objects;
+  }
+
+  void open_file(daqdataformats::run_number_t run_number)
+  {
+    close_file();
+
+    std::string file_name = m_file_name_template.get_file_name(run_number, m_file_index);
+    if (!m_disable_unique_suffix) {
+      file_name = m_file_name_template.make_unique(file_name, time(0));
+    }
+
+    RawFileHeader header;
+    header.run_number = run_number;
+    header.file_index = m_file_index;
+    header.stream_index = m_stream_index;
+    header.stream_count = m_stream_count;
+    header.run_was_for_test_purposes = m_run_is_for_test_purposes ? 1 : 0;
+    set_raw_header_field(header.writer_identifier, m_writer_identifier);
+    set_raw_header_field(header.operational_environment, m_operational_environment);
+    set_raw_header_field(header.offline_data_stream, m_offline_data_stream);
+
+    TLOG_DEBUG(TLVL_BASIC) << get_name() << ": going to open file " << file_name;
+    try {
+      m_writer->open(file_name, header);
+    } catch (const RawDataFileProblem& excpt) {
+      throw FileOperationProblem(ERS_HERE, get_name(), file_name, excpt);
+    }
+    m_run_number_of_open_file = run_number;
+    m_file_index_of_open_file = m_file_index;
+    m_recorded_size = 0;
+    m_unwritten_preallocation = m_writer->get_preallocated_bytes();
+    m_free_space.reserve(m_unwritten_preallocation);
+    m_direct_io = m_writer->using_direct_io();
+  }
+
+  void close_file()
+  {
+    if (!m_writer->is_open()) {
+      return;
+    }
+    std::string file_name = m_writer->get_file_name();
+    // closing the file truncates it, which releases what is left of the preallocated space
+    m_free_space.release(m_unwritten_preallocation);
+    m_unwritten_preallocation = 0;
+    try {
+      m_writer->close();
+    } catch (const RawDataFileProblem& excpt) {
+      throw FileOperationProblem(ERS_HERE, get_name(), file_name, excpt);
+    }
+  }
+
+  // After a failed write, the file is closed as it is, and the next record goes to a new file.
+  // The records already appended to it that were not written will never complete: the next
+  // flush() reports it, so that the caller stops waiting for them
+  void abandon_file()
+  {
+    m_free_space.release(m_unwritten_preallocation);
+    m_unwritten_preallocation = 0;
+    std::string file_name = m_writer->get_file_name();
+    try {
+      m_writer->close();
+    } catch (const RawDataFileProblem& excpt) {
+      // expected, the failed write is reported by the caller
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": giving up file " << file_name << ": " << excpt.message();
+    }
+    if (m_writer->get_appended_records() > m_writer->get_completed_records()) {
+      m_abandoned_file = file_name;
+    }
+    ++m_file_index;
+  }
+
+  std::unique_ptr<RawDataFileWriter> m_writer;
+  daqdataformats::run_number_t m_run_number;
+  bool m_run_is_for_test_purposes;
+  std::string m_operational_environment;
+  std::string m_offline_data_stream;
+  std::string m_writer_identifier;
+  size_t m_stream_index{ 0 };
+  size_t m_stream_count{ 1 };
+
+  // Total number of generated files
+  std::atomic<size_t> m_file_index;
+  daqdataformats::run_number_t m_run_number_of_open_file{ 0 };
+  size_t m_file_index_of_open_file{ 0 };
+
+  // Size of the data in the current file
+  std::atomic<size_t> m_recorded_size{ 0 };
+
+  // preallocated space of the current file that is not written yet
+  uint64_t m_unwritten_preallocation{ 0 }; // NOLINT(build/unsigned)
+
+  // file given up with incomplete records, that flush() has not reported yet
+  std::string m_abandoned_file;
+
+  // Record number for the record that is currently being written out
+  size_t m_current_record_number;
+
+  // incremental written data
+  std::atomic<uint64_t> m_new_bytes{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_new_objects{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<bool> m_direct_io{ false };
+
+  // Configuration
+  const appmodel::DataStoreConf* m_config_params;
+  std::string m_operation_mode;
+  std::string m_path;
+  size_t m_max_file_size;
+  bool m_disable_unique_suffix;
+  float m_free_space_safety_factor_for_write;
+  FileNameTemplate m_file_name_template;
+
+  // estimate of the free space, measured in the background during runs
+  FreeSpaceTracker::Config m_free_space_config;
+  FreeSpaceTracker m_free_space;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_PLUGINS_RAWDATASTORE_HPP_
@@ -0,0 +1,35 @@
+/**
+ * @file DataVolumeEstimator.cpp DataVolumeEstimator Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DataVolumeEstimator.hpp"
+
+namespace dunedaq {
+namespace dfmodules {
+
+void
+DataVolumeEstimator::set_bytes_per_tick(subsystem_t subsystem, double bytes_per_tick)
+{
+  m_bytes_per_tick[index(subsystem)] = bytes_per_tick > 0. ? bytes_per_tick : 0.;
+}
+
+uint64_t // NOLINT(build/unsigned)
+DataVolumeEstimator::estimate(const dfmessages::TriggerDecision& decision) const
+{
+  double bytes = 0.;
+  for (const auto& component : decision.components) {
+    if (component.window_end <= component.window_begin)
+      continue;
+
+    bytes += (component.window_end - component.window_begin) * m_bytes_per_tick[index(component.component.subsystem)];
+  }
+
+  return static_cast<uint64_t>(bytes); // NOLINT(build/unsigned)
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
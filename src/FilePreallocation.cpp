@@ -0,0 +1,73 @@
+/**
+ * @file FilePreallocation.cpp File space preallocation implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FilePreallocation.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace dfmodules {
+
+namespace {
+// Closes the file, keeping the errno of the operation that failed, if any
+bool
+close_file(int fd, bool success)
+{
+  int error = errno;
+  ::close(fd);
+  errno = error;
+  return success;
+}
+} // namespace
+
+bool
+preallocate_file_space(const std::string& file_name, uint64_t bytes) // NOLINT(build/unsigned)
+{
+  int fd = ::open(file_name.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  // with FALLOC_FL_KEEP_SIZE, the library writing the file still sees it end where its data ends
+  return close_file(fd, fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, bytes) == 0);
+}
+
+bool
+release_file_space(const std::string& file_name, uint64_t* released_bytes) // NOLINT(build/unsigned)
+{
+  int fd = ::open(file_name.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  // truncating a file to its own size frees the blocks allocated beyond its end
+  struct stat before;
+  struct stat after;
+  if (fstat(fd, &before) != 0 || ftruncate(fd, before.st_size) != 0) {
+    return close_file(fd, false);
+  }
+  if (released_bytes != nullptr && fstat(fd, &after) == 0 && after.st_blocks < before.st_blocks) {
+    *released_bytes += static_cast<uint64_t>(before.st_blocks - after.st_blocks) * 512; // NOLINT(build/unsigned)
+  }
+  return close_file(fd, true);
+}
+
+uint64_t // NOLINT(build/unsigned)
+allocated_file_space(const std::string& file_name)
+{
+  // st_blocks counts 512-byte units, whatever the block size of the file system
+  struct stat file_status;
+  if (stat(file_name.c_str(), &file_status) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(file_status.st_blocks) * 512; // NOLINT(build/unsigned)
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,387 @@
+/**
+ * @file FragmentCompressor.cpp FragmentCompressor Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FragmentCompressor.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+#include <zlib.h>
+#ifdef DFMODULES_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace dunedaq {
+namespace dfmodules {
+
+using daqdataformats::Fragment;
+using daqdataformats::FragmentHeader;
+
+namespace {
+uint64_t // NOLINT(build/unsigned)
+thread_cpu_time_us()
+{
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000; // NOLINT(build/unsigned)
+}
+
+size_t
+compress_bound(CompressionCodec codec, size_t size)
+{
+#ifdef DFMODULES_HAVE_ZSTD
+  if (codec == CompressionCodec::kZstd)
+    return ZSTD_compressBound(size);
+#endif
+  return compressBound(size);
+}
+
+// Returns the compressed size, or 0 if the codec failed
+size_t
+encode(const FragmentCompressor::Setting& setting, const char* input, size_t size, char* output, size_t capacity)
+{
+  switch (setting.codec) {
+    case CompressionCodec::kZlib: {
+      uLongf output_size = capacity;
+      int level = setting.level > 0 ? setting.level : Z_DEFAULT_COMPRESSION;
+      if (compress2(reinterpret_cast<Bytef*>(output), &output_size, reinterpret_cast<const Bytef*>(input), size, level) !=
+          Z_OK)
+        return 0;
+      return output_size;
+    }
+#ifdef DFMODULES_HAVE_ZSTD
+    case CompressionCodec::kZstd: {
+      size_t output_size = ZSTD_compress(output, capacity, input, size, setting.level);
+      return ZSTD_isError(output_size) ? 0 : output_size;
+    }
+#endif
+    default:
+      return 0;
+  }
+}
+
+// Returns an empty string, or the reason of the failure
+std::string
+decode(CompressionCodec codec, const char* input, size_t size, char* output, size_t expected_size)
+{
+  switch (codec) {
+    case CompressionCodec::kZlib: {
+      uLongf output_size = expected_size;
+      int result =
+        uncompress(reinterpret_cast<Bytef*>(output), &output_size, reinterpret_cast<const Bytef*>(input), size);
+      if (result != Z_OK)
+        return std::string("zlib error ") + std::to_string(result);
+      return output_size == expected_size ? "" : "unexpected decompressed size";
+    }
+#ifdef DFMODULES_HAVE_ZSTD
+    case CompressionCodec::kZstd: {
+      size_t output_size = ZSTD_decompress(output, expected_size, input, size);
+      if (ZSTD_isError(output_size))
+        return ZSTD_getErrorName(output_size);
+      return output_size == expected_size ? "" : "unexpected decompressed size";
+    }
+#endif
+    default:
+      return "codec " + std::to_string(static_cast<int>(codec)) + " is not available";
+  }
+}
+
+std::unique_ptr<Fragment>
+share(const Fragment& fragment)
+{
+  return std::make_unique<Fragment>(fragment.get_storage_location(), Fragment::BufferAdoptionMode::kReadOnlyMode);
+}
+} // namespace
+
+// The tasks of a record, which its compress() call waits for
+struct FragmentCompressor::Batch
+{
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t remaining{ 0 };
+};
+
+FragmentCompressor::FragmentCompressor(const Config& config)
+  : m_config(config)
+  , m_tasks(1024)
+{
+  for (auto& [type, setting] : m_config.settings) {
+    if (!codec_available(setting.codec)) {
+      throw InvalidCompressionConfig(ERS_HERE,
+                                     "the codec for " + daqdataformats::fragment_type_to_string(type) +
+                                       " fragments is not available in this build");
+    }
+  }
+  for (size_t i = 0; i < m_config.threads; ++i) {
+    m_threads.push_back(std::make_unique<dunedaq::utilities::WorkerThread>(
+      std::bind(&FragmentCompressor::do_work, this, std::placeholders::_1)));
+    m_threads.back()->start_working_thread("compress-" + std::to_string(i));
+  }
+}
+
+FragmentCompressor::~FragmentCompressor()
+{
+  for (auto& thread : m_threads) {
+    thread->stop_working_thread();
+  }
+}
+
+CompressionCodec
+FragmentCompressor::codec_from_string(const std::string& name)
+{
+  CompressionCodec codec = CompressionCodec::kNone;
+  if (name == "zlib") {
+    codec = CompressionCodec::kZlib;
+  } else if (name == "zstd") {
+    codec = CompressionCodec::kZstd;
+  } else if (name != "none") {
+    throw InvalidCompressionConfig(ERS_HERE, "unknown codec \"" + name + "\"");
+  }
+  if (!codec_available(codec)) {
+    throw InvalidCompressionConfig(ERS_HERE, "the " + name + " codec is not available in this build");
+  }
+  return codec;
+}
+
+std::string
+FragmentCompressor::codec_to_string(CompressionCodec codec)
+{
+  switch (codec) {
+    case CompressionCodec::kNone:
+      return "none";
+    case CompressionCodec::kZlib:
+      return "zlib";
+    case CompressionCodec::kZstd:
+      return "zstd";
+  }
+  return "unknown";
+}
+
+bool
+FragmentCompressor::codec_available(CompressionCodec codec)
+{
+#ifndef DFMODULES_HAVE_ZSTD
+  if (codec == CompressionCodec::kZstd)
+    return false;
+#endif
+  return codec == CompressionCodec::kNone || codec == CompressionCodec::kZlib || codec == CompressionCodec::kZstd;
+}
+
+std::unique_ptr<daqdataformats::TriggerRecord>
+FragmentCompressor::compress(const daqdataformats::TriggerRecord& record)
+{
+  fragments_t fragments;
+  compress_fragments(record.get_fragments_ref(), fragments);
+  auto compressed = std::make_unique<daqdataformats::TriggerRecord>(record.get_header_ref());
+  for (auto& fragment : fragments) {
+    compressed->add_fragment(std::move(fragment));
+  }
+  return compressed;
+}
+
+std::unique_ptr<daqdataformats::TimeSlice>
+FragmentCompressor::compress(const daqdataformats::TimeSlice& slice)
+{
+  fragments_t fragments;
+  compress_fragments(slice.get_fragments_ref(), fragments);
+  auto compressed = std::make_unique<daqdataformats::TimeSlice>(slice.get_header());
+  for (auto& fragment : fragments) {
+    compressed->add_fragment(std::move(fragment));
+  }
+  return compressed;
+}
+
+void
+FragmentCompressor::compress_fragments(const fragments_t& input, fragments_t& output)
+{
+  output.resize(input.size());
+  Batch batch;
+  std::vector<Task> tasks;
+  for (size_t i = 0; i < input.size(); ++i) {
+    const Fragment& fragment = *input[i];
+    auto setting = m_config.settings.find(fragment.get_fragment_type());
+    if (setting == m_config.settings.end() || setting->second.codec == CompressionCodec::kNone ||
+        fragment.get_data_size() < m_config.min_payload_size) {
+      output[i] = share(fragment);
+    } else {
+      tasks.push_back(Task{ &fragment, &output[i], setting->second, &batch });
+    }
+  }
+  if (tasks.empty())
+    return;
+
+  batch.remaining = tasks.size();
+  for (auto& task : tasks) {
+    Task queued = task;
+    if (m_threads.empty() || !m_tasks.push(std::move(queued), std::chrono::milliseconds(0))) {
+      run(task);
+    }
+  }
+
+  // the calling thread takes its share of the work while waiting
+  Task task;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lk(batch.mutex);
+      if (batch.remaining == 0)
+        break;
+    }
+    if (m_tasks.pop(task, std::chrono::milliseconds(0))) {
+      run(task);
+    } else {
+      std::unique_lock<std::mutex> lk(batch.mutex);
+      batch.done.wait_for(lk, std::chrono::milliseconds(1), [&batch]() { return batch.remaining == 0; });
+    }
+  }
+}
+
+void
+FragmentCompressor::run(Task& task)
+{
+  try {
+    *task.output = compress_fragment(*task.input, task.setting);
+  } catch (const std::bad_alloc&) {
+    TLOG() << "Not enough memory to compress a fragment, storing it uncompressed";
+    *task.output = share(*task.input);
+  }
+
+  // the batch may be gone as soon as its last task is counted
+  std::lock_guard<std::mutex> lk(task.batch->mutex);
+  if (--task.batch->remaining == 0)
+    task.batch->done.notify_all();
+}
+
+std::unique_ptr<Fragment>
+FragmentCompressor::compress_fragment(const Fragment& fragment, const Setting& setting)
+{
+  auto cpu_start = thread_cpu_time_us();
+  auto payload = static_cast<const char*>(fragment.get_data());
+  size_t payload_size = fragment.get_data_size();
+  size_t prefix_size = sizeof(FragmentHeader) + sizeof(CompressedPayloadHeader);
+  size_t capacity = compress_bound(setting.codec, payload_size);
+
+  auto buffer = static_cast<char*>(std::malloc(prefix_size + capacity)); // NOLINT
+  if (buffer == nullptr) {
+    throw std::bad_alloc();
+  }
+  size_t compressed_size = encode(setting, payload, payload_size, buffer + prefix_size, capacity);
+  m_input_bytes += payload_size;
+
+  std::unique_ptr<Fragment> result;
+  if (compressed_size == 0 || sizeof(CompressedPayloadHeader) + compressed_size >= payload_size) {
+    std::free(buffer); // NOLINT
+    ++m_incompressible_fragments;
+    m_output_bytes += payload_size;
+    result = share(fragment);
+  } else {
+    FragmentHeader header = fragment.get_header();
+    header.size = prefix_size + compressed_size;
+    std::memcpy(buffer, &header, sizeof(header));
+    CompressedPayloadHeader payload_header;
+    payload_header.uncompressed_size = payload_size;
+    payload_header.codec = setting.codec;
+    std::memcpy(buffer + sizeof(FragmentHeader), &payload_header, sizeof(payload_header));
+    // the worst case capacity is released, the record may wait in a queue
+    auto shrunk = static_cast<char*>(std::realloc(buffer, header.size)); // NOLINT
+    if (shrunk != nullptr)
+      buffer = shrunk;
+
+    ++m_compressed_fragments;
+    m_output_bytes += sizeof(CompressedPayloadHeader) + compressed_size;
+    result = std::make_unique<Fragment>(buffer, Fragment::BufferAdoptionMode::kTakeOverBuffer);
+  }
+  m_cpu_time_us += thread_cpu_time_us() - cpu_start;
+  return result;
+}
+
+bool
+FragmentCompressor::is_compressed(const Fragment& fragment)
+{
+  if (fragment.get_data_size() < sizeof(CompressedPayloadHeader))
+    return false;
+  uint64_t magic = 0; // NOLINT(build/unsigned)
+  std::memcpy(&magic, fragment.get_data(), sizeof(magic));
+  return magic == kCompressedPayloadMagic;
+}
+
+std::unique_ptr<Fragment>
+FragmentCompressor::decompress(const Fragment& fragment)
+{
+  if (!is_compressed(fragment)) {
+    return std::make_unique<Fragment>(fragment.get_storage_location(), Fragment::BufferAdoptionMode::kCopyFromBuffer);
+  }
+
+  CompressedPayloadHeader payload_header;
+  std::memcpy(&payload_header, fragment.get_data(), sizeof(payload_header));
+  auto buffer = static_cast<char*>(std::malloc(sizeof(FragmentHeader) + payload_header.uncompressed_size)); // NOLINT
+  if (buffer == nullptr) {
+    throw std::bad_alloc();
+  }
+  std::string error = decode(payload_header.codec,
+                             static_cast<const char*>(fragment.get_data()) + sizeof(payload_header),
+                             fragment.get_data_size() - sizeof(payload_header),
+                             buffer + sizeof(FragmentHeader),
+                             payload_header.uncompressed_size);
+  if (!error.empty()) {
+    std::free(buffer); // NOLINT
+    throw FragmentDecompressionFailed(ERS_HERE, daqdataformats::fragment_type_to_string(fragment.get_fragment_type()), error);
+  }
+
+  FragmentHeader header = fragment.get_header();
+  header.size = sizeof(FragmentHeader) + payload_header.uncompressed_size;
+  std::memcpy(buffer, &header, sizeof(header));
+  return std::make_unique<Fragment>(buffer, Fragment::BufferAdoptionMode::kTakeOverBuffer);
+}
+
+FragmentCompressor::Statistics
+FragmentCompressor::take_statistics()
+{
+  Statistics statistics;
+  statistics.input_bytes = m_input_bytes.exchange(0);
+  statistics.output_bytes = m_output_bytes.exchange(0);
+  statistics.cpu_time_us = m_cpu_time_us.exchange(0);
+  statistics.compressed_fragments = m_compressed_fragments.exchange(0);
+  statistics.incompressible_fragments = m_incompressible_fragments.exchange(0);
+  return statistics;
+}
+
+std::string
+FragmentCompressor::describe() const
+{
+  std::ostringstream description;
+  for (auto& [type, setting] : m_config.settings) {
+    if (setting.codec == CompressionCodec::kNone)
+      continue;
+    if (description.tellp() > 0)
+      description << ",";
+    description << daqdataformats::fragment_type_to_string(type) << ":" << codec_to_string(setting.codec) << ":"
+                << setting.level;
+  }
+  return description.str();
+}
+
+void
+FragmentCompressor::do_work(std::atomic<bool>& running_flag)
+{
+  Task task;
+  while (running_flag.load() || !m_tasks.empty()) {
+    if (m_tasks.pop(task, std::chrono::milliseconds(10))) {
+      run(task);
+    }
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,161 @@
+/**
+ * @file FreeSpaceTracker.cpp FreeSpaceTracker Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FreeSpaceTracker.hpp"
+
+#include <algorithm>
+#include <sys/statvfs.h>
+#include <thread>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+FreeSpaceTracker::FreeSpaceTracker(query_fun_t query)
+  : m_query(std::move(query))
+  , m_refresh_thread(std::bind(&FreeSpaceTracker::do_refresh, this, std::placeholders::_1))
+{}
+
+FreeSpaceTracker::~FreeSpaceTracker()
+{
+  stop();
+}
+
+FreeSpaceTracker::Usage
+FreeSpaceTracker::query_statvfs(const std::string& path)
+{
+  Usage usage;
+  struct statvfs vfs_results;
+  if (statvfs(path.c_str(), &vfs_results) != 0)
+    return usage;
+
+  usage.valid = true;
+  usage.free_bytes = static_cast<uint64_t>(vfs_results.f_bsize) * vfs_results.f_bavail;  // NOLINT(build/unsigned)
+  usage.total_bytes = static_cast<uint64_t>(vfs_results.f_bsize) * vfs_results.f_blocks; // NOLINT(build/unsigned)
+  return usage;
+}
+
+void
+FreeSpaceTracker::start(const std::string& path, const Config& config)
+{
+  stop();
+  m_path = path;
+  m_config = config;
+  m_sync_refreshes = 0;
+  m_async_refreshes = 0;
+  // the files of the previous runs are closed, and their space released
+  m_reserved = 0;
+
+  refresh();
+  if (m_config.refresh_interval.count() > 0) {
+    m_refresh_thread.start_working_thread("free-space");
+  }
+}
+
+void
+FreeSpaceTracker::stop()
+{
+  if (m_refresh_thread.thread_running()) {
+    m_refresh_thread.stop_working_thread();
+  }
+}
+
+void
+FreeSpaceTracker::refresh()
+{
+  // the bytes written while the file system is queried may or may not be included in the result:
+  // they are subtracted anyway, so that the estimate errs on the low side
+  auto written = m_written_since_refresh.load();
+  Usage usage = m_query(m_path);
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_free_at_refresh = usage.valid ? usage.free_bytes : 0;
+  m_written_since_refresh -= written;
+  if (!usage.valid) {
+    m_free_fraction = -1.;
+  } else if (usage.total_bytes > 0) {
+    m_free_fraction =
+      static_cast<float>(static_cast<double>(usage.free_bytes + m_reserved.load()) / usage.total_bytes);
+  }
+}
+
+uint64_t // NOLINT(build/unsigned)
+FreeSpaceTracker::estimate() const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto free_bytes = m_free_at_refresh + m_reserved.load();
+  auto written = m_written_since_refresh.load();
+  return free_bytes > written ? free_bytes - written : 0;
+}
+
+void
+FreeSpaceTracker::record_written(uint64_t bytes, uint64_t reserved_bytes) // NOLINT(build/unsigned)
+{
+  // the writes into preallocated space do not change the free space measured on the file system
+  auto taken = take_reserved(std::min(bytes, reserved_bytes));
+  m_written_since_refresh += bytes - taken;
+}
+
+void
+FreeSpaceTracker::reserve(uint64_t bytes) // NOLINT(build/unsigned)
+{
+  // the space is now missing from the file system until the next measurement, and is counted
+  // like written space until then, so that the estimate does not change
+  m_written_since_refresh += bytes;
+  m_reserved += bytes;
+}
+
+void
+FreeSpaceTracker::release(uint64_t bytes) // NOLINT(build/unsigned)
+{
+  // the released space only counts as free once it is measured, which errs on the low side
+  take_reserved(bytes);
+}
+
+uint64_t // NOLINT(build/unsigned)
+FreeSpaceTracker::take_reserved(uint64_t bytes) // NOLINT(build/unsigned)
+{
+  auto reserved = m_reserved.load();
+  uint64_t taken = 0; // NOLINT(build/unsigned)
+  do {
+    taken = std::min(bytes, reserved);
+  } while (!m_reserved.compare_exchange_weak(reserved, reserved - taken));
+  return taken;
+}
+
+uint64_t // NOLINT(build/unsigned)
+FreeSpaceTracker::available(uint64_t needed_bytes) // NOLINT(build/unsigned)
+{
+  if (m_config.refresh_interval.count() > 0) {
+    auto free_bytes = estimate();
+    if (free_bytes >= m_config.sync_margin * needed_bytes)
+      return free_bytes;
+  }
+
+  refresh();
+  ++m_sync_refreshes;
+  return estimate();
+}
+
+void
+FreeSpaceTracker::do_refresh(std::atomic<bool>& running_flag)
+{
+  auto last_refresh = std::chrono::steady_clock::now();
+  while (running_flag.load()) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_refresh >= m_config.refresh_interval) {
+      refresh();
+      ++m_async_refreshes;
+      last_refresh = now;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,127 @@
+/**
+ * @file HDF5FileTuning.cpp HDF5FileTuning Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/HDF5FileTuning.hpp"
+
+#include <hdf5.h>
+
+#include <map>
+#include <sstream>
+
+namespace dunedaq {
+namespace dfmodules {
+
+namespace {
+// the limits the HDF5 library puts on the size of the metadata cache
+constexpr uint64_t kMinMetadataCacheSize = 1024;              // NOLINT(build/unsigned)
+constexpr uint64_t kMaxMetadataCacheSize = 128 * 1024 * 1024; // NOLINT(build/unsigned)
+
+const std::map<std::string, H5F_libver_t>&
+libver_bounds()
+{
+  static const std::map<std::string, H5F_libver_t> bounds{ { "earliest", H5F_LIBVER_EARLIEST },
+                                                           { "v18", H5F_LIBVER_V18 },
+                                                           { "v110", H5F_LIBVER_V110 },
+#if H5_VERSION_GE(1, 12, 0)
+                                                           { "v112", H5F_LIBVER_V112 },
+#endif
+                                                           { "latest", H5F_LIBVER_LATEST } };
+  return bounds;
+}
+
+void
+check(herr_t status, const std::string& function)
+{
+  if (status < 0) {
+    throw InvalidHDF5Tuning(ERS_HERE, function + " failed");
+  }
+}
+} // namespace
+
+void
+HDF5FileTuning::validate() const
+{
+  if (metadata_cache_size != 0 &&
+      (metadata_cache_size < kMinMetadataCacheSize || metadata_cache_size > kMaxMetadataCacheSize)) {
+    throw InvalidHDF5Tuning(ERS_HERE,
+                            "the metadata cache size must be between " + std::to_string(kMinMetadataCacheSize) +
+                              " and " + std::to_string(kMaxMetadataCacheSize) + " bytes");
+  }
+  if (alignment == 0) {
+    throw InvalidHDF5Tuning(ERS_HERE, "the alignment must be at least 1");
+  }
+  if (core_driver && core_driver_increment == 0) {
+    throw InvalidHDF5Tuning(ERS_HERE, "the core driver increment must be at least 1");
+  }
+  if (libver_bounds().count(libver_low_bound) == 0) {
+    throw InvalidHDF5Tuning(ERS_HERE,
+                            "unknown or unsupported library version bound \"" + libver_low_bound + "\"");
+  }
+}
+
+bool
+HDF5FileTuning::is_default() const
+{
+  return describe().empty();
+}
+
+std::string
+HDF5FileTuning::describe() const
+{
+  std::ostringstream description;
+  auto add = [&](const std::string& name, const auto& value) {
+    description << (description.tellp() > 0 ? "," : "") << name << '=' << value;
+  };
+  if (metadata_cache_size != 0)
+    add("metadata_cache_size", metadata_cache_size);
+  if (alignment > 1)
+    add("alignment", std::to_string(alignment) + "/" + std::to_string(alignment_threshold));
+  if (metadata_block_size != 0)
+    add("metadata_block_size", metadata_block_size);
+  if (core_driver)
+    add("core_driver_increment", core_driver_increment);
+  if (libver_low_bound != "earliest")
+    add("libver_low_bound", libver_low_bound);
+  return description.str();
+}
+
+void
+HDF5FileTuning::apply(hid_t fapl) const
+{
+  validate();
+
+  if (metadata_cache_size != 0) {
+    H5AC_cache_config_t config;
+    config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+    check(H5Pget_mdc_config(fapl, &config), "H5Pget_mdc_config");
+    config.set_initial_size = true;
+    config.initial_size = metadata_cache_size;
+    config.max_size = metadata_cache_size;
+    if (config.min_size > metadata_cache_size) {
+      config.min_size = metadata_cache_size;
+    }
+    check(H5Pset_mdc_config(fapl, &config), "H5Pset_mdc_config");
+  }
+  if (alignment > 1) {
+    check(H5Pset_alignment(fapl, alignment_threshold, alignment), "H5Pset_alignment");
+  }
+  if (metadata_block_size != 0) {
+    check(H5Pset_meta_block_size(fapl, metadata_block_size), "H5Pset_meta_block_size");
+  }
+  if (core_driver) {
+    // with the backing store, the file image is written to disk when the file is closed
+    check(H5Pset_fapl_core(fapl, core_driver_increment, true), "H5Pset_fapl_core");
+  }
+  if (libver_low_bound != "earliest") {
+    check(H5Pset_libver_bounds(fapl, libver_bounds().at(libver_low_bound), H5F_LIBVER_LATEST),
+          "H5Pset_libver_bounds");
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
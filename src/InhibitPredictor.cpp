@@ -0,0 +1,110 @@
+/**
+ * @file InhibitPredictor.cpp InhibitPredictor Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/InhibitPredictor.hpp"
+
+#include <algorithm>
+
+namespace dunedaq {
+namespace dfmodules {
+
+void
+InhibitPredictor::reset(clock_t::time_point now)
+{
+  m_arrivals = 0;
+  m_completions = 0;
+  m_arrival_rate = 0.;
+  m_completion_rate = 0.;
+  m_last_rate_update = now;
+
+  m_inhibited = false;
+  m_last_change = now;
+
+  m_statistics_start = now;
+  m_inhibited_time = clock_t::duration(0);
+  m_transitions = 0;
+}
+
+void
+InhibitPredictor::update_rates(clock_t::time_point now)
+{
+  auto elapsed = now - m_last_rate_update;
+  if (elapsed < m_config.rate_interval)
+    return;
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  double arrival_rate = m_arrivals.exchange(0) / seconds;
+  double completion_rate = m_completions.exchange(0) / seconds;
+  m_arrival_rate += m_config.smoothing * (arrival_rate - m_arrival_rate);
+  m_completion_rate += m_config.smoothing * (completion_rate - m_completion_rate);
+  m_last_rate_update = now;
+}
+
+bool
+InhibitPredictor::predicts_exhaustion(size_t free_slots) const
+{
+  if (m_config.horizon.count() <= 0)
+    return false;
+
+  double net_rate = m_arrival_rate - m_completion_rate;
+  if (net_rate <= 0.)
+    return false;
+
+  // hysteresis: once inhibited, the prediction has to clear twice the horizon to release
+  double horizon = std::chrono::duration<double>(m_config.horizon).count();
+  if (m_inhibited)
+    horizon *= 2.;
+
+  return free_slots / net_rate < horizon;
+}
+
+bool
+InhibitPredictor::evaluate(bool reactive_busy, size_t free_slots, clock_t::time_point now)
+{
+  update_rates(now);
+
+  bool wanted = reactive_busy || predicts_exhaustion(free_slots);
+  if (wanted == m_inhibited)
+    return m_inhibited;
+
+  // the slots are exhausted: the inhibit cannot wait for the dwell time
+  bool immediate = wanted && reactive_busy;
+  if (!immediate && now - m_last_change < m_config.min_dwell)
+    return m_inhibited;
+
+  if (m_inhibited)
+    m_inhibited_time += now - std::max(m_last_change, m_statistics_start);
+
+  m_inhibited = wanted;
+  m_last_change = now;
+  ++m_transitions;
+  return m_inhibited;
+}
+
+InhibitPredictor::Statistics
+InhibitPredictor::collect_statistics(clock_t::time_point now)
+{
+  Statistics stats;
+
+  auto inhibited_time = m_inhibited_time;
+  if (m_inhibited)
+    inhibited_time += now - std::max(m_last_change, m_statistics_start);
+
+  auto interval = now - m_statistics_start;
+  if (interval.count() > 0)
+    stats.duty_cycle = std::chrono::duration<double>(inhibited_time) / interval;
+  stats.transitions = m_transitions;
+
+  m_statistics_start = now;
+  m_inhibited_time = clock_t::duration(0);
+  m_transitions = 0;
+  return stats;
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,135 @@
+/**
+ * @file LatencyHistory.cpp LatencyHistory Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/LatencyHistory.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dunedaq {
+namespace dfmodules {
+
+size_t
+LatencyHistory::bucket_of(uint64_t value_us)
+{
+  if (value_us < s_sub_buckets)
+    return value_us;
+
+  unsigned exponent = 63 - __builtin_clzll(value_us);
+  if (exponent >= s_max_exponent)
+    return s_n_buckets - 1;
+
+  unsigned shift = exponent - s_sub_bucket_bits;
+  size_t sub = (value_us >> shift) & (s_sub_buckets - 1);
+  return s_sub_buckets + shift * s_sub_buckets + sub;
+}
+
+uint64_t
+LatencyHistory::bucket_value(size_t bucket)
+{
+  if (bucket < s_sub_buckets)
+    return bucket;
+
+  unsigned shift = (bucket - s_sub_buckets) / s_sub_buckets;
+  uint64_t sub = (bucket - s_sub_buckets) % s_sub_buckets;
+  uint64_t lower = (s_sub_buckets + sub) << shift;
+  // middle of the bucket
+  return lower + ((uint64_t(1) << shift) >> 1);
+}
+
+void
+LatencyHistory::add(clock_t::time_point when, std::chrono::microseconds latency)
+{
+  uint64_t value = latency.count() > 0 ? latency.count() : 0;
+
+  if (m_size == s_capacity) {
+    const auto& oldest = m_entries[m_next];
+    uint64_t old_value = oldest.latency.count() > 0 ? oldest.latency.count() : 0;
+    m_sum_us -= old_value;
+    --m_buckets[bucket_of(old_value)];
+  } else {
+    ++m_size;
+  }
+
+  m_entries[m_next] = Entry{ when, latency };
+  m_next = (m_next + 1) % s_capacity;
+  m_sum_us += value;
+  ++m_buckets[bucket_of(value)];
+}
+
+void
+LatencyHistory::clear()
+{
+  m_next = 0;
+  m_size = 0;
+  m_sum_us = 0;
+  m_buckets.fill(0);
+}
+
+std::chrono::microseconds
+LatencyHistory::mean() const
+{
+  if (m_size == 0)
+    return std::chrono::microseconds(0);
+
+  return std::chrono::microseconds(m_sum_us / m_size);
+}
+
+std::chrono::microseconds
+LatencyHistory::quantile(double q) const
+{
+  if (m_size == 0)
+    return std::chrono::microseconds(0);
+
+  q = std::clamp(q, 0., 1.);
+  size_t rank = std::max<size_t>(1, static_cast<size_t>(std::ceil(q * m_size)));
+
+  size_t cumulative = 0;
+  for (size_t b = 0; b < s_n_buckets; ++b) {
+    cumulative += m_buckets[b];
+    if (cumulative >= rank)
+      return std::chrono::microseconds(bucket_value(b));
+  }
+
+  return std::chrono::microseconds(bucket_value(s_n_buckets - 1));
+}
+
+LatencyHistory::Summary
+LatencyHistory::summary() const
+{
+  Summary s;
+  s.count = m_size;
+  s.mean = mean();
+  s.p50 = quantile(0.5);
+  s.p99 = quantile(0.99);
+  return s;
+}
+
+std::chrono::microseconds
+LatencyHistory::average_since(clock_t::time_point since) const
+{
+  std::chrono::microseconds sum(0);
+  size_t count = 0;
+  for (size_t i = 0; i < m_size; ++i) {
+    // walk backwards from the most recent entry
+    const auto& entry = m_entries[(m_next + s_capacity - 1 - i) % s_capacity];
+    if (entry.when < since)
+      break;
+
+    ++count;
+    sum += entry.latency;
+  }
+
+  if (count == 0)
+    return std::chrono::microseconds(0);
+
+  return sum / count;
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
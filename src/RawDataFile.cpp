@@ -0,0 +1,445 @@
+/**
+ * @file RawDataFile.cpp RawDataFileWriter and RawDataFileReader Classes Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/RawDataFile.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace dfmodules {
+
+namespace {
+size_t
+round_up_to_block(size_t size)
+{
+  return (size + kRawFileBlockSize - 1) / kRawFileBlockSize * kRawFileBlockSize;
+}
+} // namespace
+
+RawDataFileWriter::aligned_buffer_t
+RawDataFileWriter::allocate_aligned(size_t size)
+{
+  void* memory = nullptr;
+  if (posix_memalign(&memory, kRawFileBlockSize, size) != 0) {
+    throw std::bad_alloc();
+  }
+  return aligned_buffer_t(static_cast<char*>(memory));
+}
+
+RawDataFileWriter::RawDataFileWriter(const Config& config)
+  : m_config(config)
+{
+  m_config.buffer_size = round_up_to_block(std::max<size_t>(m_config.buffer_size, 1));
+  m_config.io_depth = std::max<size_t>(m_config.io_depth, 1);
+  // one buffer is filled while the others are written
+  m_buffers.resize(m_config.io_depth + 1);
+  for (auto& buffer : m_buffers) {
+    buffer.data = allocate_aligned(m_config.buffer_size);
+  }
+  m_free_buffers.set_capacity(m_buffers.size());
+  m_engine = make_write_engine(m_config.io_engine, m_config.io_depth);
+}
+
+RawDataFileWriter::~RawDataFileWriter()
+{
+  if (is_open()) {
+    try {
+      close();
+    } catch (const ers::Issue& excpt) {
+      ers::error(excpt);
+    }
+  }
+}
+
+void
+RawDataFileWriter::open(const std::string& file_name, const RawFileHeader& header)
+{
+  if (is_open()) {
+    close();
+  }
+
+  std::string writing_name = file_name + kRawFileWritingSuffix;
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  m_using_direct_io = m_config.direct_io;
+  m_fd = ::open(writing_name.c_str(), flags | (m_using_direct_io ? O_DIRECT : 0), 0644);
+  if (m_fd < 0 && m_using_direct_io && errno == EINVAL) {
+    // e.g. tmpfs does not support direct I/O
+    TLOG() << "Direct I/O is not supported for " << writing_name << ", using buffered I/O";
+    m_using_direct_io = false;
+    m_fd = ::open(writing_name.c_str(), flags, 0644);
+  }
+  if (m_fd < 0) {
+    throw RawDataFileProblem(ERS_HERE, "open", writing_name, std::strerror(errno));
+  }
+
+  // the preallocation is an optimisation: the file systems that do not support it are fine without
+  m_preallocated_bytes = 0;
+  if (m_config.preallocate_bytes > 0) {
+    if (fallocate(m_fd, 0, 0, m_config.preallocate_bytes) == 0) {
+      m_preallocated_bytes = m_config.preallocate_bytes;
+    } else {
+      TLOG_DEBUG(5) << "Unable to preallocate " << m_config.preallocate_bytes << " bytes for " << writing_name << ": "
+                    << std::strerror(errno);
+    }
+  }
+
+  m_file_name = file_name;
+  m_index.clear();
+  m_data_bytes = 0;
+  {
+    std::lock_guard<std::mutex> lk(m_io_error_mutex);
+    m_io_error.clear();
+  }
+  {
+    std::lock_guard<std::mutex> lk(m_completion_mutex);
+    m_write_failed = false;
+  }
+
+  // the header takes the whole first block
+  auto header_block = allocate_aligned(kRawFileBlockSize);
+  std::memset(header_block.get(), 0, kRawFileBlockSize);
+  std::memcpy(header_block.get(), &header, sizeof(header));
+  try {
+    write_at(header_block.get(), kRawFileBlockSize, 0);
+  } catch (...) {
+    ::close(m_fd);
+    m_fd = -1;
+    throw;
+  }
+
+  // all the buffers are idle once the previous file is closed
+  m_free_buffers.clear();
+  for (size_t i = 1; i < m_buffers.size(); ++i) {
+    Buffer* buffer = &m_buffers[i];
+    m_free_buffers.push(std::move(buffer), std::chrono::milliseconds(0));
+  }
+  m_active = &m_buffers[0];
+  m_active->used = 0;
+  m_active->carried = 0;
+  m_active->file_offset = kRawFileBlockSize;
+  m_appending = false;
+  m_overlapping_submission = 0;
+}
+
+void
+RawDataFileWriter::append(RawRecordType type,
+                          uint64_t record_number,  // NOLINT(build/unsigned)
+                          uint16_t sequence_number, // NOLINT(build/unsigned)
+                          const std::vector<piece_t>& pieces)
+{
+  if (!is_open()) {
+    throw RawDataFileProblem(ERS_HERE, "append to", m_file_name, "the file is not open");
+  }
+  // nothing more goes into a file with a failed write
+  check_io_error();
+
+  RawIndexEntry entry;
+  entry.record_number = record_number;
+  entry.sequence_number = sequence_number;
+  entry.record_type = type;
+  entry.offset = kRawFileBlockSize + m_data_bytes;
+
+  // the buffer writes that include the end of the record complete it
+  m_appending_end = entry.offset;
+  for (auto& piece : pieces) {
+    m_appending_end += piece.second;
+  }
+  m_appending = true;
+
+  try {
+    for (auto& piece : pieces) {
+      auto source = static_cast<const char*>(piece.first);
+      size_t remaining = piece.second;
+      while (remaining > 0) {
+        size_t n = std::min(remaining, m_config.buffer_size - m_active->used);
+        std::memcpy(m_active->data.get() + m_active->used, source, n);
+        m_active->used += n;
+        source += n;
+        remaining -= n;
+        if (m_active->used == m_config.buffer_size) {
+          submit_active_buffer();
+        }
+      }
+      entry.size += piece.second;
+    }
+  } catch (...) {
+    // the part of the record already in the buffers is not in the index, and the file can only be closed
+    m_appending = false;
+    throw;
+  }
+
+  m_appending = false;
+  ++m_appended_records;
+  m_data_bytes += entry.size;
+  m_index.push_back(entry);
+}
+
+void
+RawDataFileWriter::flush()
+{
+  if (!is_open()) {
+    return;
+  }
+  if (m_active->used > m_active->carried) {
+    submit_active_buffer();
+  }
+  // the records waiting for a failed write will not complete
+  check_io_error();
+}
+
+void
+RawDataFileWriter::submit_active_buffer()
+{
+  Buffer* buffer = m_active;
+  size_t data_end = buffer->used;
+  // direct I/O needs whole blocks: a partial last block is padded with zeros
+  size_t size = round_up_to_block(data_end);
+  std::memset(buffer->data.get() + data_end, 0, size - data_end);
+
+  auto start_time = std::chrono::steady_clock::now();
+  // a partial block written by the previous buffer is written again by this one: the two writes must not be
+  // reordered
+  if (m_overlapping_submission > 0) {
+    wait_for_submission(m_overlapping_submission);
+    m_overlapping_submission = 0;
+  }
+
+  uint64_t records = m_appended_records; // NOLINT(build/unsigned)
+  if (m_appending && m_appending_end <= buffer->file_offset + data_end) {
+    ++records;
+  }
+  uint64_t sequence = ++m_submission_count; // NOLINT(build/unsigned)
+  {
+    std::lock_guard<std::mutex> lk(m_completion_mutex);
+    m_submissions.push_back(Submission{ sequence, records, false, false });
+  }
+  m_engine->submit(m_fd, buffer->data.get(), size, buffer->file_offset, [this, buffer, sequence](int error) {
+    complete_submission(buffer, sequence, error);
+  });
+
+  Buffer* next = nullptr;
+  while (!m_free_buffers.pop(next, std::chrono::milliseconds(100))) {
+    check_io_error();
+  }
+  m_buffer_wait_us +=
+    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+
+  // the next buffer continues where this one stops, from the start of its partial block if any.
+  // The buffer being written is only read, and may already be the next one.
+  size_t tail = data_end % kRawFileBlockSize;
+  next->file_offset = buffer->file_offset + data_end - tail;
+  std::memmove(next->data.get(), buffer->data.get() + data_end - tail, tail);
+  next->used = tail;
+  next->carried = tail;
+  if (tail > 0) {
+    m_overlapping_submission = sequence;
+  }
+  m_active = next;
+  check_io_error();
+}
+
+void
+RawDataFileWriter::complete_submission(Buffer* buffer, uint64_t sequence, int error) // NOLINT(build/unsigned)
+{
+  if (error != 0) {
+    std::lock_guard<std::mutex> lk(m_io_error_mutex);
+    if (m_io_error.empty())
+      m_io_error = std::strerror(error);
+  }
+  {
+    std::lock_guard<std::mutex> lk(m_completion_mutex);
+    for (auto& submission : m_submissions) {
+      if (submission.sequence == sequence) {
+        submission.done = true;
+        submission.failed = (error != 0);
+        break;
+      }
+    }
+    // the writes complete in any order, the records in the order of the file. After a failed
+    // write, the records of the file are no longer complete, even if the next writes succeed
+    while (!m_submissions.empty() && m_submissions.front().done) {
+      if (m_submissions.front().failed)
+        m_write_failed = true;
+      if (!m_write_failed && m_submissions.front().records > m_completed_records.load())
+        m_completed_records = m_submissions.front().records;
+      m_submissions.pop_front();
+    }
+  }
+  m_completion_cv.notify_all();
+  m_free_buffers.push(std::move(buffer), std::chrono::milliseconds(0));
+}
+
+void
+RawDataFileWriter::wait_for_submission(uint64_t sequence) // NOLINT(build/unsigned)
+{
+  std::unique_lock<std::mutex> lk(m_completion_mutex);
+  m_completion_cv.wait(lk, [this, sequence]() {
+    for (auto& submission : m_submissions) {
+      if (submission.sequence == sequence)
+        return submission.done;
+    }
+    return true;
+  });
+}
+
+void
+RawDataFileWriter::close()
+{
+  if (!is_open()) {
+    return;
+  }
+
+  std::string writing_name = m_file_name + kRawFileWritingSuffix;
+  std::string error;
+  try {
+    flush();
+  } catch (const ers::Issue& excpt) {
+    error = excpt.message();
+  }
+  m_engine->drain();
+  {
+    std::lock_guard<std::mutex> lk(m_io_error_mutex);
+    if (error.empty())
+      error = m_io_error;
+  }
+
+  if (error.empty()) {
+    // the index, with the trailer at the end of its last block
+    RawFileTrailer trailer;
+    trailer.index_offset = round_up_to_block(kRawFileBlockSize + m_data_bytes);
+    trailer.index_entries = m_index.size();
+    trailer.data_bytes = m_data_bytes;
+    size_t index_bytes = m_index.size() * sizeof(RawIndexEntry);
+    size_t tail_size = round_up_to_block(index_bytes + sizeof(trailer));
+    auto tail = allocate_aligned(tail_size);
+    std::memset(tail.get(), 0, tail_size);
+    if (index_bytes > 0) {
+      std::memcpy(tail.get(), m_index.data(), index_bytes);
+    }
+    std::memcpy(tail.get() + tail_size - sizeof(trailer), &trailer, sizeof(trailer));
+    try {
+      write_at(tail.get(), tail_size, trailer.index_offset);
+      // drop what is left of the preallocated space
+      if (ftruncate(m_fd, trailer.index_offset + tail_size) != 0) {
+        error = std::string("truncate: ") + std::strerror(errno);
+      }
+    } catch (const ers::Issue& excpt) {
+      error = excpt.message();
+    }
+  }
+
+  ::close(m_fd);
+  m_fd = -1;
+  m_index.clear();
+
+  if (!error.empty()) {
+    throw RawDataFileProblem(ERS_HERE, "close", writing_name, error);
+  }
+  if (std::rename(writing_name.c_str(), m_file_name.c_str()) != 0) {
+    throw RawDataFileProblem(ERS_HERE, "rename", writing_name, std::strerror(errno));
+  }
+}
+
+void
+RawDataFileWriter::write_at(const char* data, size_t size, uint64_t offset) // NOLINT(build/unsigned)
+{
+  while (size > 0) {
+    ssize_t n = pwrite(m_fd, data, size, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw RawDataFileProblem(ERS_HERE, "write", m_file_name + kRawFileWritingSuffix, std::strerror(errno));
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+void
+RawDataFileWriter::check_io_error()
+{
+  std::lock_guard<std::mutex> lk(m_io_error_mutex);
+  if (!m_io_error.empty()) {
+    throw RawDataFileProblem(ERS_HERE, "write", m_file_name + kRawFileWritingSuffix, m_io_error);
+  }
+}
+
+RawDataFileReader::RawDataFileReader(const std::string& file_name)
+  : m_file_name(file_name)
+{
+  m_fd = ::open(file_name.c_str(), O_RDONLY);
+  if (m_fd < 0) {
+    throw RawDataFileProblem(ERS_HERE, "open", file_name, std::strerror(errno));
+  }
+
+  try {
+    read_at(&m_header, sizeof(m_header), 0);
+    if (m_header.magic != kRawFileMagic || m_header.version != kRawFileVersion) {
+      throw RawDataFileProblem(ERS_HERE, "read", file_name, "not a raw data file, or an unsupported version");
+    }
+
+    off_t file_size = lseek(m_fd, 0, SEEK_END);
+    if (file_size < static_cast<off_t>(kRawFileBlockSize + sizeof(RawFileTrailer))) {
+      throw RawDataFileProblem(ERS_HERE, "read", file_name, "the file is truncated, it may not have been closed");
+    }
+    RawFileTrailer trailer;
+    read_at(&trailer, sizeof(trailer), file_size - sizeof(trailer));
+    if (trailer.magic != kRawFileMagic) {
+      throw RawDataFileProblem(ERS_HERE, "read", file_name, "the trailer is missing, the file may not have been closed");
+    }
+
+    m_index.resize(trailer.index_entries);
+    if (!m_index.empty()) {
+      read_at(m_index.data(), m_index.size() * sizeof(RawIndexEntry), trailer.index_offset);
+    }
+  } catch (...) {
+    ::close(m_fd);
+    throw;
+  }
+}
+
+RawDataFileReader::~RawDataFileReader()
+{
+  ::close(m_fd);
+}
+
+std::vector<char>
+RawDataFileReader::read(const RawIndexEntry& entry) const
+{
+  std::vector<char> record(entry.size);
+  read_at(record.data(), record.size(), entry.offset);
+  return record;
+}
+
+void
+RawDataFileReader::read_at(void* data, size_t size, uint64_t offset) const // NOLINT(build/unsigned)
+{
+  auto destination = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = pread(m_fd, destination, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      throw RawDataFileProblem(ERS_HERE, "read", m_file_name, n < 0 ? std::strerror(errno) : "unexpected end of file");
+    }
+    destination += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,190 @@
+/**
+ * @file SchedulingPolicy.cpp SchedulingPolicy Classes Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/SchedulingPolicy.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+
+/**
+ * @brief Name used by TRACE TLOG calls from this source file
+ */
+#define TRACE_NAME "SchedulingPolicy" // NOLINT
+
+namespace dunedaq {
+namespace dfmodules {
+
+SchedulingPolicy::Selection
+RoundRobinPolicy::select(const data_structure_t& apps,
+                         const dfmessages::TriggerDecision& /*decision*/,
+                         uint64_t estimated_bytes) // NOLINT(build/unsigned)
+{
+  // Applications in error are skipped.
+  // We only probe the applications once.
+  // Degraded applications are only used if all the others are busy.
+  // If they are all busy, the assignment is set to
+  // the application with the lowest load
+  auto first_degraded = apps.end();
+  auto minimum_occupied = apps.end();
+  double minimum = std::numeric_limits<double>::max();
+
+  auto candidate_it = apps.upper_bound(m_last_assigned);
+  for (size_t counter = 0; counter < apps.size(); ++counter, ++candidate_it) {
+
+    if (candidate_it == apps.end())
+      candidate_it = apps.begin();
+
+    // get rid of the applications in error state or quarantined
+    if (candidate_it->second->is_in_error() || candidate_it->second->is_quarantined())
+      continue;
+
+    auto load = candidate_it->second->load(estimated_bytes);
+    if (load < minimum) {
+      minimum = load;
+      minimum_occupied = candidate_it;
+    }
+
+    if (candidate_it->second->is_busy())
+      continue;
+
+    if (candidate_it->second->is_degraded()) {
+      if (first_degraded == apps.end())
+        first_degraded = candidate_it;
+      continue;
+    }
+
+    m_last_assigned = candidate_it->first;
+    return { candidate_it, false };
+  }
+
+  if (first_degraded != apps.end()) {
+    m_last_assigned = first_degraded->first;
+    return { first_degraded, false };
+  }
+
+  if (minimum_occupied != apps.end())
+    m_last_assigned = minimum_occupied->first;
+
+  return { minimum_occupied, true };
+}
+
+LatencyWeightedPolicy::LatencyWeightedPolicy()
+  : m_generator(std::random_device{}())
+{}
+
+double
+LatencyWeightedPolicy::predicted_finish_time(const TriggerRecordBuilderData& app)
+{
+  auto rate = app.capacity_rate();
+  // applications without a measurement are preferred, so that they get one
+  if (rate <= 0.)
+    return 0.;
+
+  return (app.used_slots() + 1) / rate;
+}
+
+SchedulingPolicy::Selection
+LatencyWeightedPolicy::select(const data_structure_t& apps,
+                              const dfmessages::TriggerDecision& /*decision*/,
+                              uint64_t estimated_bytes) // NOLINT(build/unsigned)
+{
+  m_candidates.clear();
+  for (auto it = apps.begin(); it != apps.end(); ++it) {
+    if (!it->second->is_busy() && !it->second->is_degraded())
+      m_candidates.push_back(it);
+  }
+
+  // degraded applications are only considered if there is no healthy one
+  if (m_candidates.empty()) {
+    for (auto it = apps.begin(); it != apps.end(); ++it) {
+      if (!it->second->is_busy())
+        m_candidates.push_back(it);
+    }
+  }
+
+  auto better = [estimated_bytes](data_structure_t::const_iterator a, data_structure_t::const_iterator b) {
+    auto time_a = predicted_finish_time(*a->second);
+    auto time_b = predicted_finish_time(*b->second);
+    if (time_a != time_b)
+      return time_a < time_b;
+    return a->second->load(estimated_bytes) < b->second->load(estimated_bytes);
+  };
+
+  if (m_candidates.size() == 1)
+    return { m_candidates.front(), false };
+
+  if (m_candidates.size() > 1) {
+    std::uniform_int_distribution<size_t> first_dist(0, m_candidates.size() - 1);
+    std::uniform_int_distribution<size_t> second_dist(0, m_candidates.size() - 2);
+    auto first = first_dist(m_generator);
+    auto second = second_dist(m_generator);
+    if (second >= first)
+      ++second;
+
+    auto chosen = better(m_candidates[second], m_candidates[first]) ? m_candidates[second] : m_candidates[first];
+    return { chosen, false };
+  }
+
+  // all the applications are busy or in error:
+  // select the one expected to finish first among those not in error or quarantined
+  auto best = apps.end();
+  for (auto it = apps.begin(); it != apps.end(); ++it) {
+    if (it->second->is_in_error() || it->second->is_quarantined())
+      continue;
+    if (best == apps.end() || better(it, best))
+      best = it;
+  }
+
+  return { best, true };
+}
+
+SchedulingPolicy::Selection
+LeastLoadedPolicy::select(const data_structure_t& apps,
+                          const dfmessages::TriggerDecision& /*decision*/,
+                          uint64_t estimated_bytes) // NOLINT(build/unsigned)
+{
+  auto best = apps.end();
+  // applications that are not busy always win over the busy ones,
+  // and healthy ones over the degraded ones
+  std::tuple<bool, bool, double> best_rank{ true, true, std::numeric_limits<double>::max() };
+
+  for (auto it = apps.begin(); it != apps.end(); ++it) {
+    if (it->second->is_in_error() || it->second->is_quarantined())
+      continue;
+
+    std::tuple<bool, bool, double> rank{ it->second->is_busy(),
+                                         it->second->is_degraded(),
+                                         it->second->load(estimated_bytes) };
+    if (best == apps.end() || rank < best_rank) {
+      best = it;
+      best_rank = rank;
+    }
+  }
+
+  return { best, std::get<0>(best_rank) };
+}
+
+std::unique_ptr<SchedulingPolicy>
+make_scheduling_policy(const std::string& name)
+{
+  if (name == "round-robin" || name.empty())
+    return std::make_unique<RoundRobinPolicy>();
+  if (name == "latency-weighted")
+    return std::make_unique<LatencyWeightedPolicy>();
+  if (name == "least-loaded")
+    return std::make_unique<LeastLoadedPolicy>();
+
+  throw UnknownSchedulingPolicy(ERS_HERE, name);
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
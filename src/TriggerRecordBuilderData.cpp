@@ -14,6 +14,8 @@
 
 #include "logging/Logging.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <string>
@@ -39,7 +41,7 @@ TriggerRecordBuilderData::TriggerRecordBuilderData(std::string connection_name,
                                                    size_t busy_threshold,
                                                    size_t free_threshold)
   : m_busy_threshold(busy_threshold)
-  , m_free_threshold(busy_threshold)
+  , m_free_threshold(free_threshold)
   , m_is_busy(false)
   , m_in_error(false)
   , m_connection_name(connection_name)
@@ -53,17 +55,24 @@ TriggerRecordBuilderData::extract_assignment(daqdataformats::trigger_number_t tr
 {
   std::shared_ptr<AssignedTriggerDecision> dec_ptr;
   auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  bool was_busy = is_busy();
+  size_t old_slots = m_assigned_trigger_decisions.size();
+  auto old_bytes = m_outstanding_bytes.load();
   for (auto it = m_assigned_trigger_decisions.begin(); it != m_assigned_trigger_decisions.end(); ++it) {
     if ((*it)->decision.trigger_number == trigger_number) {
       dec_ptr = *it;
+      m_outstanding_bytes -= dec_ptr->estimated_bytes;
       m_assigned_trigger_decisions.erase(it);
       break;
     }
   }
 
-  if (m_assigned_trigger_decisions.size() < m_free_threshold.load())
+  bool bytes_below_free = m_busy_threshold_bytes.load() == 0 || m_outstanding_bytes.load() < m_free_threshold_bytes.load();
+  if (m_assigned_trigger_decisions.size() < m_free_threshold.load() && bytes_below_free)
     m_is_busy.store(false);
 
+  update_occupancy(was_busy, old_slots, old_bytes);
+
   return dec_ptr;
 }
 
@@ -82,7 +91,8 @@ TriggerRecordBuilderData::get_assignment(daqdataformats::trigger_number_t trigge
 
 std::shared_ptr<AssignedTriggerDecision>
 TriggerRecordBuilderData::complete_assignment(daqdataformats::trigger_number_t trigger_number,
-                                              std::function<void(nlohmann::json&)> metadata_fun)
+                                              std::function<void(nlohmann::json&)> metadata_fun,
+                                              std::chrono::steady_clock::time_point now)
 {
 
   auto dec_ptr = extract_assignment(trigger_number);
@@ -90,27 +100,21 @@ TriggerRecordBuilderData::complete_assignment(daqdataformats::trigger_number_t t
   if (dec_ptr == nullptr)
     throw AssignedTriggerDecisionNotFound(ERS_HERE, trigger_number, m_connection_name);
 
-  auto now = std::chrono::steady_clock::now();
-  auto time = std::chrono::duration_cast<std::chrono::microseconds>(now - dec_ptr->assigned_time);
   {
-    auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
-    m_latency_info.emplace_back(now, time);
+    auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+    m_last_token_time = now;
+  }
+  ++m_completed_counter;
 
-    if (m_latency_info.size() > 1000)
-      m_latency_info.pop_front();
+  auto completion_time = std::chrono::duration_cast<std::chrono::microseconds>(now - dec_ptr->assigned_time);
+  {
+    auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
+    m_latency_info.add(now, completion_time);
   }
 
   if (metadata_fun)
     metadata_fun(m_metadata);
 
-  ++m_complete_counter;
-  auto completion_time =
-    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dec_ptr->assigned_time);
-  if (completion_time.count() < m_min_complete_time.load())
-    m_min_complete_time.store(completion_time.count());
-  if (completion_time.count() > m_max_complete_time.load())
-    m_max_complete_time.store(completion_time.count());
-
   opmon::TRCompleteInfo i;
   i.set_completion_time(completion_time.count());
   i.set_tr_number( dec_ptr->decision.trigger_number );
@@ -126,27 +130,38 @@ TriggerRecordBuilderData::flush()
 {
 
   auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  bool was_busy = is_busy();
+  size_t old_slots = m_assigned_trigger_decisions.size();
+  auto old_bytes = m_outstanding_bytes.load();
   std::list<std::shared_ptr<AssignedTriggerDecision>> ret;
 
   for (const auto& td : m_assigned_trigger_decisions) {
     ret.push_back(td);
   }
   m_assigned_trigger_decisions.clear();
+  m_outstanding_bytes = 0;
 
   auto stat_lock = std::lock_guard<std::mutex>(m_latency_info_mutex);
   m_latency_info.clear();
   m_is_busy = false;
 
   m_in_error = false;
+  m_quarantine = QuarantineReason::kNone;
+  m_completed_counter = 0;
+  m_last_tuning = std::chrono::steady_clock::time_point();
   m_metadata = nlohmann::json();
+  m_degraded_until = 0;
+
+  update_occupancy(was_busy, old_slots, old_bytes);
 
   return ret;
 }
 
 std::shared_ptr<AssignedTriggerDecision>
-TriggerRecordBuilderData::make_assignment(dfmessages::TriggerDecision decision)
+TriggerRecordBuilderData::make_assignment(dfmessages::TriggerDecision decision,
+                                          uint64_t estimated_bytes) // NOLINT(build/unsigned)
 {
-  return std::make_shared<AssignedTriggerDecision>(decision, m_connection_name);
+  return std::make_shared<AssignedTriggerDecision>(decision, m_connection_name, estimated_bytes);
 }
 
 void
@@ -157,12 +172,223 @@ TriggerRecordBuilderData::add_assignment(std::shared_ptr<AssignedTriggerDecision
   if (is_in_error())
     throw NoSlotsAvailable(ERS_HERE, assignment->decision.trigger_number, m_connection_name);
 
+  bool was_busy = is_busy();
+  size_t old_slots = m_assigned_trigger_decisions.size();
+  auto old_bytes = m_outstanding_bytes.load();
+  if (m_assigned_trigger_decisions.empty())
+    m_outstanding_since = assignment->assigned_time;
   m_assigned_trigger_decisions.push_back(assignment);
+  m_outstanding_bytes += assignment->estimated_bytes;
+  ++m_assigned_counter;
   TLOG_DEBUG(13) << "Size of assigned_trigger_decision list is " << m_assigned_trigger_decisions.size();
 
   if (m_assigned_trigger_decisions.size() >= m_busy_threshold.load()) {
     m_is_busy.store(true);
   }
+  if (m_busy_threshold_bytes.load() > 0 && m_outstanding_bytes.load() >= m_busy_threshold_bytes.load()) {
+    m_is_busy.store(true);
+  }
+
+  update_occupancy(was_busy, old_slots, old_bytes);
+}
+
+void
+TriggerRecordBuilderData::set_in_error(bool err)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  bool was_busy = is_busy();
+  m_in_error = err;
+  update_occupancy(was_busy, m_assigned_trigger_decisions.size(), m_outstanding_bytes.load());
+}
+
+void
+TriggerRecordBuilderData::set_byte_thresholds(uint64_t busy_threshold, uint64_t free_threshold) // NOLINT
+{
+  if (busy_threshold < free_threshold)
+    throw dfmodules::DFOThresholdsNotConsistent(ERS_HERE, busy_threshold, free_threshold);
+
+  m_busy_threshold_bytes = busy_threshold;
+  m_free_threshold_bytes = free_threshold;
+}
+
+void
+TriggerRecordBuilderData::set_writer_health_limits(const WriterHealthLimits& limits)
+{
+  auto lk = std::lock_guard<std::mutex>(m_writer_health_mutex);
+  m_health_limits = limits;
+}
+
+void
+TriggerRecordBuilderData::update_writer_health(const WriterHealth& health)
+{
+  auto lk = std::lock_guard<std::mutex>(m_writer_health_mutex);
+  m_writer_health = health;
+
+  bool degraded = false;
+  if (m_health_limits.max_write_latency.count() > 0 &&
+      health.write_latency_us > m_health_limits.max_write_latency.count())
+    degraded = true;
+  if (m_health_limits.min_disk_free_fraction > 0. && health.disk_free_fraction >= 0. &&
+      health.disk_free_fraction < m_health_limits.min_disk_free_fraction)
+    degraded = true;
+  if (m_health_limits.max_queue_depth > 0 && health.queue_depth > m_health_limits.max_queue_depth)
+    degraded = true;
+
+  if (degraded) {
+    auto until = std::chrono::steady_clock::now() + m_health_limits.hold_time;
+    m_degraded_until = until.time_since_epoch().count();
+  } else {
+    m_degraded_until = 0;
+  }
+}
+
+bool
+TriggerRecordBuilderData::tune_thresholds(const ThresholdTuning& tuning, std::chrono::steady_clock::time_point now)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+
+  auto completed = m_completed_counter.exchange(0);
+  auto previous = m_last_tuning;
+  m_last_tuning = now;
+  // nothing to learn from the first interval or from an idle application
+  if (previous == std::chrono::steady_clock::time_point() || completed == 0 || tuning.target_delay.count() <= 0)
+    return false;
+
+  double elapsed = std::chrono::duration<double>(now - previous).count();
+  if (elapsed <= 0.)
+    return false;
+
+  // number of decisions that complete within the target delay at the measured rate.
+  // The threshold only moves half way towards it, to damp the oscillations
+  double wanted = completed / elapsed * std::chrono::duration<double>(tuning.target_delay).count();
+  size_t old_busy = m_busy_threshold.load();
+  auto busy = static_cast<size_t>(std::ceil(0.5 * (old_busy + wanted)));
+  busy = std::clamp(
+    busy, std::max<size_t>(tuning.min_busy_threshold, 1), std::max<size_t>(tuning.max_busy_threshold, 1));
+  auto free = std::clamp(static_cast<size_t>(std::lround(busy * tuning.free_fraction)), size_t(1), busy);
+
+  if (busy == old_busy && free == m_free_threshold.load())
+    return false;
+
+  bool was_busy = is_busy();
+  m_busy_threshold = busy;
+  m_free_threshold = free;
+  if (m_occupancy) {
+    m_occupancy->slot_capacity += busy;
+    m_occupancy->slot_capacity -= old_busy;
+  }
+
+  size_t slots = m_assigned_trigger_decisions.size();
+  if (slots >= busy)
+    m_is_busy = true;
+  else if (slots < free &&
+           (m_busy_threshold_bytes.load() == 0 || m_outstanding_bytes.load() < m_free_threshold_bytes.load()))
+    m_is_busy = false;
+
+  update_occupancy(was_busy, slots, m_outstanding_bytes.load());
+
+  TLOG_DEBUG(13) << "Thresholds of " << m_connection_name << " set to " << busy << '/' << free << " after "
+                 << completed << " completions in " << elapsed << " s";
+  return true;
+}
+
+void
+TriggerRecordBuilderData::set_liveness_limits(const LivenessLimits& limits)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  m_liveness_limits = limits;
+}
+
+bool
+TriggerRecordBuilderData::update_liveness(std::chrono::steady_clock::time_point now)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+
+  auto reason = QuarantineReason::kNone;
+  if (!m_assigned_trigger_decisions.empty()) {
+    // the assignments are kept in order, the oldest is the first
+    auto max_age = m_liveness_limits.max_assignment_age;
+    if (max_age.count() > 0 && now - m_assigned_trigger_decisions.front()->assigned_time > max_age)
+      reason = QuarantineReason::kStaleAssignment;
+
+    auto max_silence = m_liveness_limits.max_token_silence;
+    if (reason == QuarantineReason::kNone && max_silence.count() > 0 &&
+        now - std::max(m_last_token_time, m_outstanding_since) > max_silence)
+      reason = QuarantineReason::kTokenSilence;
+  }
+
+  if (reason == m_quarantine.load())
+    return false;
+
+  bool was_busy = is_busy();
+  m_quarantine = reason;
+  update_occupancy(was_busy, m_assigned_trigger_decisions.size(), m_outstanding_bytes.load());
+  return true;
+}
+
+WriterHealth
+TriggerRecordBuilderData::writer_health() const
+{
+  auto lk = std::lock_guard<std::mutex>(m_writer_health_mutex);
+  return m_writer_health;
+}
+
+double
+TriggerRecordBuilderData::load(uint64_t extra_bytes) const // NOLINT(build/unsigned)
+{
+  double result = m_busy_threshold.load() > 0 ? static_cast<double>(used_slots()) / m_busy_threshold.load() : 0.;
+
+  auto busy_bytes = m_busy_threshold_bytes.load();
+  if (busy_bytes > 0) {
+    double byte_load = static_cast<double>(m_outstanding_bytes.load() + extra_bytes) / busy_bytes;
+    if (byte_load > result)
+      result = byte_load;
+  }
+
+  return result;
+}
+
+void
+TriggerRecordBuilderData::set_occupancy_counters(std::shared_ptr<TRBOccupancy> occupancy)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  m_occupancy = occupancy;
+  if (!m_occupancy)
+    return;
+
+  ++m_occupancy->apps;
+  m_occupancy->slot_capacity += m_busy_threshold.load();
+  if (is_busy())
+    ++m_occupancy->busy_apps;
+  m_occupancy->used_slots += m_assigned_trigger_decisions.size();
+  m_occupancy->outstanding_bytes += m_outstanding_bytes.load();
+}
+
+void
+TriggerRecordBuilderData::update_occupancy(bool was_busy, size_t old_slots, uint64_t old_bytes) // NOLINT
+{
+  size_t new_slots = m_assigned_trigger_decisions.size();
+  m_used_slots = new_slots;
+
+  if (!m_occupancy)
+    return;
+
+  if (new_slots > old_slots)
+    m_occupancy->used_slots += new_slots - old_slots;
+  else if (new_slots < old_slots)
+    m_occupancy->used_slots -= old_slots - new_slots;
+
+  auto new_bytes = m_outstanding_bytes.load();
+  if (new_bytes > old_bytes)
+    m_occupancy->outstanding_bytes += new_bytes - old_bytes;
+  else if (new_bytes < old_bytes)
+    m_occupancy->outstanding_bytes -= old_bytes - new_bytes;
+
+  bool busy = is_busy();
+  if (busy && !was_busy)
+    ++m_occupancy->busy_apps;
+  else if (!busy && was_busy)
+    --m_occupancy->busy_apps;
 }
 
 void
@@ -176,6 +402,7 @@ TriggerRecordBuilderData::generate_opmon_data()
 
   auto lk = std::unique_lock<std::mutex>(m_assigned_trigger_decisions_mutex);
   info.set_outstanding_decisions(m_assigned_trigger_decisions.size());
+  info.set_outstanding_bytes(m_outstanding_bytes.load());
   auto current_time = std::chrono::steady_clock::now();
   for (const auto& dec_ptr : m_assigned_trigger_decisions) {
     auto us_since_assignment =
@@ -190,17 +417,25 @@ TriggerRecordBuilderData::generate_opmon_data()
   
   info.set_total_time_since_assignment(time);
 
-  // estimate of the capcity
-  auto completed_trigger_records = m_complete_counter.exchange(0);
-  if ( completed_trigger_records > 0 ) {
-    m_last_average_time = 1e-6*0.5*(m_min_complete_time.exchange(0) + m_max_complete_time.exchange(0)); // in seconds     
-  }
+  auto latency = latency_summary();
+  info.set_mean_completion_time(latency.mean.count());
+  info.set_median_completion_time(latency.p50.count());
+  info.set_p99_completion_time(latency.p99.count());
 
-  if ( m_last_average_time > 0. ) {
-    // prediction rate metrics
-    info.set_capacity_rate( 0.5*(m_busy_threshold.load()+m_free_threshold.load())/m_last_average_time );
+  auto rate = capacity_rate();
+  if (rate > 0.) {
+    info.set_capacity_rate(rate);
   }
-  
+
+  auto health = writer_health();
+  info.set_write_latency(health.write_latency_us);
+  info.set_disk_free_fraction(health.disk_free_fraction);
+  info.set_writer_queue_depth(health.queue_depth);
+  info.set_degraded(is_degraded());
+  info.set_quarantine_reason(to_string(quarantine_reason()));
+  info.set_busy_threshold(busy_threshold());
+  info.set_free_threshold(free_threshold());
+
   publish(std::move(info));
   
 }
@@ -209,17 +444,30 @@ std::chrono::microseconds
 TriggerRecordBuilderData::average_latency(std::chrono::steady_clock::time_point since) const
 {
   auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
-  std::chrono::microseconds sum = std::chrono::microseconds(0);
-  size_t count = 0;
-  for (auto it = m_latency_info.rbegin(); it != m_latency_info.rend(); ++it) {
-    if (it->first < since)
-      break;
+  return m_latency_info.average_since(since);
+}
+
+LatencyHistory::Summary
+TriggerRecordBuilderData::latency_summary() const
+{
+  auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
+  return m_latency_info.summary();
+}
 
-    count++;
-    sum += it->second;
+double
+TriggerRecordBuilderData::capacity_rate() const
+{
+  std::chrono::microseconds mean_latency;
+  {
+    auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
+    mean_latency = m_latency_info.mean();
   }
 
-  return sum / count;
+  if (mean_latency.count() <= 0)
+    return 0.;
+
+  // estimate of the capacity, based on the mean completion time of the recent history
+  return 0.5 * (m_busy_threshold.load() + m_free_threshold.load()) / (1e-6 * mean_latency.count());
 }
 
 } // namespace dfmodules
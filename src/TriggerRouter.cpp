@@ -0,0 +1,60 @@
+/**
+ * @file TriggerRouter.cpp TriggerRouter Class Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/TriggerRouter.hpp"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+void
+TriggerRouter::clear()
+{
+  m_classes.clear();
+  m_class_of_bit.fill(s_no_class);
+  std::atomic_store(&m_subsets, std::make_shared<const std::vector<snapshot_t>>());
+}
+
+void
+TriggerRouter::add_class(RoutingClass routing_class)
+{
+  size_t index = m_classes.size();
+  for (size_t bit = 0; bit < s_n_bits; ++bit) {
+    if (((routing_class.trigger_types >> bit) & 1) != 0 && m_class_of_bit[bit] == s_no_class)
+      m_class_of_bit[bit] = index;
+  }
+  m_classes.push_back(std::move(routing_class));
+
+  // the subset of the new class is empty until the next update
+  auto subsets = std::make_shared<std::vector<snapshot_t>>(*std::atomic_load(&m_subsets));
+  subsets->resize(m_classes.size(), std::make_shared<const data_structure_t>());
+  std::atomic_store(&m_subsets, std::shared_ptr<const std::vector<snapshot_t>>(subsets));
+}
+
+void
+TriggerRouter::update(const data_structure_t& apps)
+{
+  auto subsets = std::make_shared<std::vector<snapshot_t>>();
+  subsets->reserve(m_classes.size());
+  for (const auto& routing_class : m_classes) {
+    auto subset = std::make_shared<data_structure_t>();
+    for (const auto& destination : routing_class.destinations) {
+      auto it = apps.find(destination);
+      if (it != apps.end())
+        subset->insert(*it);
+    }
+    subsets->push_back(std::move(subset));
+  }
+  std::atomic_store(&m_subsets, std::shared_ptr<const std::vector<snapshot_t>>(subsets));
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,428 @@
+/**
+ * @file WriteEngine.cpp WriteEngine Implementations
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/WriteEngine.hpp"
+#include "dfmodules/BoundedQueue.hpp"
+
+#include "logging/Logging.hpp"
+#include "utilities/WorkerThread.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// io_uring is used through its system calls, with the kernel headers only
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define DFMODULES_HAVE_IO_URING 1
+#endif
+#endif
+
+namespace dunedaq {
+namespace dfmodules {
+
+void
+WriteEngine::drain()
+{
+  std::unique_lock<std::mutex> lk(m_mutex);
+  m_cv.wait(lk, [this]() { return m_in_flight == 0; });
+}
+
+size_t
+WriteEngine::get_in_flight() const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_in_flight;
+}
+
+void
+WriteEngine::acquire_slot()
+{
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cv.wait(lk, [this]() { return m_in_flight < m_queue_depth; });
+    ++m_in_flight;
+  }
+  m_cv.notify_all();
+}
+
+void
+WriteEngine::release_slot()
+{
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    --m_in_flight;
+  }
+  m_cv.notify_all();
+}
+
+bool
+WriteEngine::wait_for_writes(std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lk(m_mutex);
+  return m_cv.wait_for(lk, timeout, [this]() { return m_in_flight > 0; });
+}
+
+int
+WriteEngine::write_fully(int fd, const char* data, size_t size, uint64_t offset) // NOLINT(build/unsigned)
+{
+  while (size > 0) {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    if (n == 0)
+      return EIO;
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+namespace {
+
+struct WriteRequest
+{
+  int fd{ -1 };
+  const char* data{ nullptr };
+  size_t size{ 0 };
+  uint64_t offset{ 0 }; // NOLINT(build/unsigned)
+  WriteEngine::completion_t completion;
+};
+
+/**
+ * @brief One thread per write in flight, each calling pwrite.
+ */
+class ThreadPoolWriteEngine : public WriteEngine
+{
+public:
+  explicit ThreadPoolWriteEngine(size_t queue_depth)
+    : WriteEngine(queue_depth)
+    , m_requests(get_queue_depth())
+  {
+    for (size_t i = 0; i < get_queue_depth(); ++i) {
+      m_threads.push_back(std::make_unique<dunedaq::utilities::WorkerThread>(
+        std::bind(&ThreadPoolWriteEngine::do_write, this, std::placeholders::_1)));
+      m_threads.back()->start_working_thread("write-pool-" + std::to_string(i));
+    }
+  }
+
+  ~ThreadPoolWriteEngine()
+  {
+    drain();
+    for (auto& thread : m_threads) {
+      thread->stop_working_thread();
+    }
+  }
+
+  std::string get_type() const override { return "thread_pool"; }
+
+  void submit(int fd,
+              const void* data,
+              size_t size,
+              uint64_t offset, // NOLINT(build/unsigned)
+              completion_t completion) override
+  {
+    acquire_slot();
+    WriteRequest request{ fd, static_cast<const char*>(data), size, offset, std::move(completion) };
+    // there is room for every write in flight, the push does not wait
+    while (!m_requests.push(std::move(request), std::chrono::milliseconds(100))) {
+    }
+  }
+
+private:
+  void do_write(std::atomic<bool>& running_flag)
+  {
+    WriteRequest request;
+    while (running_flag.load() || !m_requests.empty()) {
+      if (!m_requests.pop(request, std::chrono::milliseconds(10)))
+        continue;
+
+      int error = write_fully(request.fd, request.data, request.size, request.offset);
+      request.completion(error);
+      request.completion = nullptr;
+      release_slot();
+    }
+  }
+
+  BoundedQueue<WriteRequest> m_requests;
+  std::vector<std::unique_ptr<dunedaq::utilities::WorkerThread>> m_threads;
+};
+
+#ifdef DFMODULES_HAVE_IO_URING
+
+/**
+ * @brief Writes through an io_uring. The caller fills the submission queue, and a single
+ * thread waits for the completions, resubmits the short writes and calls the completions.
+ */
+class IoUringWriteEngine : public WriteEngine
+{
+public:
+  explicit IoUringWriteEngine(size_t queue_depth)
+    : WriteEngine(queue_depth)
+    , m_reaper(std::bind(&IoUringWriteEngine::do_reap, this, std::placeholders::_1))
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, get_queue_depth(), &params));
+    if (m_ring_fd < 0) {
+      throw WriteEngineUnavailable(ERS_HERE, "io_uring", std::strerror(errno));
+    }
+    // IORING_OP_WRITE came with the same kernel version (5.6) as this feature flag
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+      ::close(m_ring_fd);
+      throw WriteEngineUnavailable(ERS_HERE, "io_uring", "the kernel does not support the write operation");
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      m_sq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+    m_cq_ring = single_mmap ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+    m_sqes = static_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+    if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+      std::string reason = std::strerror(errno);
+      unmap();
+      throw WriteEngineUnavailable(ERS_HERE, "io_uring", "unable to map the rings: " + reason);
+    }
+
+    auto sq = static_cast<char*>(m_sq_ring);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto cq = static_cast<char*>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // one request slot per write in flight, identified by the user data of the queue entries
+    m_requests.resize(get_queue_depth());
+    for (size_t slot = 0; slot < m_requests.size(); ++slot) {
+      m_free_slots.push_back(slot);
+    }
+    m_reaper.start_working_thread("io-uring");
+  }
+
+  ~IoUringWriteEngine()
+  {
+    drain();
+    m_reaper.stop_working_thread();
+    unmap();
+  }
+
+  std::string get_type() const override { return "io_uring"; }
+
+  void submit(int fd,
+              const void* data,
+              size_t size,
+              uint64_t offset, // NOLINT(build/unsigned)
+              completion_t completion) override
+  {
+    acquire_slot();
+    size_t slot = 0;
+    {
+      std::lock_guard<std::mutex> lk(m_submit_mutex);
+      slot = m_free_slots.back();
+      m_free_slots.pop_back();
+      m_requests[slot] = WriteRequest{ fd, static_cast<const char*>(data), size, offset, std::move(completion) };
+    }
+    push_entry(slot);
+  }
+
+private:
+  void* map(size_t size, off_t offset)
+  {
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, offset);
+  }
+
+  void unmap()
+  {
+    if (m_sqes != nullptr && m_sqes != MAP_FAILED)
+      munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != nullptr && m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+      munmap(m_cq_ring, m_cq_ring_size);
+    if (m_sq_ring != nullptr && m_sq_ring != MAP_FAILED)
+      munmap(m_sq_ring, m_sq_ring_size);
+    ::close(m_ring_fd);
+  }
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+  {
+    return static_cast<int>(syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, nullptr, 0));
+  }
+
+  // Puts the remaining part of the request of the slot into the submission queue, and submits it.
+  // There are never more requests than queue entries, so the queue is never full.
+  void push_entry(size_t slot)
+  {
+    std::lock_guard<std::mutex> lk(m_submit_mutex);
+    const auto& request = m_requests[slot];
+    unsigned tail = *m_sq_tail;
+    unsigned index = tail & m_sq_mask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = request.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(request.data); // NOLINT(build/unsigned)
+    // the length is 32 bits: the larger writes complete short, and their remainder is resubmitted
+    sqe->len = static_cast<uint32_t>(std::min<size_t>(request.size, 1UL << 30)); // NOLINT(build/unsigned)
+    sqe->off = request.offset;
+    sqe->user_data = slot;
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (enter(1, 0, 0) < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        // the entry stays in the queue, and is submitted with the next one
+        TLOG() << "io_uring submission failed: " << std::strerror(errno);
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  void complete(size_t slot, int error)
+  {
+    WriteEngine::completion_t completion;
+    {
+      std::lock_guard<std::mutex> lk(m_submit_mutex);
+      completion = std::move(m_requests[slot].completion);
+      m_requests[slot].completion = nullptr;
+      m_free_slots.push_back(slot);
+    }
+    completion(error);
+    release_slot();
+  }
+
+  // Handles the available completion queue entries, returns false if there were none
+  bool reap()
+  {
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+      return false;
+
+    while (head != tail) {
+      const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+      size_t slot = cqe.user_data;
+      int result = cqe.res;
+      ++head;
+      __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+      bool resubmit = false;
+      int error = 0;
+      {
+        // the requests are shared with the submitting thread
+        std::lock_guard<std::mutex> lk(m_submit_mutex);
+        auto& request = m_requests[slot];
+        if (result == -EINTR || result == -EAGAIN) {
+          resubmit = true;
+        } else if (result < 0) {
+          error = -result;
+        } else if (result == 0) {
+          error = EIO;
+        } else if (static_cast<size_t>(result) < request.size) {
+          request.data += result;
+          request.size -= result;
+          request.offset += result;
+          resubmit = true;
+        }
+      }
+      if (resubmit) {
+        push_entry(slot);
+      } else {
+        complete(slot, error);
+      }
+    }
+    return true;
+  }
+
+  void do_reap(std::atomic<bool>& running_flag)
+  {
+    while (running_flag.load() || get_in_flight() > 0) {
+      if (reap())
+        continue;
+      if (!wait_for_writes(std::chrono::milliseconds(10)))
+        continue;
+      // at least one write is in flight, its completion ends the wait
+      if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        TLOG() << "Waiting for io_uring completions failed: " << std::strerror(errno);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  int m_ring_fd{ -1 };
+  void* m_sq_ring{ nullptr };
+  void* m_cq_ring{ nullptr };
+  io_uring_sqe* m_sqes{ nullptr };
+  size_t m_sq_ring_size{ 0 };
+  size_t m_cq_ring_size{ 0 };
+  size_t m_sqes_size{ 0 };
+  unsigned* m_sq_tail{ nullptr };
+  unsigned m_sq_mask{ 0 };
+  unsigned* m_sq_array{ nullptr };
+  unsigned* m_cq_head{ nullptr };
+  unsigned* m_cq_tail{ nullptr };
+  unsigned m_cq_mask{ 0 };
+  io_uring_cqe* m_cqes{ nullptr };
+
+  std::vector<WriteRequest> m_requests;
+  std::vector<size_t> m_free_slots;
+  std::mutex m_submit_mutex;
+  dunedaq::utilities::WorkerThread m_reaper;
+};
+
+#endif // DFMODULES_HAVE_IO_URING
+
+} // namespace
+
+std::unique_ptr<WriteEngine>
+make_write_engine(const std::string& type, size_t queue_depth)
+{
+  if (type != "io_uring" && type != "thread_pool" && type != "auto") {
+    throw WriteEngineUnavailable(ERS_HERE, type, "unknown type, expected io_uring, thread_pool or auto");
+  }
+
+  if (type != "thread_pool") {
+    try {
+#ifdef DFMODULES_HAVE_IO_URING
+      return std::make_unique<IoUringWriteEngine>(queue_depth);
+#else
+      throw WriteEngineUnavailable(ERS_HERE, "io_uring", "not supported by this build");
+#endif
+    } catch (const WriteEngineUnavailable& excpt) {
+      // only worth a warning if io_uring was asked for explicitly
+      if (type == "io_uring") {
+        ers::warning(excpt);
+      } else {
+        TLOG_DEBUG(5) << excpt.message() << ", using the thread pool";
+      }
+    }
+  }
+  return std::make_unique<ThreadPoolWriteEngine>(queue_depth);
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -0,0 +1,97 @@
+/**
+ * @file BoundedQueue.hpp BoundedQueue Class
+ *
+ * The BoundedQueue class links the stages of a pipeline running in different threads.
+ * A full queue blocks the producer, so that a slow stage slows down the previous ones
+ * instead of accumulating an unbounded amount of data.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
+#define DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Thread-safe FIFO with a maximum size, for any number of producers and consumers.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity = 1)
+    : m_capacity(capacity > 0 ? capacity : 1)
+  {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // To be called while the queue is not in use
+  void set_capacity(size_t capacity) { m_capacity = capacity > 0 ? capacity : 1; }
+  size_t capacity() const { return m_capacity; }
+
+  size_t size() const { return m_size.load(); }
+  bool empty() const { return m_size.load() == 0; }
+
+  // Returns false if the queue was still full after the timeout, in which case the item is left untouched
+  bool push(T&& item, std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_not_full.wait_for(lk, timeout, [this]() { return m_items.size() < m_capacity; }))
+      return false;
+
+    m_items.push_back(std::move(item));
+    m_size = m_items.size();
+    lk.unlock();
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  // Returns false if the queue was still empty after the timeout
+  bool pop(T& item, std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_not_empty.wait_for(lk, timeout, [this]() { return !m_items.empty(); }))
+      return false;
+
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_size = m_items.size();
+    lk.unlock();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_items.clear();
+    m_size = 0;
+    m_not_full.notify_all();
+  }
+
+private:
+  size_t m_capacity;
+  std::deque<T> m_items;
+  std::atomic<size_t> m_size{ 0 }; // readable without the lock
+  mutable std::mutex m_mutex;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
@@ -86,6 +86,39 @@ ERS_DECLARE_ISSUE(dfmodules,         ///< Namespace
                   "Unknown system type " << type,
                   ((std::string)type) ///< Message parameters
 )
+
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       InvalidOperationMode,
+                       appfwk::GeneralDAQModuleIssue,
+                       "Selected operation mode \"" << selected_operation
+                                                    << "\" is NOT supported. Please update the configuration file.",
+                       ((std::string)name),
+                       ((std::string)selected_operation))
+
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       FileOperationProblem,
+                       appfwk::GeneralDAQModuleIssue,
+                       "A problem was encountered when opening or closing file \"" << filename << "\"",
+                       ((std::string)name),
+                       ((std::string)filename))
+
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       InvalidOutputPath,
+                       appfwk::GeneralDAQModuleIssue,
+                       "The specified output destination, \"" << output_path
+                                                              << "\", is not a valid file system path on this server.",
+                       ((std::string)name),
+                       ((std::string)output_path))
+
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       InsufficientDiskSpace,
+                       appfwk::GeneralDAQModuleIssue,
+                       "There is insufficient free space on the disk associated with output file path \""
+                         << path << "\". There are " << free_bytes << " bytes free, and the "
+                         << "required minimum is " << needed_bytes << " bytes based on " << criteria << ".",
+                       ((std::string)name),
+                       ((std::string)path)((size_t)free_bytes)((size_t)needed_bytes)((std::string)criteria))
+
 // Re-enable coverage checking LCOV_EXCL_STOP
 
 } // namespace dunedaq
@@ -0,0 +1,51 @@
+/**
+ * @file DataVolumeEstimator.hpp DataVolumeEstimator Class
+ *
+ * The DataVolumeEstimator class estimates the amount of data that a TriggerDecision
+ * will produce, from the readout windows of its components and a configurable
+ * data rate (in bytes per tick) for each subsystem.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
+#define DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
+
+#include "daqdataformats/SourceID.hpp"
+#include "dfmessages/TriggerDecision.hpp"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace dunedaq {
+namespace dfmodules {
+
+class DataVolumeEstimator
+{
+public:
+  using subsystem_t = daqdataformats::SourceID::Subsystem;
+
+  void set_bytes_per_tick(subsystem_t subsystem, double bytes_per_tick);
+  double bytes_per_tick(subsystem_t subsystem) const { return m_bytes_per_tick[index(subsystem)]; }
+
+  // Returns 0 for subsystems without a configured data rate
+  uint64_t estimate(const dfmessages::TriggerDecision& decision) const; // NOLINT(build/unsigned)
+
+  void clear() { m_bytes_per_tick.fill(0.); }
+
+private:
+  using index_t = std::make_unsigned_t<std::underlying_type_t<subsystem_t>>;
+  static constexpr size_t s_n_subsystems = size_t(std::numeric_limits<index_t>::max()) + 1;
+  static size_t index(subsystem_t subsystem) { return static_cast<index_t>(subsystem); }
+
+  std::array<double, s_n_subsystems> m_bytes_per_tick{};
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
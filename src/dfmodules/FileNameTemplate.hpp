@@ -0,0 +1,113 @@
+/**
+ * @file FileNameTemplate.hpp FileNameTemplate Class
+ *
+ * The FileNameTemplate class builds the names of the raw data files written by the DataStores.
+ * The parts of the names that only depend on the configuration are computed once, and the part
+ * that depends on the run number at the start of each run, so that a name can be built cheaply
+ * whenever a new file is opened.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FILENAMETEMPLATE_HPP_
+#define DFMODULES_SRC_DFMODULES_FILENAMETEMPLATE_HPP_
+
+#include "daqdataformats/Types.hpp"
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include <ctime>
+#include <string>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Naming rules of the raw data files:
+ * [directory/]<operational environment>_<file type prefix>_<run number prefix><run number>_<file index prefix><file index>_<writer identifier><extension>
+ */
+class FileNameTemplate
+{
+public:
+  struct Params
+  {
+    std::string directory_path;
+    std::string operational_environment;
+    std::string file_type_prefix;
+    std::string run_number_prefix;
+    size_t digits_for_run_number{ 0 };
+    std::string file_index_prefix;
+    size_t digits_for_file_index{ 0 };
+    std::string writer_identifier;
+    std::string extension; // including the dot
+  };
+
+  FileNameTemplate() = default;
+
+  explicit FileNameTemplate(const Params& params)
+    : m_params(params)
+  {
+    m_prefix = m_params.directory_path;
+    if (m_prefix.length() > 0) {
+      m_prefix += "/";
+    }
+    m_prefix +=
+      m_params.operational_environment + "_" + m_params.file_type_prefix + "_" + m_params.run_number_prefix;
+    m_suffix = "_" + m_params.writer_identifier + m_params.extension;
+    set_run_number(0);
+  }
+
+  // Precomputes the part of the names that depends on the run number. Unlike get_file_name(), it must
+  // not be called while other threads build names
+  void set_run_number(daqdataformats::run_number_t run_number)
+  {
+    m_run_number = run_number;
+    m_run_part = make_run_part(run_number);
+  }
+
+  // The names of other runs than the one set are built entirely
+  std::string get_file_name(daqdataformats::run_number_t run_number, size_t file_index) const
+  {
+    return (run_number == m_run_number ? m_run_part : make_run_part(run_number)) +
+           zero_padded(file_index, m_params.digits_for_file_index) + m_suffix;
+  }
+
+  // Inserts the creation time before the extension, so that files of repeated runs do not collide
+  std::string make_unique(const std::string& file_name, std::time_t creation_time) const
+  {
+    std::string unique_name = file_name;
+    if (unique_name.length() > m_params.extension.length() + 1) {
+      unique_name.insert(unique_name.length() - m_params.extension.length(),
+                         "_" + boost::posix_time::to_iso_string(boost::posix_time::from_time_t(creation_time)));
+    }
+    return unique_name;
+  }
+
+  static std::string zero_padded(size_t value, size_t digits)
+  {
+    std::string text = std::to_string(value);
+    if (text.length() < digits) {
+      text.insert(0, digits - text.length(), '0');
+    }
+    return text;
+  }
+
+private:
+  std::string make_run_part(daqdataformats::run_number_t run_number) const
+  {
+    return m_prefix + zero_padded(run_number, m_params.digits_for_run_number) + "_" + m_params.file_index_prefix;
+  }
+
+  Params m_params;
+  std::string m_prefix; // up to the run number prefix
+  std::string m_suffix; // after the file index
+  daqdataformats::run_number_t m_run_number{ 0 };
+  std::string m_run_part; // up to the file index prefix
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FILENAMETEMPLATE_HPP_
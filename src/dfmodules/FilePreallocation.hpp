@@ -0,0 +1,57 @@
+/**
+ * @file FilePreallocation.hpp File space preallocation
+ *
+ * Functions to reserve the disk space of an output file when it is opened, so that the file
+ * system allocates it in large extents rather than as the file grows, and to release what is
+ * left of it when the file is closed. They are used for the files whose writes are done by a
+ * library, such as the HDF5 files, and so do not change the size of the files.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FILEPREALLOCATION_HPP_
+#define DFMODULES_SRC_DFMODULES_FILEPREALLOCATION_HPP_
+
+#include <cstdint>
+#include <string>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Reserves bytes of disk space for the file, beyond its current end, without changing its size.
+ * Returns false, with errno set, if the file cannot be opened or the file system does not support it.
+ */
+bool
+preallocate_file_space(const std::string& file_name, uint64_t bytes); // NOLINT(build/unsigned)
+
+/**
+ * @brief Releases the space reserved beyond the end of the file, and adds the number of bytes freed
+ * to released_bytes if given. Returns false, with errno set, on failure.
+ */
+bool
+release_file_space(const std::string& file_name, uint64_t* released_bytes = nullptr); // NOLINT(build/unsigned)
+
+/**
+ * @brief The disk space allocated to the file, 0 if it does not exist
+ */
+uint64_t // NOLINT(build/unsigned)
+allocated_file_space(const std::string& file_name);
+
+/**
+ * @brief The part of a write of size bytes at offset in a file that lands in the first preallocated bytes
+ */
+inline uint64_t // NOLINT(build/unsigned)
+preallocated_part(uint64_t offset, uint64_t size, uint64_t preallocated) // NOLINT(build/unsigned)
+{
+  if (offset >= preallocated)
+    return 0;
+  return preallocated - offset < size ? preallocated - offset : size;
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FILEPREALLOCATION_HPP_
@@ -0,0 +1,256 @@
+/**
+ * @file FileRotation.hpp FileRotation Class
+ *
+ * The FileRotation class takes the opening and closing of the output files of a DataStore
+ * off the writing thread. While a file is being written, the next one is created and prepared
+ * by a background thread, and the files that are done with are closed by that same thread,
+ * so that moving on to the next file only takes the swap of a pointer.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FILEROTATION_HPP_
+#define DFMODULES_SRC_DFMODULES_FILEROTATION_HPP_
+
+#include "dfmodules/BoundedQueue.hpp"
+
+#include "daqdataformats/Types.hpp"
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief What identifies an output file before it is opened
+ */
+struct FileKey
+{
+  daqdataformats::run_number_t run_number{ 0 };
+  size_t file_index{ 0 };
+  unsigned open_flags{ 0 };
+
+  bool operator==(const FileKey& other) const
+  {
+    return run_number == other.run_number && file_index == other.file_index && open_flags == other.open_flags;
+  }
+};
+
+/**
+ * @brief Opens the next output file and closes the previous ones in a background thread.
+ *
+ * prepare(), take(), close() and cancel() are expected to be called from a single writing thread.
+ * The open and close functions are called from the background thread, and the close function
+ * must report its errors itself rather than throw.
+ */
+template<typename File>
+class FileRotation
+{
+public:
+  using file_ptr_t = std::unique_ptr<File>;
+  using open_fun_t = std::function<file_ptr_t(const FileKey&)>;
+  // Called with the files that were written to, and with the prepared files that were not used (unused = true)
+  using close_fun_t = std::function<void(file_ptr_t, bool unused)>;
+
+  FileRotation(open_fun_t open, close_fun_t close, size_t max_queued_tasks = 4)
+    : m_open(std::move(open))
+    , m_close(std::move(close))
+    , m_tasks(max_queued_tasks)
+    , m_thread(std::bind(&FileRotation::do_work, this, std::placeholders::_1))
+  {
+    m_thread.start_working_thread("file-rotation");
+  }
+
+  ~FileRotation()
+  {
+    cancel();
+    m_thread.stop_working_thread();
+  }
+
+  FileRotation(const FileRotation&) = delete;
+  FileRotation& operator=(const FileRotation&) = delete;
+
+  // Starts opening the file for key in the background, unless it is already prepared
+  void prepare(const FileKey& key)
+  {
+    file_ptr_t unused;
+    uint64_t generation = 0; // NOLINT(build/unsigned)
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      if (m_state != State::kNone && m_key == key)
+        return;
+      unused = release_prepared();
+      m_state = State::kOpening;
+      m_key = key;
+      generation = m_generation;
+    }
+    if (unused)
+      close(std::move(unused), true);
+    push(Task{ nullptr, key, generation, true, false });
+  }
+
+  /**
+   * @brief Returns the prepared file for key, waiting for it if it is being opened, or nullptr
+   * if another file, or none, was prepared. A file prepared for another key is discarded.
+   */
+  file_ptr_t take(const FileKey& key)
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cv.wait(lk, [&]() { return m_state != State::kOpening || !(m_key == key); });
+    if (m_state == State::kReady && m_key == key) {
+      m_state = State::kNone;
+      return std::move(m_prepared);
+    }
+    auto unused = release_prepared();
+    lk.unlock();
+    if (unused)
+      close(std::move(unused), true);
+    return nullptr;
+  }
+
+  // Closes a file in the background
+  void close(file_ptr_t file) { close(std::move(file), false); }
+
+  // Discards the prepared file, if any
+  void cancel()
+  {
+    file_ptr_t unused;
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      unused = release_prepared();
+    }
+    if (unused)
+      close(std::move(unused), true);
+  }
+
+  // Waits until the background thread is done with the files given to it, including the discarded ones
+  void wait_until_idle()
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cv.wait(lk, [this]() { return m_pending_tasks == 0; });
+  }
+
+  size_t get_pending_closes() const
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_pending_closes;
+  }
+
+private:
+  enum class State
+  {
+    kNone,
+    kOpening,
+    kReady
+  };
+
+  struct Task
+  {
+    file_ptr_t file;
+    FileKey key;
+    uint64_t generation{ 0 }; // NOLINT(build/unsigned)
+    bool open{ false };
+    bool unused{ false };
+  };
+
+  // To be called with the lock held. Returns the ready file, and makes an opening one stale
+  file_ptr_t release_prepared()
+  {
+    file_ptr_t file = std::move(m_prepared);
+    m_state = State::kNone;
+    ++m_generation;
+    return file;
+  }
+
+  void close(file_ptr_t file, bool unused) { push(Task{ std::move(file), FileKey(), 0, false, unused }); }
+
+  // a full queue blocks the writing thread, so that files do not pile up waiting to be closed
+  void push(Task&& task)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      ++m_pending_tasks;
+      if (!task.open)
+        ++m_pending_closes;
+    }
+    while (!m_tasks.push(std::move(task), std::chrono::milliseconds(10))) {
+    }
+  }
+
+  void do_work(std::atomic<bool>& running)
+  {
+    Task task;
+    while (running.load() || !m_tasks.empty()) {
+      if (!m_tasks.pop(task, std::chrono::milliseconds(10)))
+        continue;
+      if (task.open) {
+        run_open(task);
+      } else {
+        m_close(std::move(task.file), task.unused);
+      }
+      std::lock_guard<std::mutex> lk(m_mutex);
+      --m_pending_tasks;
+      if (!task.open)
+        --m_pending_closes;
+      m_cv.notify_all();
+    }
+  }
+
+  void run_open(Task& task)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      if (task.generation != m_generation)
+        return;
+    }
+
+    // a file that fails to open here is opened again by the writing thread, which reports the problem
+    file_ptr_t file;
+    try {
+      file = m_open(task.key);
+    } catch (...) { // NOLINT(runtime/exceptions)
+    }
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (task.generation == m_generation) {
+      m_prepared = std::move(file);
+      m_state = m_prepared ? State::kReady : State::kNone;
+      m_cv.notify_all();
+      return;
+    }
+    lk.unlock();
+    // not wanted anymore
+    if (file)
+      m_close(std::move(file), true);
+  }
+
+  open_fun_t m_open;
+  close_fun_t m_close;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  State m_state{ State::kNone };
+  FileKey m_key;
+  uint64_t m_generation{ 0 }; // NOLINT(build/unsigned)
+  file_ptr_t m_prepared;
+  size_t m_pending_tasks{ 0 };
+  size_t m_pending_closes{ 0 };
+
+  BoundedQueue<Task> m_tasks;
+  dunedaq::utilities::WorkerThread m_thread;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FILEROTATION_HPP_
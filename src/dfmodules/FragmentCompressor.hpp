@@ -0,0 +1,154 @@
+/**
+ * @file FragmentCompressor.hpp FragmentCompressor Class
+ *
+ * The FragmentCompressor compresses the payloads of the fragments of a record before it is
+ * stored, with a codec and level chosen per fragment type. A compressed fragment keeps its
+ * FragmentHeader, with the size updated, and its payload becomes a CompressedPayloadHeader
+ * followed by the compressed bytes. decompress() restores the original fragment.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
+#define DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
+
+#include "dfmodules/BoundedQueue.hpp"
+
+#include "daqdataformats/Fragment.hpp"
+#include "daqdataformats/TimeSlice.hpp"
+#include "daqdataformats/TriggerRecord.hpp"
+#include "ers/Issue.hpp"
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules,
+                  InvalidCompressionConfig,
+                  "Invalid fragment compression configuration: " << reason,
+                  ((std::string)reason))
+
+ERS_DECLARE_ISSUE(dfmodules,
+                  FragmentDecompressionFailed,
+                  "Unable to decompress a fragment of type " << fragment_type << ": " << reason,
+                  ((std::string)fragment_type)((std::string)reason))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+enum class CompressionCodec : uint8_t // NOLINT(build/unsigned)
+{
+  kNone = 0,
+  kZlib = 1,
+  kZstd = 2
+};
+
+constexpr uint64_t kCompressedPayloadMagic = 0x314c5941505a4644; // NOLINT(build/unsigned) "DFZPAYL1" in memory
+
+struct CompressedPayloadHeader
+{
+  uint64_t magic{ kCompressedPayloadMagic }; // NOLINT(build/unsigned)
+  uint64_t uncompressed_size{ 0 };           // NOLINT(build/unsigned)
+  CompressionCodec codec{ CompressionCodec::kNone };
+  uint8_t reserved[7]{}; // NOLINT(build/unsigned)
+};
+static_assert(sizeof(CompressedPayloadHeader) == 24, "Unexpected size of the compressed payload header");
+
+/**
+ * @brief Compresses the fragments of the records given to it, in parallel: the calling thread
+ * shares the fragments of each record with a pool of threads.
+ *
+ * compress() is expected to be called from one thread at a time.
+ */
+class FragmentCompressor
+{
+public:
+  struct Setting
+  {
+    CompressionCodec codec{ CompressionCodec::kNone };
+    int level{ 0 }; // 0 for the default level of the codec
+  };
+
+  struct Config
+  {
+    std::map<daqdataformats::FragmentType, Setting> settings; // the other fragment types are not compressed
+    size_t threads{ 0 };                                       // in addition to the calling thread
+    size_t min_payload_size{ 1024 };                           // smaller payloads are not worth compressing
+  };
+
+  struct Statistics
+  {
+    uint64_t input_bytes{ 0 };              // payloads given to a codec. NOLINT(build/unsigned)
+    uint64_t output_bytes{ 0 };             // what they are stored as. NOLINT(build/unsigned)
+    uint64_t cpu_time_us{ 0 };              // NOLINT(build/unsigned)
+    uint64_t compressed_fragments{ 0 };     // NOLINT(build/unsigned)
+    uint64_t incompressible_fragments{ 0 }; // stored as they are, the codec did not reduce them. NOLINT
+  };
+
+  explicit FragmentCompressor(const Config& config);
+  ~FragmentCompressor();
+
+  FragmentCompressor(const FragmentCompressor&) = delete;
+  FragmentCompressor& operator=(const FragmentCompressor&) = delete;
+
+  // "none", "zlib" or "zstd". Throws InvalidCompressionConfig for the unknown codecs and those not in this build
+  static CompressionCodec codec_from_string(const std::string& name);
+  static std::string codec_to_string(CompressionCodec codec);
+  static bool codec_available(CompressionCodec codec);
+
+  // The fragments that are not compressed are shared with the original record, which must outlive the copy
+  std::unique_ptr<daqdataformats::TriggerRecord> compress(const daqdataformats::TriggerRecord& record);
+  std::unique_ptr<daqdataformats::TimeSlice> compress(const daqdataformats::TimeSlice& slice);
+
+  static bool is_compressed(const daqdataformats::Fragment& fragment);
+  // Returns a copy of the fragment if it is not compressed
+  static std::unique_ptr<daqdataformats::Fragment> decompress(const daqdataformats::Fragment& fragment);
+
+  // Returns the statistics accumulated since the previous call
+  Statistics take_statistics();
+
+  // The settings, as "<fragment type>:<codec>:<level>" separated by commas
+  std::string describe() const;
+
+private:
+  using fragments_t = std::vector<std::unique_ptr<daqdataformats::Fragment>>;
+  struct Batch;
+  struct Task
+  {
+    const daqdataformats::Fragment* input{ nullptr };
+    std::unique_ptr<daqdataformats::Fragment>* output{ nullptr };
+    Setting setting;
+    Batch* batch{ nullptr };
+  };
+
+  void compress_fragments(const fragments_t& input, fragments_t& output);
+  void run(Task& task);
+  std::unique_ptr<daqdataformats::Fragment> compress_fragment(const daqdataformats::Fragment& fragment,
+                                                              const Setting& setting);
+  void do_work(std::atomic<bool>&);
+
+  Config m_config;
+  BoundedQueue<Task> m_tasks;
+  std::vector<std::unique_ptr<dunedaq::utilities::WorkerThread>> m_threads;
+
+  std::atomic<uint64_t> m_input_bytes{ 0 };              // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_output_bytes{ 0 };             // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_cpu_time_us{ 0 };              // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_compressed_fragments{ 0 };     // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_incompressible_fragments{ 0 }; // NOLINT(build/unsigned)
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
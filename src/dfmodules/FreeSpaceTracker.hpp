@@ -0,0 +1,117 @@
+/**
+ * @file FreeSpaceTracker.hpp FreeSpaceTracker Class
+ *
+ * The FreeSpaceTracker class estimates the free space on the file system of an output path
+ * without querying the file system for every write. The free space is measured periodically
+ * by a background thread, and the bytes written since the latest measurement are subtracted
+ * from it. The file system is only queried synchronously when the estimate gets close to the
+ * space that a write needs. The space preallocated for the output files, which the file system
+ * counts as used until it is released, remains available to the writes into these files.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
+#define DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
+
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Cached, asynchronously refreshed estimate of the free space of a file system.
+ *
+ * available() and record_written() are expected to be called from a single writing thread.
+ */
+class FreeSpaceTracker
+{
+public:
+  struct Usage
+  {
+    bool valid{ false };
+    uint64_t free_bytes{ 0 };  // NOLINT(build/unsigned)
+    uint64_t total_bytes{ 0 }; // NOLINT(build/unsigned)
+  };
+  using query_fun_t = std::function<Usage(const std::string&)>;
+
+  struct Config
+  {
+    // period of the background measurements. 0 measures synchronously at every call of available()
+    std::chrono::milliseconds refresh_interval{ 0 };
+    // the estimate is measured synchronously if it is below this factor times the requested space
+    double sync_margin{ 2. };
+  };
+
+  explicit FreeSpaceTracker(query_fun_t query = query_statvfs);
+  ~FreeSpaceTracker();
+
+  FreeSpaceTracker(const FreeSpaceTracker&) = delete;
+  FreeSpaceTracker& operator=(const FreeSpaceTracker&) = delete;
+
+  // Measures the free space once and starts the background measurements if configured
+  void start(const std::string& path, const Config& config);
+  void stop();
+
+  /**
+   * @brief Returns the estimated free space, making sure that it is accurate if it is close to needed_bytes
+   */
+  uint64_t available(uint64_t needed_bytes); // NOLINT(build/unsigned)
+
+  // Of the written bytes, reserved_bytes were written in preallocated space
+  void record_written(uint64_t bytes, uint64_t reserved_bytes = 0); // NOLINT(build/unsigned)
+
+  // Space preallocated for a file, and preallocated space released without being written.
+  // They can be called from another thread than the writing one
+  void reserve(uint64_t bytes); // NOLINT(build/unsigned)
+  void release(uint64_t bytes); // NOLINT(build/unsigned)
+  uint64_t reserved() const { return m_reserved.load(); } // NOLINT(build/unsigned)
+
+  // Measures the free space now
+  void refresh();
+
+  // Fraction of free space as of the latest measurement, negative if it is not known
+  float free_fraction() const { return m_free_fraction.load(); }
+
+  uint64_t sync_refreshes() const { return m_sync_refreshes.load(); }   // NOLINT(build/unsigned)
+  uint64_t async_refreshes() const { return m_async_refreshes.load(); } // NOLINT(build/unsigned)
+
+  static Usage query_statvfs(const std::string& path);
+
+private:
+  uint64_t estimate() const; // NOLINT(build/unsigned)
+  // Subtracts up to bytes from the reserved space, and returns how much was subtracted
+  uint64_t take_reserved(uint64_t bytes); // NOLINT(build/unsigned)
+  void do_refresh(std::atomic<bool>&);
+
+  query_fun_t m_query;
+  std::string m_path;
+  Config m_config;
+
+  // measurements and writes can happen concurrently
+  mutable std::mutex m_mutex;
+  uint64_t m_free_at_refresh{ 0 };                      // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_written_since_refresh{ 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_reserved{ 0 };                // NOLINT(build/unsigned)
+  std::atomic<float> m_free_fraction{ -1. };
+
+  std::atomic<uint64_t> m_sync_refreshes{ 0 };  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_async_refreshes{ 0 }; // NOLINT(build/unsigned)
+
+  dunedaq::utilities::WorkerThread m_refresh_thread;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
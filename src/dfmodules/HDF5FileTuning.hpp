@@ -0,0 +1,71 @@
+/**
+ * @file HDF5FileTuning.hpp HDF5FileTuning Class
+ *
+ * The HDF5FileTuning holds the HDF5 file access properties that affect the write performance
+ * of the HDF5DataStore: the metadata cache size, the alignment of large datasets in the file,
+ * the aggregation of metadata blocks, the core (in-memory) driver and the library version bounds.
+ * It is added to a HighFive::FileAccessProps when the files are created.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_HDF5FILETUNING_HPP_
+#define DFMODULES_SRC_DFMODULES_HDF5FILETUNING_HPP_
+
+#include "ers/Issue.hpp"
+
+#include <H5Ipublic.h>
+
+#include <cstdint>
+#include <string>
+
+namespace dunedaq {
+
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules, InvalidHDF5Tuning, "Invalid HDF5 file tuning: " << reason, ((std::string)reason))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+/**
+ * @brief The HDF5 file access properties used by the HDF5DataStore. The defaults leave
+ * those of the HDF5 library unchanged.
+ */
+struct HDF5FileTuning
+{
+  // initial and maximum size of the metadata cache, 0 for the HDF5 default
+  uint64_t metadata_cache_size{ 0 }; // NOLINT(build/unsigned)
+
+  // the objects of at least alignment_threshold bytes start at a multiple of alignment
+  uint64_t alignment{ 1 };           // NOLINT(build/unsigned)
+  uint64_t alignment_threshold{ 1 }; // NOLINT(build/unsigned)
+
+  // size of the blocks the metadata is aggregated in, 0 for the HDF5 default
+  uint64_t metadata_block_size{ 0 }; // NOLINT(build/unsigned)
+
+  // the file is built in memory, growing by core_driver_increment bytes at a time, and written
+  // to disk when it is closed
+  bool core_driver{ false };
+  uint64_t core_driver_increment{ 64 * 1024 * 1024 }; // NOLINT(build/unsigned)
+
+  // earliest, v18, v110, v112 or latest
+  std::string libver_low_bound{ "earliest" };
+
+  // Throws InvalidHDF5Tuning for values the HDF5 library would reject
+  void validate() const;
+
+  bool is_default() const;
+
+  // The properties that differ from the defaults, as "<name>=<value>" separated by commas
+  std::string describe() const;
+
+  // Sets the properties on a file access property list. Called by HighFive::FileAccessProps::add()
+  void apply(hid_t fapl) const;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_HDF5FILETUNING_HPP_
@@ -0,0 +1,98 @@
+/**
+ * @file InhibitPredictor.hpp InhibitPredictor Class
+ *
+ * The InhibitPredictor class decides whether the DFO should inhibit the trigger.
+ * On top of the reactive condition (all the dataflow applications are busy), it can
+ * assert the inhibit in advance, when the rate of incoming TriggerDecisions exceeds
+ * the rate of completions by enough to exhaust the free slots within a time horizon.
+ * A minimum dwell time between state changes limits the flapping under bursty load.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_INHIBITPREDICTOR_HPP_
+#define DFMODULES_SRC_DFMODULES_INHIBITPREDICTOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Stateful inhibit decision with rate prediction, hysteresis and dwell time.
+ *
+ * The counters of arrivals and completions can be updated from any thread,
+ * all the other methods are expected to be serialised by the caller.
+ */
+class InhibitPredictor
+{
+public:
+  using clock_t = std::chrono::steady_clock;
+
+  struct Config
+  {
+    // the inhibit is asserted if the free slots are expected to run out within this time. 0 disables the prediction
+    std::chrono::milliseconds horizon{ 0 };
+    // minimum time between two changes of state. The reactive assertion is never delayed
+    std::chrono::milliseconds min_dwell{ 0 };
+    // period over which the rates are measured, and weight of the latest measurement
+    std::chrono::milliseconds rate_interval{ 100 };
+    double smoothing{ 0.3 };
+  };
+
+  struct Statistics
+  {
+    double duty_cycle{ 0. }; // fraction of the time spent inhibited
+    uint64_t transitions{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  void configure(const Config& config) { m_config = config; }
+  void reset(clock_t::time_point now);
+
+  void record_arrivals(size_t n = 1) { m_arrivals += n; }
+  void record_completions(size_t n = 1) { m_completions += n; }
+
+  /**
+   * @param reactive_busy Whether all the applications are busy
+   * @param free_slots Number of decisions that can still be assigned before all the applications are busy
+   * @return Whether the trigger should be inhibited
+   */
+  bool evaluate(bool reactive_busy, size_t free_slots, clock_t::time_point now);
+
+  bool is_inhibited() const { return m_inhibited; }
+  double arrival_rate() const { return m_arrival_rate; }       // in Hz
+  double completion_rate() const { return m_completion_rate; } // in Hz
+
+  // Statistics since the previous call
+  Statistics collect_statistics(clock_t::time_point now);
+
+private:
+  void update_rates(clock_t::time_point now);
+  bool predicts_exhaustion(size_t free_slots) const;
+
+  Config m_config;
+
+  std::atomic<uint64_t> m_arrivals{ 0 };    // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_completions{ 0 }; // NOLINT(build/unsigned)
+  double m_arrival_rate{ 0. };
+  double m_completion_rate{ 0. };
+  clock_t::time_point m_last_rate_update;
+
+  bool m_inhibited{ false };
+  clock_t::time_point m_last_change;
+
+  // statistics
+  clock_t::time_point m_statistics_start;
+  clock_t::duration m_inhibited_time{ 0 };
+  uint64_t m_transitions{ 0 }; // NOLINT(build/unsigned)
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_INHIBITPREDICTOR_HPP_
@@ -0,0 +1,85 @@
+/**
+ * @file LatencyHistory.hpp LatencyHistory Class
+ *
+ * The LatencyHistory class keeps the most recent completion latencies of a dataflow
+ * application in a fixed-size ring buffer, together with a log-linear histogram of the
+ * same window, so that the mean and the quantiles can be queried in constant time.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_LATENCYHISTORY_HPP_
+#define DFMODULES_SRC_DFMODULES_LATENCYHISTORY_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Fixed-size, allocation-free history of completion latencies.
+ *
+ * The class is not thread-safe; callers are expected to provide their own locking.
+ */
+class LatencyHistory
+{
+public:
+  using clock_t = std::chrono::steady_clock;
+
+  static constexpr size_t s_capacity = 1000;
+
+  struct Summary
+  {
+    size_t count{ 0 };
+    std::chrono::microseconds mean{ 0 };
+    std::chrono::microseconds p50{ 0 };
+    std::chrono::microseconds p99{ 0 };
+  };
+
+  void add(clock_t::time_point when, std::chrono::microseconds latency);
+  void clear();
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  std::chrono::microseconds mean() const;
+  std::chrono::microseconds quantile(double q) const;
+  Summary summary() const;
+
+  // Average of the latencies recorded at or after the given time point.
+  // This walks the buffer and is meant for diagnostics, not for the hot path.
+  std::chrono::microseconds average_since(clock_t::time_point since) const;
+
+private:
+  // Values below 2^s_sub_bucket_bits us get one bucket each, every following
+  // power of two is split into 2^s_sub_bucket_bits linear sub-buckets (~6% resolution)
+  static constexpr unsigned s_sub_bucket_bits = 4;
+  static constexpr unsigned s_sub_buckets = 1u << s_sub_bucket_bits;
+  static constexpr unsigned s_max_exponent = 40; // ~12 days in us, larger values are clamped
+  static constexpr size_t s_n_buckets = s_sub_buckets + (s_max_exponent - s_sub_bucket_bits) * s_sub_buckets;
+
+  static size_t bucket_of(uint64_t value_us);
+  static uint64_t bucket_value(size_t bucket);
+
+  struct Entry
+  {
+    clock_t::time_point when;
+    std::chrono::microseconds latency;
+  };
+
+  std::array<Entry, s_capacity> m_entries{};
+  size_t m_next{ 0 };
+  size_t m_size{ 0 };
+  uint64_t m_sum_us{ 0 }; // NOLINT(build/unsigned)
+  std::array<uint32_t, s_n_buckets> m_buckets{}; // NOLINT(build/unsigned)
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_LATENCYHISTORY_HPP_
@@ -0,0 +1,264 @@
+/**
+ * @file RawDataFile.hpp RawDataFileWriter and RawDataFileReader Classes
+ *
+ * The raw data files hold TriggerRecords and TimeSlices in their native daqdataformats
+ * byte layout, written with large aligned writes (optionally with O_DIRECT) so that the
+ * throughput is limited by the storage only. A trailing index locates each record.
+ *
+ * Layout of a file, in blocks of kRawFileBlockSize bytes:
+ * - one block with the RawFileHeader
+ * - the records back to back: a TriggerRecord is its header followed by its fragments,
+ *   a TimeSlice likewise
+ * - zero padding up to a block boundary
+ * - the index, one RawIndexEntry per record in the order of writing
+ * - zero padding, and the RawFileTrailer at the very end of the last block
+ *
+ * While it is written, a file has a ".writing" suffix, which is removed when it is closed.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_RAWDATAFILE_HPP_
+#define DFMODULES_SRC_DFMODULES_RAWDATAFILE_HPP_
+
+#include "dfmodules/BoundedQueue.hpp"
+#include "dfmodules/WriteEngine.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules,
+                  RawDataFileProblem,
+                  "Unable to " << operation << " raw data file \"" << file_name << "\": " << reason,
+                  ((std::string)operation)((std::string)file_name)((std::string)reason))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+constexpr uint64_t kRawFileMagic = 0x31574152454e5544; // NOLINT(build/unsigned) "DUNERAW1" on disk
+constexpr uint32_t kRawFileVersion = 1;                 // NOLINT(build/unsigned)
+constexpr size_t kRawFileBlockSize = 4096;              // alignment required by O_DIRECT
+constexpr const char* kRawFileWritingSuffix = ".writing";
+
+struct RawFileHeader
+{
+  uint64_t magic{ kRawFileMagic };      // NOLINT(build/unsigned)
+  uint32_t version{ kRawFileVersion };  // NOLINT(build/unsigned)
+  uint32_t block_size{ kRawFileBlockSize }; // NOLINT(build/unsigned)
+  uint32_t run_number{ 0 };             // NOLINT(build/unsigned)
+  uint32_t file_index{ 0 };             // NOLINT(build/unsigned)
+  uint32_t stream_index{ 0 };           // NOLINT(build/unsigned)
+  uint32_t stream_count{ 1 };           // NOLINT(build/unsigned)
+  uint8_t run_was_for_test_purposes{ 0 }; // NOLINT(build/unsigned)
+  uint8_t reserved[7]{};                // NOLINT(build/unsigned)
+  char writer_identifier[64]{};
+  char operational_environment[64]{};
+  char offline_data_stream[64]{};
+};
+static_assert(sizeof(RawFileHeader) <= kRawFileBlockSize, "The header of raw data files must fit in one block");
+
+enum class RawRecordType : uint8_t // NOLINT(build/unsigned)
+{
+  kTriggerRecord = 1,
+  kTimeSlice = 2
+};
+
+struct RawIndexEntry
+{
+  uint64_t record_number{ 0 };  // trigger or time slice number. NOLINT(build/unsigned)
+  uint64_t offset{ 0 };         // NOLINT(build/unsigned)
+  uint64_t size{ 0 };           // NOLINT(build/unsigned)
+  uint16_t sequence_number{ 0 }; // NOLINT(build/unsigned)
+  RawRecordType record_type{ RawRecordType::kTriggerRecord };
+  uint8_t reserved[5]{}; // NOLINT(build/unsigned)
+};
+static_assert(sizeof(RawIndexEntry) == 32, "Unexpected size of the raw data file index entries");
+
+struct RawFileTrailer
+{
+  uint64_t index_offset{ 0 };  // NOLINT(build/unsigned)
+  uint64_t index_entries{ 0 }; // NOLINT(build/unsigned)
+  uint64_t data_bytes{ 0 };    // NOLINT(build/unsigned)
+  uint64_t magic{ kRawFileMagic }; // NOLINT(build/unsigned)
+};
+
+// Copies a string into a fixed-size, null-terminated field of the header
+template<size_t N>
+void
+set_raw_header_field(char (&field)[N], const std::string& value)
+{
+  size_t length = std::min(value.length(), N - 1);
+  value.copy(field, length);
+  field[length] = '\0';
+}
+
+/**
+ * @brief Writes one raw data file at a time, through a set of buffers: one is filled by the
+ * caller while the others are written to disk by a WriteEngine, io_depth of them at once.
+ *
+ * A record is complete once all the buffers holding a part of it have been written:
+ * get_completed_records() counts them, over the lifetime of the writer. flush() writes out
+ * the partially filled buffer, so that the latest records complete without waiting for more
+ * data; the partial block at its end is written again, with more data, by the next buffer.
+ *
+ * After a failed write, no more record of the file completes, and append() and flush() throw.
+ * close() then gives up the file, which keeps its temporary name.
+ *
+ * All the methods but get_completed_records() are expected to be called from a single thread.
+ */
+class RawDataFileWriter
+{
+public:
+  struct Config
+  {
+    size_t buffer_size{ 4 * 1024 * 1024 }; // rounded up to a multiple of the block size
+    bool direct_io{ true };                // falls back to buffered I/O if the file system does not support it
+    uint64_t preallocate_bytes{ 0 };       // NOLINT(build/unsigned)
+    std::string io_engine{ "auto" };       // see make_write_engine
+    size_t io_depth{ 4 };                  // buffers written at the same time
+  };
+
+  // a part of a record, in memory
+  using piece_t = std::pair<const void*, size_t>;
+
+  explicit RawDataFileWriter(const Config& config);
+  ~RawDataFileWriter();
+
+  RawDataFileWriter(const RawDataFileWriter&) = delete;
+  RawDataFileWriter& operator=(const RawDataFileWriter&) = delete;
+
+  void open(const std::string& file_name, const RawFileHeader& header);
+  void append(RawRecordType type,
+              uint64_t record_number,  // NOLINT(build/unsigned)
+              uint16_t sequence_number, // NOLINT(build/unsigned)
+              const std::vector<piece_t>& pieces);
+  // Starts the write of the partially filled buffer
+  void flush();
+  // Writes the index and gives the file its final name
+  void close();
+
+  bool is_open() const { return m_fd >= 0; }
+  const std::string& get_file_name() const { return m_file_name; }
+  bool using_direct_io() const { return m_using_direct_io; }
+  uint64_t get_data_bytes() const { return m_data_bytes; } // NOLINT(build/unsigned)
+  // space preallocated for the open file, 0 if the file system does not support it
+  uint64_t get_preallocated_bytes() const { return m_preallocated_bytes; } // NOLINT(build/unsigned)
+  std::string get_io_engine_type() const { return m_engine->get_type(); }
+
+  // records appended, and records whose data has been written, since the writer was created
+  uint64_t get_appended_records() const { return m_appended_records.load(); }   // NOLINT(build/unsigned)
+  uint64_t get_completed_records() const { return m_completed_records.load(); } // NOLINT(build/unsigned)
+
+  // time spent waiting for a buffer to be written, since the previous call
+  uint64_t get_buffer_wait_us() { return m_buffer_wait_us.exchange(0); } // NOLINT(build/unsigned)
+
+private:
+  struct AlignedDeleter
+  {
+    void operator()(char* p) const { std::free(p); } // NOLINT
+  };
+  using aligned_buffer_t = std::unique_ptr<char, AlignedDeleter>;
+  static aligned_buffer_t allocate_aligned(size_t size);
+
+  struct Buffer
+  {
+    aligned_buffer_t data;
+    size_t used{ 0 };
+    size_t carried{ 0 };       // bytes of a partial block copied from the previous buffer
+    uint64_t file_offset{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  // A buffer write, with the number of records that are complete once it and the previous ones are done
+  struct Submission
+  {
+    uint64_t sequence{ 0 }; // NOLINT(build/unsigned)
+    uint64_t records{ 0 };  // NOLINT(build/unsigned)
+    bool done{ false };
+    bool failed{ false };
+  };
+
+  void submit_active_buffer();
+  void complete_submission(Buffer* buffer, uint64_t sequence, int error); // NOLINT(build/unsigned)
+  void wait_for_submission(uint64_t sequence);                           // NOLINT(build/unsigned)
+  void write_at(const char* data, size_t size, uint64_t offset);         // NOLINT(build/unsigned)
+  void check_io_error();
+
+  Config m_config;
+  std::vector<Buffer> m_buffers;
+  Buffer* m_active{ nullptr };
+  BoundedQueue<Buffer*> m_free_buffers;
+
+  int m_fd{ -1 };
+  bool m_using_direct_io{ false };
+  std::string m_file_name;
+  uint64_t m_data_bytes{ 0 };         // NOLINT(build/unsigned)
+  uint64_t m_preallocated_bytes{ 0 }; // NOLINT(build/unsigned)
+  std::vector<RawIndexEntry> m_index;
+
+  // completion tracking
+  std::atomic<uint64_t> m_appended_records{ 0 };    // NOLINT(build/unsigned)
+  bool m_appending{ false };                        // a record is being copied into the buffers
+  uint64_t m_appending_end{ 0 };                    // file offset of the end of that record. NOLINT(build/unsigned)
+  uint64_t m_submission_count{ 0 };                 // NOLINT(build/unsigned)
+  uint64_t m_overlapping_submission{ 0 };           // to complete before the active buffer is written. NOLINT
+  std::atomic<uint64_t> m_completed_records{ 0 };   // NOLINT(build/unsigned)
+  std::deque<Submission> m_submissions;             // in flight, in the order of submission
+  bool m_write_failed{ false };                     // a write of the open file has failed
+  std::mutex m_completion_mutex;
+  std::condition_variable m_completion_cv;
+
+  std::mutex m_io_error_mutex;
+  std::string m_io_error;
+  std::atomic<uint64_t> m_buffer_wait_us{ 0 }; // NOLINT(build/unsigned)
+
+  // last, so that it is destroyed, with its threads, before what its completions use
+  std::unique_ptr<WriteEngine> m_engine;
+};
+
+/**
+ * @brief Reads the header, the index and the records of a closed raw data file.
+ */
+class RawDataFileReader
+{
+public:
+  explicit RawDataFileReader(const std::string& file_name);
+  ~RawDataFileReader();
+
+  RawDataFileReader(const RawDataFileReader&) = delete;
+  RawDataFileReader& operator=(const RawDataFileReader&) = delete;
+
+  const RawFileHeader& get_header() const { return m_header; }
+  const std::vector<RawIndexEntry>& get_index() const { return m_index; }
+
+  std::vector<char> read(const RawIndexEntry& entry) const;
+
+private:
+  void read_at(void* data, size_t size, uint64_t offset) const; // NOLINT(build/unsigned)
+
+  std::string m_file_name;
+  int m_fd{ -1 };
+  RawFileHeader m_header;
+  std::vector<RawIndexEntry> m_index;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_RAWDATAFILE_HPP_
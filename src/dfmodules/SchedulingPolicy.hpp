@@ -0,0 +1,138 @@
+/**
+ * @file SchedulingPolicy.hpp SchedulingPolicy Classes
+ *
+ * The SchedulingPolicy classes decide which dataflow application should receive the
+ * next TriggerDecision, based on the state stored in the TriggerRecordBuilderData objects.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_SCHEDULINGPOLICY_HPP_
+#define DFMODULES_SRC_DFMODULES_SCHEDULINGPOLICY_HPP_
+
+#include "dfmodules/TriggerRecordBuilderData.hpp"
+
+#include "dfmessages/TriggerDecision.hpp"
+#include "ers/Issue.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules,
+                  UnknownSchedulingPolicy,
+                  "Unknown scheduling policy \"" << policy << '"',
+                  ((std::string)policy))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+/**
+ * @brief Interface for the logic that selects the destination of a TriggerDecision
+ */
+class SchedulingPolicy
+{
+public:
+  using trbd_ptr_t = std::shared_ptr<TriggerRecordBuilderData>;
+  using data_structure_t = std::map<std::string, trbd_ptr_t>;
+
+  /**
+   * @brief Result of a selection. If no application could take the decision without
+   * exceeding its busy threshold, the least loaded one is returned with over_busy set.
+   * If all the applications are in error or quarantined, app is the end of the container.
+   */
+  struct Selection
+  {
+    data_structure_t::const_iterator app;
+    bool over_busy{ false };
+  };
+
+  virtual ~SchedulingPolicy() = default;
+
+  virtual std::string name() const = 0;
+
+  /**
+   * @param estimated_bytes Estimated data volume of the decision, 0 if unknown
+   */
+  virtual Selection select(const data_structure_t& apps,
+                           const dfmessages::TriggerDecision& decision,
+                           uint64_t estimated_bytes = 0) = 0; // NOLINT(build/unsigned)
+
+  // Called at the start of each run
+  virtual void reset() {}
+};
+
+/**
+ * @brief Round-robin across the available applications, skipping those busy or in error.
+ * Degraded applications are skipped unless all the others are busy.
+ * If they are all busy, the application with the lowest load is selected.
+ */
+class RoundRobinPolicy : public SchedulingPolicy
+{
+public:
+  std::string name() const override { return "round-robin"; }
+  Selection select(const data_structure_t& apps,
+                   const dfmessages::TriggerDecision& decision,
+                   uint64_t estimated_bytes = 0) override; // NOLINT(build/unsigned)
+  void reset() override { m_last_assigned.clear(); }
+
+private:
+  std::string m_last_assigned;
+};
+
+/**
+ * @brief Power-of-two-choices on the predicted finish time of the decision.
+ * Two candidates are drawn at random among the applications that are not busy,
+ * preferring those that are not degraded, and the one expected to complete the new decision first is selected.
+ * The prediction is the number of outstanding decisions (including the new one)
+ * divided by the capacity rate estimated from the measured completion latency.
+ */
+class LatencyWeightedPolicy : public SchedulingPolicy
+{
+public:
+  LatencyWeightedPolicy();
+
+  std::string name() const override { return "latency-weighted"; }
+  Selection select(const data_structure_t& apps,
+                   const dfmessages::TriggerDecision& decision,
+                   uint64_t estimated_bytes = 0) override; // NOLINT(build/unsigned)
+
+  static double predicted_finish_time(const TriggerRecordBuilderData& app); // in seconds
+
+private:
+  std::minstd_rand m_generator;
+  std::vector<data_structure_t::const_iterator> m_candidates; // reused to avoid allocations
+};
+
+/**
+ * @brief Selects the application with the lowest load after the assignment,
+ * where the load is the larger of the fractions of the busy thresholds on slots
+ * and on bytes that would be in use. Degraded applications are only selected
+ * if all the others are busy.
+ */
+class LeastLoadedPolicy : public SchedulingPolicy
+{
+public:
+  std::string name() const override { return "least-loaded"; }
+  Selection select(const data_structure_t& apps,
+                   const dfmessages::TriggerDecision& decision,
+                   uint64_t estimated_bytes = 0) override; // NOLINT(build/unsigned)
+};
+
+/**
+ * @brief Creates the scheduling policy with the given name
+ */
+std::unique_ptr<SchedulingPolicy>
+make_scheduling_policy(const std::string& name);
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_SCHEDULINGPOLICY_HPP_
@@ -14,6 +14,8 @@
 
 #include "daqdataformats/Types.hpp"
 #include "dfmessages/TriggerDecision.hpp"
+#include "dfmodules/LatencyHistory.hpp"
+#include "dfmodules/TriggerDecisionTokenBatch.hpp"
 #include "dfmodules/opmon/TRBuilderData.pb.h"
 
 #include "ers/Issue.hpp"
@@ -55,14 +57,91 @@ struct AssignedTriggerDecision
   dfmessages::TriggerDecision decision;
   std::chrono::steady_clock::time_point assigned_time;
   std::string connection_name;
+  uint64_t estimated_bytes; // NOLINT(build/unsigned)
 
-  AssignedTriggerDecision(dfmessages::TriggerDecision dec, std::string conn_name)
+  AssignedTriggerDecision(dfmessages::TriggerDecision dec,
+                          std::string conn_name,
+                          uint64_t est_bytes = 0) // NOLINT(build/unsigned)
     : decision(dec)
     , assigned_time(std::chrono::steady_clock::now())
     , connection_name(conn_name)
+    , estimated_bytes(est_bytes)
   {}
 };
 
+/**
+ * @brief Aggregate occupancy of a group of TriggerRecordBuilderData objects.
+ * The counters are updated incrementally by each TriggerRecordBuilderData
+ * that shares them, so that the aggregate state can be checked in O(1)
+ */
+struct TRBOccupancy
+{
+  std::atomic<size_t> apps{ 0 };       // number of applications sharing these counters
+  std::atomic<size_t> busy_apps{ 0 };  // applications that are busy or in error
+  std::atomic<size_t> used_slots{ 0 }; // outstanding decisions across all applications
+  std::atomic<size_t> slot_capacity{ 0 }; // sum of the busy thresholds of the applications
+  std::atomic<uint64_t> outstanding_bytes{ 0 }; // NOLINT(build/unsigned) estimated data volume of the above
+};
+
+/**
+ * @brief Limits on the health reported by a writer, beyond which the application is considered degraded.
+ * A limit set to 0 is disabled.
+ */
+struct WriterHealthLimits
+{
+  std::chrono::microseconds max_write_latency{ 0 };
+  double min_disk_free_fraction{ 0. };
+  size_t max_queue_depth{ 0 };
+  // a degraded report is trusted for this long, since a writer that is avoided sends fewer updates
+  std::chrono::milliseconds hold_time{ 1000 };
+};
+
+/**
+ * @brief Limits on the progress of an application, beyond which it is quarantined.
+ * A limit set to 0 is disabled.
+ */
+struct LivenessLimits
+{
+  // age of the oldest outstanding decision
+  std::chrono::milliseconds max_assignment_age{ 0 };
+  // time without tokens while decisions are outstanding
+  std::chrono::milliseconds max_token_silence{ 0 };
+};
+
+/**
+ * @brief Parameters of the automatic tuning of the thresholds on the number of outstanding decisions.
+ * A target delay of 0 disables the tuning.
+ */
+struct ThresholdTuning
+{
+  // time within which the outstanding decisions of an application are expected to complete
+  std::chrono::milliseconds target_delay{ 0 };
+  size_t min_busy_threshold{ 1 };
+  size_t max_busy_threshold{ std::numeric_limits<size_t>::max() };
+  // the free threshold is kept at this fraction of the busy one
+  double free_fraction{ 1. };
+};
+
+enum class QuarantineReason : uint8_t // NOLINT(build/unsigned)
+{
+  kNone = 0,
+  kStaleAssignment,
+  kTokenSilence
+};
+
+inline std::string
+to_string(QuarantineReason reason)
+{
+  switch (reason) {
+    case QuarantineReason::kStaleAssignment:
+      return "stale assignment";
+    case QuarantineReason::kTokenSilence:
+      return "token silence";
+    default:
+      return "";
+  }
+}
+
 class TriggerRecordBuilderData : public opmonlib::MonitorableObject
 {
 public:
@@ -77,40 +156,111 @@ public:
 
   ~TriggerRecordBuilderData() = default;
   
-  bool is_busy() const { return m_in_error || m_is_busy; }
-  size_t used_slots() const { return m_assigned_trigger_decisions.size(); }
+  bool is_busy() const { return m_in_error || is_quarantined() || m_is_busy; }
+  size_t used_slots() const { return m_used_slots.load(); }
 
   size_t busy_threshold() const { return m_busy_threshold.load(); }
   size_t free_threshold() const { return m_free_threshold.load(); }
 
+  // estimated data volume of the outstanding decisions
+  uint64_t outstanding_bytes() const { return m_outstanding_bytes.load(); } // NOLINT(build/unsigned)
+
+  // Thresholds on the outstanding bytes, on top of the ones on the number of slots.
+  // A busy threshold of 0 disables the check on the bytes.
+  void set_byte_thresholds(uint64_t busy_threshold, uint64_t free_threshold); // NOLINT(build/unsigned)
+  uint64_t busy_threshold_bytes() const { return m_busy_threshold_bytes.load(); } // NOLINT(build/unsigned)
+  uint64_t free_threshold_bytes() const { return m_free_threshold_bytes.load(); } // NOLINT(build/unsigned)
+
+  // Fraction of the busy threshold that would be in use with an extra decision of the given size,
+  // taking the largest between slots and bytes
+  double load(uint64_t extra_bytes = 0) const; // NOLINT(build/unsigned)
+
   std::shared_ptr<AssignedTriggerDecision> get_assignment(daqdataformats::trigger_number_t trigger_number) const;
   std::shared_ptr<AssignedTriggerDecision> extract_assignment(daqdataformats::trigger_number_t trigger_number);
-  std::shared_ptr<AssignedTriggerDecision> make_assignment(dfmessages::TriggerDecision decision);
+  std::shared_ptr<AssignedTriggerDecision> make_assignment(dfmessages::TriggerDecision decision,
+                                                           uint64_t estimated_bytes = 0); // NOLINT(build/unsigned)
   void add_assignment(std::shared_ptr<AssignedTriggerDecision> assignment);
+  // The completion time is only overridden in simulations
   std::shared_ptr<AssignedTriggerDecision> complete_assignment(
     daqdataformats::trigger_number_t trigger_number,
-    std::function<void(nlohmann::json&)> metadata_fun = nullptr);
+    std::function<void(nlohmann::json&)> metadata_fun = nullptr,
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
   std::list<std::shared_ptr<AssignedTriggerDecision>> flush();
 
   void generate_opmon_data() override;
 
   std::chrono::microseconds average_latency(std::chrono::steady_clock::time_point since) const;
+  LatencyHistory::Summary latency_summary() const;
+  // estimated rate of completed decisions that this application can sustain, in Hz. 0 if unknown
+  double capacity_rate() const;
+
+  // number of assignments since the last call
+  uint64_t reset_assigned_counter() { return m_assigned_counter.exchange(0); } // NOLINT(build/unsigned)
 
   bool is_in_error() const { return m_in_error.load(); }
-  void set_in_error(bool err) { m_in_error = err; }
+  void set_in_error(bool err);
+
+  // Health reported by the writer of this application. It does not change the busy state,
+  // but the scheduling policies avoid degraded applications when there is an alternative
+  void set_writer_health_limits(const WriterHealthLimits& limits);
+  void update_writer_health(const WriterHealth& health);
+  WriterHealth writer_health() const;
+  bool is_degraded() const
+  {
+    return std::chrono::steady_clock::now().time_since_epoch().count() < m_degraded_until.load();
+  }
+
+  // Sets the busy threshold from the completion rate measured since the previous call and the target delay
+  // (Little's law), within the configured bounds. Returns true if the thresholds have changed
+  bool tune_thresholds(const ThresholdTuning& tuning,
+                       std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  // A quarantined application is considered busy and is not selected by the scheduling policies,
+  // but its outstanding decisions stay assigned. The quarantine is lifted by the first call
+  // to update_liveness that finds the application making progress again
+  void set_liveness_limits(const LivenessLimits& limits);
+  // Returns true if the quarantine state has changed
+  bool update_liveness(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+  bool is_quarantined() const { return m_quarantine.load() != QuarantineReason::kNone; }
+  QuarantineReason quarantine_reason() const { return m_quarantine.load(); }
+
+  // The current state is added to the counters when they are attached
+  void set_occupancy_counters(std::shared_ptr<TRBOccupancy> occupancy);
 
 private:
+  // to be called with m_assigned_trigger_decisions_mutex held, after every change of the assignments
+  void update_occupancy(bool was_busy, size_t old_slots, uint64_t old_bytes); // NOLINT(build/unsigned)
+
   std::atomic<size_t> m_busy_threshold{ 0 };
   std::atomic<size_t> m_free_threshold{ std::numeric_limits<size_t>::max() };
+  std::atomic<uint64_t> m_busy_threshold_bytes{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_free_threshold_bytes{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_outstanding_bytes{ 0 };    // NOLINT(build/unsigned)
   std::atomic<bool> m_is_busy{ false };
   std::list<std::shared_ptr<AssignedTriggerDecision>> m_assigned_trigger_decisions;
   mutable std::mutex m_assigned_trigger_decisions_mutex;
+  std::atomic<size_t> m_used_slots{ 0 }; // size of the list above, readable without the lock
 
-  // TODO: Eric Flumerfelt <eflumerf@github.com> Dec-03-2021: Replace with circular buffer
-  std::list<std::pair<std::chrono::steady_clock::time_point, std::chrono::microseconds>> m_latency_info;
+  LatencyHistory m_latency_info;
   mutable std::mutex m_latency_info_mutex;
 
   std::atomic<bool> m_in_error{ true };
+  std::shared_ptr<TRBOccupancy> m_occupancy;
+
+  // threshold tuning, protected by m_assigned_trigger_decisions_mutex
+  std::atomic<uint64_t> m_completed_counter{ 0 }; // NOLINT(build/unsigned)
+  std::chrono::steady_clock::time_point m_last_tuning;
+
+  // liveness, protected by m_assigned_trigger_decisions_mutex
+  LivenessLimits m_liveness_limits;
+  std::chrono::steady_clock::time_point m_last_token_time;
+  std::chrono::steady_clock::time_point m_outstanding_since; // when the list of assignments was last empty
+  std::atomic<QuarantineReason> m_quarantine{ QuarantineReason::kNone };
+
+  WriterHealthLimits m_health_limits;
+  WriterHealth m_writer_health;
+  mutable std::mutex m_writer_health_mutex;
+  std::atomic<std::chrono::steady_clock::rep> m_degraded_until{ 0 };
 
   nlohmann::json m_metadata;
   std::string m_connection_name{ "" };
@@ -120,9 +270,7 @@ private:
   using const_time_counter_t = std::invoke_result<decltype(&metric_t::min_time_since_assignment),
 						  metric_t>::type;
   using time_counter_t = std::remove_const<const_time_counter_t>::type;
-  std::atomic<uint32_t> m_complete_counter{ 0 };
-  std::atomic<time_counter_t> m_min_complete_time{ std::numeric_limits<time_counter_t>::max() }, m_max_complete_time{ 0 };  // in us
-  double m_last_average_time{0.};
+  std::atomic<uint64_t> m_assigned_counter{ 0 }; // NOLINT(build/unsigned)
 };
 } // namespace dfmodules
 } // namespace dunedaq
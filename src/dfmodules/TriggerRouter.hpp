@@ -0,0 +1,98 @@
+/**
+ * @file TriggerRouter.hpp TriggerRouter Class
+ *
+ * The TriggerRouter class maps the trigger types of a TriggerDecision to a routing class,
+ * each of which restricts the decision to a subset of the dataflow applications.
+ * For example, long-window and calibration triggers can be sent to the applications
+ * with the fastest storage, so that they do not delay the common triggers.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_TRIGGERROUTER_HPP_
+#define DFMODULES_SRC_DFMODULES_TRIGGERROUTER_HPP_
+
+#include "dfmodules/SchedulingPolicy.hpp"
+
+#include "dfmessages/TriggerDecision.hpp"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Routing of TriggerDecisions to subsets of the dataflow applications, by trigger type.
+ *
+ * The classes are configured before the run, the subsets of applications are rebuilt
+ * with update() every time the registry of the applications changes, and can be read
+ * concurrently with it.
+ */
+class TriggerRouter
+{
+public:
+  using data_structure_t = SchedulingPolicy::data_structure_t;
+  using snapshot_t = std::shared_ptr<const data_structure_t>;
+  using trigger_type_t = decltype(dfmessages::TriggerDecision::trigger_type);
+
+  static constexpr size_t s_no_class = std::numeric_limits<size_t>::max();
+
+  TriggerRouter() { m_class_of_bit.fill(s_no_class); }
+
+  struct RoutingClass
+  {
+    std::string name;
+    trigger_type_t trigger_types{ 0 }; // mask, with the same bits as TriggerDecision::trigger_type
+    std::set<std::string> destinations;
+    // whether the decision can go to the other applications, when none of the class can take it
+    bool fallback{ true };
+  };
+
+  // The classes are in order of priority: a decision matching several of them gets the first
+  void add_class(RoutingClass routing_class);
+  void clear();
+  bool empty() const { return m_classes.empty(); }
+  size_t size() const { return m_classes.size(); }
+  const RoutingClass& get_class(size_t index) const { return m_classes[index]; }
+
+  // Returns s_no_class if none of the classes matches
+  size_t classify(trigger_type_t trigger_type) const
+  {
+    if (trigger_type == dfmessages::TypeDefaults::s_invalid_trigger_type)
+      return s_no_class;
+
+    // every set bit has its class precomputed, the one with the highest priority wins
+    size_t result = s_no_class;
+    while (trigger_type != 0) {
+      auto index = m_class_of_bit[__builtin_ctzll(trigger_type)];
+      if (index < result)
+        result = index;
+      trigger_type &= trigger_type - 1;
+    }
+    return result;
+  }
+
+  void update(const data_structure_t& apps);
+  // Applications of the class among the registered ones
+  snapshot_t applications(size_t index) const { return std::atomic_load(&m_subsets)->at(index); }
+
+private:
+  static constexpr size_t s_n_bits = 8 * sizeof(trigger_type_t);
+
+  std::vector<RoutingClass> m_classes;
+  std::array<size_t, s_n_bits> m_class_of_bit;
+  std::shared_ptr<const std::vector<snapshot_t>> m_subsets = std::make_shared<const std::vector<snapshot_t>>();
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_TRIGGERROUTER_HPP_
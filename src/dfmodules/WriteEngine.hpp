@@ -0,0 +1,105 @@
+/**
+ * @file WriteEngine.hpp WriteEngine Interface
+ *
+ * A WriteEngine performs positioned writes asynchronously, so that several writes are in
+ * flight while the caller prepares the next data. Two implementations are available:
+ * - "io_uring" hands the writes to the kernel through an io_uring submission queue,
+ *   without extra threads doing the I/O
+ * - "thread_pool" has a pool of threads calling pwrite, for the systems on which io_uring
+ *   is not available (kernels older than 5.6, or containers whose seccomp profile blocks it)
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_WRITEENGINE_HPP_
+#define DFMODULES_SRC_DFMODULES_WRITEENGINE_HPP_
+
+#include "ers/Issue.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace dunedaq {
+
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules,
+                  WriteEngineUnavailable,
+                  "The \"" << engine_type << "\" write engine is not available: " << reason,
+                  ((std::string)engine_type)((std::string)reason))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+/**
+ * @brief Interface of the asynchronous write engines. At most get_queue_depth() writes are
+ * in flight: submit() waits for one of them to complete when that limit is reached.
+ */
+class WriteEngine
+{
+public:
+  // Called with 0, or with the errno of the failed write, from a thread of the engine
+  using completion_t = std::function<void(int error)>;
+
+  explicit WriteEngine(size_t queue_depth)
+    : m_queue_depth(queue_depth > 0 ? queue_depth : 1)
+  {}
+  virtual ~WriteEngine() = default;
+
+  WriteEngine(const WriteEngine&) = delete;
+  WriteEngine& operator=(const WriteEngine&) = delete;
+
+  virtual std::string get_type() const = 0;
+
+  /**
+   * @brief Queues the write of size bytes at the given offset of the file. The data must stay
+   * valid and unchanged until the completion has been called.
+   */
+  virtual void submit(int fd,
+                      const void* data,
+                      size_t size,
+                      uint64_t offset, // NOLINT(build/unsigned)
+                      completion_t completion) = 0;
+
+  // Waits until the completions of all the submitted writes have been called
+  void drain();
+
+  size_t get_queue_depth() const { return m_queue_depth; }
+  size_t get_in_flight() const;
+
+protected:
+  // Each submitted write takes a slot, which is released after its completion has been called
+  void acquire_slot();
+  void release_slot();
+  // Returns false if no write was in flight during the timeout
+  bool wait_for_writes(std::chrono::milliseconds timeout);
+
+  // Writes the whole buffer with pwrite, returns 0 or the errno of the failure
+  static int write_fully(int fd, const char* data, size_t size, uint64_t offset); // NOLINT(build/unsigned)
+
+private:
+  size_t m_queue_depth;
+  size_t m_in_flight{ 0 };
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+};
+
+/**
+ * @brief Creates a WriteEngine of the given type: "io_uring", "thread_pool", or "auto" for
+ * io_uring where available. The io_uring types fall back to the thread pool when io_uring
+ * is not available.
+ */
+std::unique_ptr<WriteEngine>
+make_write_engine(const std::string& type, size_t queue_depth);
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_WRITEENGINE_HPP_
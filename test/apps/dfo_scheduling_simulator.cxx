@@ -0,0 +1,588 @@
+/**
+ * @file dfo_scheduling_simulator.cxx
+ *
+ * Discrete-event simulation of the scheduling and inhibit logic of the DFO.
+ * The TriggerRecordBuilderData, SchedulingPolicy and InhibitPredictor classes
+ * used by the DFOModule are driven by simulated triggers and dataflow applications,
+ * in virtual time, so that policies and thresholds can be compared without a
+ * full DAQ session.
+ *
+ * Usage: dfo_scheduling_simulator [config.json]
+ * An example configuration is in test/config/dfo_scheduling_simulation.json,
+ * a built-in one is used if no file is given.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/InhibitPredictor.hpp"
+#include "dfmodules/SchedulingPolicy.hpp"
+#include "dfmodules/TriggerRecordBuilderData.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+using sim_clock = std::chrono::steady_clock;
+using sim_duration = std::chrono::duration<double>; // in seconds
+
+struct Distribution
+{
+  std::string type{ "exponential" }; // exponential, lognormal, uniform or fixed
+  double mean_ms{ 100. };
+  double sigma{ 0.5 }; // lognormal only, of the underlying normal
+  double min_ms{ 0. }; // uniform only
+  double max_ms{ 0. }; // uniform only
+
+  double sample_ms(std::mt19937_64& generator) const
+  {
+    if (type == "fixed")
+      return mean_ms;
+    if (type == "uniform")
+      return std::uniform_real_distribution<double>(min_ms, max_ms)(generator);
+    if (type == "lognormal") {
+      // parameters chosen so that the mean of the distribution is mean_ms
+      double mu = std::log(mean_ms) - 0.5 * sigma * sigma;
+      return std::lognormal_distribution<double>(mu, sigma)(generator);
+    }
+    return std::exponential_distribution<double>(1. / mean_ms)(generator);
+  }
+};
+
+struct Failure
+{
+  double start_s{ 0. };
+  double duration_s{ 0. };
+  std::string mode{ "stall" }; // stall: tokens are withheld, send-error: decisions cannot be sent
+};
+
+struct AppConfig
+{
+  std::string name;
+  Distribution completion;
+  size_t workers{ 0 }; // decisions processed in parallel, 0 for unlimited
+  std::vector<Failure> failures;
+};
+
+struct TriggerConfig
+{
+  std::string process{ "poisson" }; // poisson, periodic or bursty
+  double rate_hz{ 100. };
+  double burst_rate_hz{ 0. }; // bursty only: rate during the bursts
+  double burst_on_s{ 0. };
+  double burst_off_s{ 0. };
+};
+
+struct SimulationConfig
+{
+  double duration_s{ 60. };
+  uint64_t seed{ 1 }; // NOLINT(build/unsigned)
+  size_t busy_threshold{ 5 };
+  size_t free_threshold{ 3 };
+  InhibitPredictor::Config inhibit;
+  TriggerConfig trigger;
+  std::vector<AppConfig> apps;
+  std::vector<std::string> policies;
+};
+
+Distribution
+parse_distribution(const nlohmann::json& j)
+{
+  Distribution d;
+  d.type = j.value("type", d.type);
+  d.mean_ms = j.value("mean_ms", d.mean_ms);
+  d.sigma = j.value("sigma", d.sigma);
+  d.min_ms = j.value("min_ms", d.min_ms);
+  d.max_ms = j.value("max_ms", d.max_ms);
+  return d;
+}
+
+SimulationConfig
+parse_config(const nlohmann::json& j)
+{
+  SimulationConfig config;
+  config.duration_s = j.value("duration_s", config.duration_s);
+  config.seed = j.value("seed", config.seed);
+  config.busy_threshold = j.value("busy_threshold", config.busy_threshold);
+  config.free_threshold = j.value("free_threshold", config.free_threshold);
+  config.inhibit.horizon = std::chrono::milliseconds(j.value("inhibit_horizon_ms", 0));
+  config.inhibit.min_dwell = std::chrono::milliseconds(j.value("inhibit_min_dwell_ms", 0));
+
+  if (j.contains("trigger")) {
+    const auto& t = j["trigger"];
+    config.trigger.process = t.value("process", config.trigger.process);
+    config.trigger.rate_hz = t.value("rate_hz", config.trigger.rate_hz);
+    config.trigger.burst_rate_hz = t.value("burst_rate_hz", config.trigger.burst_rate_hz);
+    config.trigger.burst_on_s = t.value("burst_on_s", config.trigger.burst_on_s);
+    config.trigger.burst_off_s = t.value("burst_off_s", config.trigger.burst_off_s);
+  }
+
+  for (const auto& a : j.value("apps", nlohmann::json::array())) {
+    size_t copies = a.value("count", 1);
+    for (size_t i = 0; i < copies; ++i) {
+      AppConfig app;
+      app.name = a.value("name", std::string("app")) + (copies > 1 ? "_" + std::to_string(i) : "");
+      if (a.contains("completion"))
+        app.completion = parse_distribution(a["completion"]);
+      app.workers = a.value("workers", app.workers);
+      for (const auto& f : a.value("failures", nlohmann::json::array())) {
+        Failure failure;
+        failure.start_s = f.value("start_s", failure.start_s);
+        failure.duration_s = f.value("duration_s", failure.duration_s);
+        failure.mode = f.value("mode", failure.mode);
+        app.failures.push_back(failure);
+      }
+      config.apps.push_back(app);
+    }
+  }
+
+  config.policies = j.value("policies", std::vector<std::string>{ "round-robin", "latency-weighted", "least-loaded" });
+  return config;
+}
+
+// Four applications, one of them slower and one stalling for a while
+const char* s_default_config = R"({
+  "duration_s": 120,
+  "busy_threshold": 5,
+  "free_threshold": 3,
+  "trigger": { "process": "bursty", "rate_hz": 40, "burst_rate_hz": 120, "burst_on_s": 2, "burst_off_s": 8 },
+  "apps": [
+    { "name": "fast", "count": 2, "completion": { "type": "lognormal", "mean_ms": 60, "sigma": 0.4 }, "workers": 4 },
+    { "name": "slow", "completion": { "type": "lognormal", "mean_ms": 150, "sigma": 0.6 }, "workers": 4 },
+    { "name": "flaky", "completion": { "type": "exponential", "mean_ms": 60 }, "workers": 4,
+      "failures": [ { "start_s": 30, "duration_s": 10, "mode": "stall" },
+                    { "start_s": 80, "duration_s": 5, "mode": "send-error" } ] }
+  ]
+})";
+
+struct Results
+{
+  std::string policy;
+  uint64_t triggers{ 0 };   // NOLINT(build/unsigned) generated while not inhibited
+  uint64_t suppressed{ 0 }; // NOLINT(build/unsigned) lost to the inhibit
+  uint64_t completed{ 0 };  // NOLINT(build/unsigned)
+  double throughput_hz{ 0. };
+  double inhibit_fraction{ 0. };
+  uint64_t inhibit_transitions{ 0 }; // NOLINT(build/unsigned)
+  double p50_ms{ 0. };
+  double p90_ms{ 0. };
+  double p99_ms{ 0. };
+  std::map<std::string, uint64_t> assigned; // NOLINT(build/unsigned)
+};
+
+class Simulation
+{
+public:
+  Simulation(const SimulationConfig& config, const std::string& policy)
+    : m_config(config)
+    , m_policy(make_scheduling_policy(policy))
+    , m_occupancy(std::make_shared<TRBOccupancy>())
+    , m_generator(config.seed)
+  {
+    for (const auto& app_config : m_config.apps) {
+      AppState state;
+      state.config = &app_config;
+      state.trbd = std::make_shared<TriggerRecordBuilderData>(
+        app_config.name, m_config.busy_threshold, m_config.free_threshold);
+      state.trbd->set_occupancy_counters(m_occupancy);
+      m_app_index[app_config.name] = m_apps.size();
+      m_registry[app_config.name] = state.trbd;
+      m_apps.push_back(std::move(state));
+    }
+    m_predictor.configure(m_config.inhibit);
+  }
+
+  Results run()
+  {
+    m_start = sim_clock::now();
+    m_predictor.reset(m_start);
+    m_policy->reset();
+
+    schedule(m_start, EventType::kTrigger);
+    schedule(m_start + s_inhibit_check_period, EventType::kInhibitCheck);
+    for (size_t i = 0; i < m_apps.size(); ++i) {
+      for (const auto& failure : m_apps[i].config->failures) {
+        schedule(at(failure.start_s), EventType::kFailureStart, i, 0, &failure);
+        schedule(at(failure.start_s + failure.duration_s), EventType::kFailureEnd, i, 0, &failure);
+      }
+    }
+
+    auto end = at(m_config.duration_s);
+    while (!m_events.empty() && m_events.top().time <= end) {
+      auto event = m_events.top();
+      m_events.pop();
+      process(event);
+    }
+
+    return collect_results(end);
+  }
+
+private:
+  enum class EventType
+  {
+    kTrigger,
+    kCompletion,
+    kFailureStart,
+    kFailureEnd,
+    kInhibitCheck
+  };
+
+  struct Event
+  {
+    sim_clock::time_point time;
+    uint64_t sequence; // NOLINT(build/unsigned) keeps the order of simultaneous events
+    EventType type;
+    size_t app;
+    daqdataformats::trigger_number_t trigger_number;
+    const Failure* failure;
+
+    bool operator>(const Event& other) const
+    {
+      return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+  };
+
+  struct AppState
+  {
+    const AppConfig* config{ nullptr };
+    std::shared_ptr<TriggerRecordBuilderData> trbd;
+    std::deque<daqdataformats::trigger_number_t> waiting; // for a free worker
+    size_t busy_workers{ 0 };
+    bool stalled{ false };
+    bool send_error{ false };
+    std::vector<daqdataformats::trigger_number_t> withheld_tokens;
+    uint64_t assigned{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  static constexpr sim_clock::duration s_inhibit_check_period = std::chrono::milliseconds(10);
+
+  sim_clock::time_point at(double seconds) const
+  {
+    return m_start + std::chrono::duration_cast<sim_clock::duration>(sim_duration(seconds));
+  }
+
+  sim_clock::duration after_ms(double ms) const
+  {
+    return std::chrono::duration_cast<sim_clock::duration>(sim_duration(ms * 1e-3));
+  }
+
+  void schedule(sim_clock::time_point time,
+                EventType type,
+                size_t app = 0,
+                daqdataformats::trigger_number_t trigger_number = 0,
+                const Failure* failure = nullptr)
+  {
+    m_events.push(Event{ time, m_sequence++, type, app, trigger_number, failure });
+  }
+
+  double current_trigger_rate(sim_clock::time_point now) const
+  {
+    const auto& trigger = m_config.trigger;
+    if (trigger.process != "bursty" || trigger.burst_on_s + trigger.burst_off_s <= 0.)
+      return trigger.rate_hz;
+
+    double t = sim_duration(now - m_start).count();
+    double phase = std::fmod(t, trigger.burst_on_s + trigger.burst_off_s);
+    return phase < trigger.burst_on_s ? trigger.burst_rate_hz : trigger.rate_hz;
+  }
+
+  void process(const Event& event)
+  {
+    switch (event.type) {
+      case EventType::kTrigger:
+        on_trigger(event.time);
+        break;
+      case EventType::kCompletion:
+        on_completion(event.time, event.app, event.trigger_number);
+        break;
+      case EventType::kFailureStart:
+        if (event.failure->mode == "send-error")
+          m_apps[event.app].send_error = true;
+        else
+          m_apps[event.app].stalled = true;
+        break;
+      case EventType::kFailureEnd:
+        on_failure_end(event.time, event.app, *event.failure);
+        break;
+      case EventType::kInhibitCheck:
+        schedule(event.time + s_inhibit_check_period, EventType::kInhibitCheck);
+        break;
+    }
+
+    dispatch_pending(event.time);
+    evaluate_inhibit(event.time);
+  }
+
+  void on_trigger(sim_clock::time_point now)
+  {
+    double rate = current_trigger_rate(now);
+    if (rate > 0.) {
+      double interval_s =
+        m_config.trigger.process == "periodic" ? 1. / rate : std::exponential_distribution<double>(rate)(m_generator);
+      schedule(now + after_ms(1e3 * interval_s), EventType::kTrigger);
+    } else {
+      schedule(now + s_inhibit_check_period, EventType::kTrigger);
+      return;
+    }
+
+    if (m_predictor.is_inhibited()) {
+      ++m_results.suppressed;
+      return;
+    }
+
+    ++m_results.triggers;
+    m_predictor.record_arrivals();
+
+    dfmessages::TriggerDecision decision;
+    decision.trigger_number = ++m_last_trigger_number;
+    decision.run_number = 1;
+    decision.trigger_timestamp = m_last_trigger_number;
+    decision.trigger_type = 1;
+    decision.readout_type = dfmessages::ReadoutType::kLocalized;
+    m_pending.push_back(decision);
+    m_arrival_times[decision.trigger_number] = now;
+  }
+
+  void dispatch_pending(sim_clock::time_point now)
+  {
+    while (!m_pending.empty()) {
+      const auto& decision = m_pending.front();
+      auto selection = m_policy->select(m_registry, decision);
+      if (selection.app == m_registry.cend())
+        return; // all the applications are in error, retried at the next event
+
+      auto index = m_app_index[selection.app->first];
+      auto& app = m_apps[index];
+      if (app.send_error) {
+        // as in DFOModule::dispatch_decision, the application is put in error and another one is tried
+        app.trbd->set_in_error(true);
+        continue;
+      }
+
+      auto assignment = app.trbd->make_assignment(decision);
+      assignment->assigned_time = now;
+      app.trbd->add_assignment(assignment);
+      ++app.assigned;
+
+      if (app.config->workers == 0 || app.busy_workers < app.config->workers)
+        start_processing(now, index, decision.trigger_number);
+      else
+        app.waiting.push_back(decision.trigger_number);
+
+      m_pending.pop_front();
+    }
+  }
+
+  void start_processing(sim_clock::time_point now, size_t index, daqdataformats::trigger_number_t trigger_number)
+  {
+    auto& app = m_apps[index];
+    ++app.busy_workers;
+    schedule(now + after_ms(app.config->completion.sample_ms(m_generator)), EventType::kCompletion, index, trigger_number);
+  }
+
+  void on_completion(sim_clock::time_point now, size_t index, daqdataformats::trigger_number_t trigger_number)
+  {
+    auto& app = m_apps[index];
+    --app.busy_workers;
+    if (!app.waiting.empty()) {
+      start_processing(now, index, app.waiting.front());
+      app.waiting.pop_front();
+    }
+
+    if (app.stalled)
+      app.withheld_tokens.push_back(trigger_number);
+    else
+      deliver_token(now, index, trigger_number);
+  }
+
+  void on_failure_end(sim_clock::time_point now, size_t index, const Failure& failure)
+  {
+    auto& app = m_apps[index];
+    if (failure.mode == "send-error") {
+      app.send_error = false;
+      app.trbd->set_in_error(false); // the application reconnects
+      return;
+    }
+
+    app.stalled = false;
+    for (auto trigger_number : app.withheld_tokens)
+      deliver_token(now, index, trigger_number);
+    app.withheld_tokens.clear();
+  }
+
+  void deliver_token(sim_clock::time_point now, size_t index, daqdataformats::trigger_number_t trigger_number)
+  {
+    auto& app = m_apps[index];
+    app.trbd->complete_assignment(trigger_number, nullptr, now);
+    if (app.trbd->is_in_error())
+      app.trbd->set_in_error(false); // as in the DFO, a token means that the application has reconnected
+
+    m_predictor.record_completions();
+    ++m_results.completed;
+
+    auto arrival = m_arrival_times.find(trigger_number);
+    if (arrival != m_arrival_times.end()) {
+      m_latencies_ms.push_back(1e3 * sim_duration(now - arrival->second).count());
+      m_arrival_times.erase(arrival);
+    }
+  }
+
+  void evaluate_inhibit(sim_clock::time_point now)
+  {
+    size_t capacity = m_occupancy->slot_capacity.load();
+    size_t used = m_occupancy->used_slots.load();
+    bool all_busy = m_occupancy->busy_apps.load() >= m_occupancy->apps.load();
+    m_predictor.evaluate(all_busy, capacity > used ? capacity - used : 0, now);
+  }
+
+  double percentile(double q)
+  {
+    if (m_latencies_ms.empty())
+      return 0.;
+    size_t rank = std::min(m_latencies_ms.size() - 1, static_cast<size_t>(q * m_latencies_ms.size()));
+    std::nth_element(m_latencies_ms.begin(), m_latencies_ms.begin() + rank, m_latencies_ms.end());
+    return m_latencies_ms[rank];
+  }
+
+  Results collect_results(sim_clock::time_point end)
+  {
+    m_results.policy = m_policy->name();
+    m_results.throughput_hz = m_results.completed / m_config.duration_s;
+    auto stats = m_predictor.collect_statistics(end);
+    m_results.inhibit_fraction = stats.duty_cycle;
+    m_results.inhibit_transitions = stats.transitions;
+    m_results.p50_ms = percentile(0.5);
+    m_results.p90_ms = percentile(0.9);
+    m_results.p99_ms = percentile(0.99);
+    for (const auto& app : m_apps)
+      m_results.assigned[app.config->name] = app.assigned;
+    return m_results;
+  }
+
+  const SimulationConfig& m_config;
+  std::unique_ptr<SchedulingPolicy> m_policy;
+  std::shared_ptr<TRBOccupancy> m_occupancy;
+  InhibitPredictor m_predictor;
+  std::mt19937_64 m_generator;
+
+  std::vector<AppState> m_apps;
+  std::map<std::string, size_t> m_app_index;
+  SchedulingPolicy::data_structure_t m_registry;
+
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+  uint64_t m_sequence{ 0 }; // NOLINT(build/unsigned)
+  sim_clock::time_point m_start;
+
+  std::deque<dfmessages::TriggerDecision> m_pending;
+  daqdataformats::trigger_number_t m_last_trigger_number{ 0 };
+  std::unordered_map<daqdataformats::trigger_number_t, sim_clock::time_point> m_arrival_times;
+  std::vector<double> m_latencies_ms;
+
+  Results m_results;
+};
+
+void
+print_results(const std::vector<Results>& all_results)
+{
+  std::cout << std::left << std::setw(18) << "policy" << std::right << std::setw(10) << "triggers" << std::setw(12)
+            << "suppressed" << std::setw(12) << "completed" << std::setw(12) << "rate [Hz]" << std::setw(11)
+            << "inhibit %" << std::setw(8) << "flaps" << std::setw(10) << "p50 [ms]" << std::setw(10) << "p90 [ms]"
+            << std::setw(10) << "p99 [ms]" << std::endl;
+
+  for (const auto& r : all_results) {
+    std::cout << std::left << std::setw(18) << r.policy << std::right << std::setw(10) << r.triggers << std::setw(12)
+              << r.suppressed << std::setw(12) << r.completed << std::fixed << std::setprecision(1) << std::setw(12)
+              << r.throughput_hz << std::setw(11) << 100. * r.inhibit_fraction << std::setw(8)
+              << r.inhibit_transitions << std::setw(10) << r.p50_ms << std::setw(10) << r.p90_ms << std::setw(10)
+              << r.p99_ms << std::endl;
+  }
+
+  std::cout << std::endl << "Decisions assigned to each application:" << std::endl;
+  for (const auto& r : all_results) {
+    std::cout << "  " << std::left << std::setw(18) << r.policy;
+    for (const auto& [name, assigned] : r.assigned)
+      std::cout << ' ' << name << '=' << assigned;
+    std::cout << std::endl;
+  }
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  if (argc > 2 || (argc == 2 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))) {
+    std::cout << "Usage: " << argv[0] << " [config.json]" << std::endl;
+    return argc > 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  SimulationConfig config;
+  try {
+    if (argc == 2) {
+      std::ifstream input(argv[1]);
+      if (!input) {
+        std::cerr << "Unable to open " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+      }
+      config = parse_config(nlohmann::json::parse(input));
+    } else {
+      config = parse_config(nlohmann::json::parse(s_default_config));
+    }
+  } catch (const nlohmann::json::exception& excpt) {
+    std::cerr << "Invalid configuration: " << excpt.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (config.apps.empty()) {
+    std::cerr << "No application defined in the configuration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (config.free_threshold > config.busy_threshold) {
+    std::cerr << "The free threshold (" << config.free_threshold << ") can not be above the busy threshold ("
+              << config.busy_threshold << ")" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Simulating " << config.duration_s << " s with " << config.apps.size()
+            << " applications, busy/free thresholds " << config.busy_threshold << '/' << config.free_threshold
+            << ", inhibit horizon " << config.inhibit.horizon.count() << " ms, dwell "
+            << config.inhibit.min_dwell.count() << " ms" << std::endl
+            << std::endl;
+
+  std::vector<Results> all_results;
+  try {
+    for (const auto& policy : config.policies) {
+      Simulation simulation(config, policy);
+      all_results.push_back(simulation.run());
+    }
+  } catch (const ers::Issue& excpt) {
+    std::cerr << "Simulation failed: " << excpt.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  print_results(all_results);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file hdf5_tuning_benchmark.cxx
+ *
+ * Measures the effect of the HDF5 file access properties of the HDF5DataStore, and of the
+ * preallocation of the files, on the rate at which records are written. Records with the layout of the HDF5RawDataFile (a group per record,
+ * a dataset for the header and one for each fragment) are written for a fixed time with each
+ * HDF5FileTuning, for a workload of small trigger records and one of large trigger records.
+ * The files are rotated at a maximum size like those of the HDF5DataStore, and the time spent
+ * opening and closing them is included. Each file is synced to disk once it is closed, so that
+ * the rates are sustained ones rather than those of the page cache.
+ *
+ * Usage: hdf5_tuning_benchmark [output directory] [seconds per case]
+ * The files are written in the temporary directory if none is given, and removed once closed.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FilePreallocation.hpp"
+#include "dfmodules/HDF5FileTuning.hpp"
+
+#include "highfive/H5File.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+struct Workload
+{
+  std::string name;
+  size_t fragments;
+  size_t fragment_size;
+  size_t max_file_size;
+};
+
+struct Case
+{
+  std::string name;
+  HDF5FileTuning tuning;
+  bool preallocate{ false }; // up to the maximum file size, released when the file is closed
+};
+
+struct Result
+{
+  size_t records{ 0 };
+  size_t bytes{ 0 };
+  size_t files{ 0 };
+  double seconds{ 0. };
+};
+
+constexpr size_t kHeaderSize = 128; // about the size of a TriggerRecordHeader with a few components
+
+std::vector<Case>
+make_cases()
+{
+  std::vector<Case> cases;
+  cases.push_back({ "default", {} });
+
+  HDF5FileTuning tuning;
+  tuning.metadata_cache_size = 16 * 1024 * 1024;
+  cases.push_back({ "metadata cache 16 MiB", tuning });
+
+  tuning = {};
+  tuning.alignment = 4096;
+  tuning.alignment_threshold = 64 * 1024;
+  cases.push_back({ "align 4 KiB >= 64 KiB", tuning });
+
+  tuning = {};
+  tuning.alignment = 1024 * 1024;
+  tuning.alignment_threshold = 1024 * 1024;
+  cases.push_back({ "align 1 MiB >= 1 MiB", tuning });
+
+  tuning = {};
+  tuning.metadata_block_size = 1024 * 1024;
+  cases.push_back({ "metadata block 1 MiB", tuning });
+
+  tuning = {};
+  tuning.libver_low_bound = "latest";
+  cases.push_back({ "libver latest", tuning });
+
+  tuning = {};
+  tuning.core_driver = true;
+  cases.push_back({ "core driver", tuning });
+
+  tuning = {};
+  tuning.metadata_cache_size = 16 * 1024 * 1024;
+  tuning.alignment = 4096;
+  tuning.alignment_threshold = 64 * 1024;
+  tuning.metadata_block_size = 1024 * 1024;
+  tuning.libver_low_bound = "latest";
+  cases.push_back({ "combined", tuning });
+
+  cases.push_back({ "preallocated", {}, true });
+  cases.push_back({ "combined, preallocated", tuning, true });
+  return cases;
+}
+
+void
+write_record(HighFive::File& file, size_t number, const Workload& workload, const std::vector<char>& data)
+{
+  char name[64];
+  std::snprintf(name, sizeof(name), "TriggerRecord%06zu.0000", number);
+  auto record_group = file.createGroup(name);
+  auto header = record_group.createDataSet<char>("TriggerRecordHeader", HighFive::DataSpace(kHeaderSize));
+  header.write_raw(data.data());
+
+  auto raw_data_group = record_group.createGroup("RawData");
+  for (size_t i = 0; i < workload.fragments; ++i) {
+    std::snprintf(name, sizeof(name), "Detector_Readout_0x%08zx_WIBEth", i);
+    auto fragment = raw_data_group.createDataSet<char>(name, HighFive::DataSpace(workload.fragment_size));
+    fragment.write_raw(data.data() + i * workload.fragment_size);
+  }
+}
+
+Result
+run(const Case& test_case, const Workload& workload, const std::filesystem::path& directory, double seconds)
+{
+  std::vector<char> data(std::max(kHeaderSize, workload.fragments * workload.fragment_size));
+  std::iota(data.begin(), data.end(), 0);
+  const size_t record_size = kHeaderSize + workload.fragments * workload.fragment_size;
+  auto file_name = directory / "hdf5_tuning_benchmark.hdf5";
+
+  Result result;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    {
+      HighFive::FileAccessProps file_access_props;
+      file_access_props.add(test_case.tuning);
+      HighFive::File file(file_name.string(), HighFive::File::Create | HighFive::File::Truncate, file_access_props);
+      ++result.files;
+      if (test_case.preallocate && !preallocate_file_space(file_name.string(), workload.max_file_size)) {
+        throw std::runtime_error("the file system does not support preallocation");
+      }
+      for (size_t file_bytes = 0;
+           file_bytes + record_size <= workload.max_file_size && std::chrono::steady_clock::now() < deadline;
+           file_bytes += record_size) {
+        write_record(file, result.records++, workload, data);
+        result.bytes += record_size;
+      }
+    }
+    if (test_case.preallocate && !release_file_space(file_name.string())) {
+      throw std::runtime_error("unable to release the preallocated space");
+    }
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      ::fsync(fd);
+      ::close(fd);
+    }
+    std::filesystem::remove(file_name);
+  }
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  if (argc > 3 || (argc >= 2 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))) {
+    std::cout << "Usage: " << argv[0] << " [output directory] [seconds per case]" << std::endl;
+    return argc > 3 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  std::filesystem::path directory = argc >= 2 ? std::filesystem::path(argv[1]) : std::filesystem::temp_directory_path();
+  double seconds = argc == 3 ? std::atof(argv[2]) : 5.;
+  if (!std::filesystem::is_directory(directory) || seconds <= 0.) {
+    std::cerr << "Invalid output directory or duration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::vector<Workload> workloads{ { "small TR (20 x 1 KiB)", 20, 1024, 256 * 1024 * 1024 },
+                                         { "large TR (10 x 4 MiB)", 10, 4 * 1024 * 1024, 1024 * 1024 * 1024 } };
+  auto cases = make_cases();
+
+  try {
+    for (const auto& workload : workloads) {
+      std::cout << workload.name << ", files of up to " << workload.max_file_size / (1024 * 1024) << " MiB, "
+                << seconds << " s per case" << std::endl;
+      std::cout << std::left << std::setw(24) << "tuning" << std::right << std::setw(12) << "records/s"
+                << std::setw(10) << "MB/s" << std::setw(8) << "files" << std::setw(12) << "vs default" << std::endl;
+      // a first pass, not reported, so that the default case does not pay for warming up the file system
+      run(cases.front(), workload, directory, seconds);
+      double default_rate = 0.;
+      for (const auto& test_case : cases) {
+        auto result = run(test_case, workload, directory, seconds);
+        double rate = result.records / result.seconds;
+        if (default_rate == 0.)
+          default_rate = rate;
+        std::cout << std::left << std::setw(24) << test_case.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << rate << std::setw(10)
+                  << result.bytes / result.seconds / 1e6 << std::setw(8) << result.files << std::setw(11)
+                  << std::setprecision(2) << rate / default_rate << 'x' << std::defaultfloat << std::endl;
+      }
+      std::cout << std::endl;
+    }
+  } catch (const std::exception& excpt) {
+    std::cerr << "Benchmark failed: " << excpt.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
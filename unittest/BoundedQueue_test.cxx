@@ -0,0 +1,78 @@
+/**
+ * @file BoundedQueue_test.cxx Test application that tests and demonstrates
+ * the functionality of the BoundedQueue class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/BoundedQueue.hpp"
+
+#define BOOST_TEST_MODULE BoundedQueue_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(BoundedQueue_test)
+
+BOOST_AUTO_TEST_CASE(Capacity)
+{
+  BoundedQueue<std::unique_ptr<int>> queue(2);
+  BOOST_REQUIRE_EQUAL(queue.capacity(), 2);
+  BOOST_REQUIRE(queue.empty());
+
+  BOOST_REQUIRE(queue.push(std::make_unique<int>(1), 1ms));
+  BOOST_REQUIRE(queue.push(std::make_unique<int>(2), 1ms));
+  BOOST_REQUIRE_EQUAL(queue.size(), 2);
+
+  // a rejected item is not consumed
+  auto extra = std::make_unique<int>(3);
+  BOOST_REQUIRE(!queue.push(std::move(extra), 1ms));
+  BOOST_REQUIRE(extra != nullptr);
+
+  std::unique_ptr<int> item;
+  BOOST_REQUIRE(queue.pop(item, 1ms));
+  BOOST_REQUIRE_EQUAL(*item, 1);
+  BOOST_REQUIRE(queue.push(std::move(extra), 1ms));
+  BOOST_REQUIRE(queue.pop(item, 1ms));
+  BOOST_REQUIRE_EQUAL(*item, 2);
+  BOOST_REQUIRE(queue.pop(item, 1ms));
+  BOOST_REQUIRE_EQUAL(*item, 3);
+  BOOST_REQUIRE(!queue.pop(item, 1ms));
+
+  // a capacity of 0 is not usable
+  queue.set_capacity(0);
+  BOOST_REQUIRE_EQUAL(queue.capacity(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(Backpressure)
+{
+  BoundedQueue<int> queue(1);
+  BOOST_REQUIRE(queue.push(1, 1ms));
+
+  // the producer is released as soon as the consumer makes room
+  std::thread consumer([&]() {
+    std::this_thread::sleep_for(20ms);
+    int item = 0;
+    queue.pop(item, 1ms);
+  });
+  BOOST_REQUIRE(queue.push(2, 1s));
+  consumer.join();
+
+  int item = 0;
+  BOOST_REQUIRE(queue.pop(item, 1ms));
+  BOOST_REQUIRE_EQUAL(item, 2);
+
+  queue.push(3, 1ms);
+  queue.clear();
+  BOOST_REQUIRE(queue.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,69 @@
+/**
+ * @file FileNameTemplate_test.cxx Test application that tests and demonstrates
+ * the functionality of the FileNameTemplate class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FileNameTemplate.hpp"
+
+#define BOOST_TEST_MODULE FileNameTemplate_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <string>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+FileNameTemplate::Params
+make_params(const std::string& extension)
+{
+  FileNameTemplate::Params params;
+  params.directory_path = "/data";
+  params.operational_environment = "test";
+  params.file_type_prefix = "raw";
+  params.run_number_prefix = "run";
+  params.digits_for_run_number = 6;
+  params.file_index_prefix = "";
+  params.digits_for_file_index = 4;
+  params.writer_identifier = "dw-01";
+  params.extension = extension;
+  return params;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FileNameTemplate_test)
+
+BOOST_AUTO_TEST_CASE(Names)
+{
+  FileNameTemplate name_template(make_params(".hdf5"));
+  BOOST_REQUIRE_EQUAL(name_template.get_file_name(53, 0), "/data/test_raw_run000053_0000_dw-01.hdf5");
+  BOOST_REQUIRE_EQUAL(name_template.get_file_name(53, 12), "/data/test_raw_run000053_0012_dw-01.hdf5");
+  BOOST_REQUIRE_EQUAL(name_template.get_file_name(1234567, 3), "/data/test_raw_run1234567_0003_dw-01.hdf5");
+
+  auto params = make_params(".raw");
+  params.directory_path = "";
+  BOOST_REQUIRE_EQUAL(FileNameTemplate(params).get_file_name(1, 1), "test_raw_run000001_0001_dw-01.raw");
+}
+
+BOOST_AUTO_TEST_CASE(RunNumber)
+{
+  FileNameTemplate name_template(make_params(".hdf5"));
+  name_template.set_run_number(53);
+  const auto& const_template = name_template;
+  BOOST_REQUIRE_EQUAL(const_template.get_file_name(53, 1), "/data/test_raw_run000053_0001_dw-01.hdf5");
+  // the names of the other runs do not change the run that is set
+  BOOST_REQUIRE_EQUAL(const_template.get_file_name(54, 1), "/data/test_raw_run000054_0001_dw-01.hdf5");
+  BOOST_REQUIRE_EQUAL(const_template.get_file_name(53, 2), "/data/test_raw_run000053_0002_dw-01.hdf5");
+}
+
+BOOST_AUTO_TEST_CASE(UniqueSuffix)
+{
+  FileNameTemplate name_template(make_params(".raw"));
+  BOOST_REQUIRE_EQUAL(name_template.make_unique("/data/a.raw", 0), "/data/a_19700101T000000.raw");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,73 @@
+/**
+ * @file FilePreallocation_test.cxx Test application that tests and demonstrates
+ * the file space preallocation functions.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FilePreallocation.hpp"
+
+#define BOOST_TEST_MODULE FilePreallocation_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+size_t
+allocated_bytes(const std::string& file_name)
+{
+  struct stat file_status;
+  BOOST_REQUIRE_EQUAL(stat(file_name.c_str(), &file_status), 0);
+  return static_cast<size_t>(file_status.st_blocks) * 512;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FilePreallocation_test)
+
+BOOST_AUTO_TEST_CASE(PreallocateAndRelease)
+{
+  std::string file_name = (std::filesystem::temp_directory_path() / "filepreallocation_test.dat").string();
+  std::ofstream(file_name) << std::string(1000, 'x');
+
+  const size_t bytes = 16 * 1024 * 1024;
+  if (!preallocate_file_space(file_name, bytes)) {
+    BOOST_TEST_MESSAGE("The file system of " << file_name << " does not support preallocation");
+    std::filesystem::remove(file_name);
+    return;
+  }
+  // the space is reserved, and the size is unchanged
+  BOOST_REQUIRE_GE(allocated_bytes(file_name), bytes);
+  BOOST_REQUIRE_EQUAL(std::filesystem::file_size(file_name), 1000);
+
+  std::ofstream(file_name, std::ios::app) << std::string(5000, 'y');
+  size_t allocated = allocated_file_space(file_name);
+  BOOST_REQUIRE_EQUAL(allocated, allocated_bytes(file_name));
+  uint64_t released = 0; // NOLINT(build/unsigned)
+  BOOST_REQUIRE(release_file_space(file_name, &released));
+  BOOST_REQUIRE_EQUAL(std::filesystem::file_size(file_name), 6000);
+  BOOST_REQUIRE_LT(allocated_bytes(file_name), 1024 * 1024);
+  BOOST_REQUIRE_EQUAL(released, allocated - allocated_bytes(file_name));
+
+  std::filesystem::remove(file_name);
+  BOOST_REQUIRE(!preallocate_file_space(file_name, bytes));
+  BOOST_REQUIRE(!release_file_space(file_name));
+  BOOST_REQUIRE_EQUAL(allocated_file_space(file_name), 0);
+}
+
+BOOST_AUTO_TEST_CASE(PreallocatedPart)
+{
+  BOOST_REQUIRE_EQUAL(preallocated_part(0, 100, 1000), 100);
+  BOOST_REQUIRE_EQUAL(preallocated_part(950, 100, 1000), 50);
+  BOOST_REQUIRE_EQUAL(preallocated_part(1000, 100, 1000), 0);
+  BOOST_REQUIRE_EQUAL(preallocated_part(0, 100, 0), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
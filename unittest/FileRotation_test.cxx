@@ -0,0 +1,167 @@
+/**
+ * @file FileRotation_test.cxx Test application that tests and demonstrates
+ * the functionality of the FileRotation class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FileRotation.hpp"
+
+#define BOOST_TEST_MODULE FileRotation_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+struct TestFile
+{
+  FileKey key;
+  std::thread::id opened_by;
+};
+
+// Records what the FileRotation opens and closes
+struct Recorder
+{
+  std::chrono::milliseconds open_time{ 0 };
+  bool fail{ false };
+  std::atomic<size_t> open_calls{ 0 };
+
+  std::mutex mutex;
+  std::vector<size_t> opened;
+  std::vector<size_t> closed;
+  std::vector<size_t> discarded;
+  std::thread::id closed_by;
+
+  FileRotation<TestFile>::open_fun_t open_fun()
+  {
+    return [this](const FileKey& key) {
+      ++open_calls;
+      std::this_thread::sleep_for(open_time);
+      if (fail)
+        throw std::runtime_error("unable to open the file");
+      std::lock_guard<std::mutex> lk(mutex);
+      opened.push_back(key.file_index);
+      return std::make_unique<TestFile>(TestFile{ key, std::this_thread::get_id() });
+    };
+  }
+
+  FileRotation<TestFile>::close_fun_t close_fun()
+  {
+    return [this](std::unique_ptr<TestFile> file, bool unused) {
+      std::lock_guard<std::mutex> lk(mutex);
+      (unused ? discarded : closed).push_back(file->key.file_index);
+      closed_by = std::this_thread::get_id();
+    };
+  }
+};
+
+FileKey
+make_key(size_t file_index)
+{
+  return FileKey{ 12, file_index, 17 };
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FileRotation_test)
+
+BOOST_AUTO_TEST_CASE(Rotation)
+{
+  Recorder recorder;
+  recorder.open_time = std::chrono::milliseconds(20);
+  FileRotation<TestFile> rotation(recorder.open_fun(), recorder.close_fun());
+
+  // the files are opened and closed by the background thread
+  std::unique_ptr<TestFile> current;
+  for (size_t index = 0; index < 5; ++index) {
+    if (current)
+      rotation.close(std::move(current));
+    current = rotation.take(make_key(index));
+    if (index == 0) {
+      BOOST_REQUIRE(current == nullptr);
+      current = std::make_unique<TestFile>(TestFile{ make_key(index), std::this_thread::get_id() });
+    } else {
+      BOOST_REQUIRE(current != nullptr);
+      BOOST_REQUIRE_EQUAL(current->key.file_index, index);
+      BOOST_REQUIRE(current->opened_by != std::this_thread::get_id());
+    }
+    rotation.prepare(make_key(index + 1));
+  }
+  rotation.close(std::move(current));
+  rotation.wait_until_idle();
+  rotation.cancel();
+  rotation.wait_until_idle();
+  BOOST_REQUIRE_EQUAL(rotation.get_pending_closes(), 0);
+
+  std::lock_guard<std::mutex> lk(recorder.mutex);
+  BOOST_REQUIRE((recorder.opened == std::vector<size_t>{ 1, 2, 3, 4, 5 }));
+  BOOST_REQUIRE((recorder.closed == std::vector<size_t>{ 0, 1, 2, 3, 4 }));
+  // the file prepared for after the last one is not used
+  BOOST_REQUIRE((recorder.discarded == std::vector<size_t>{ 5 }));
+  BOOST_REQUIRE(recorder.closed_by != std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(OtherFileNeeded)
+{
+  Recorder recorder;
+  FileRotation<TestFile> rotation(recorder.open_fun(), recorder.close_fun());
+
+  rotation.prepare(make_key(1));
+  rotation.wait_until_idle();
+  BOOST_REQUIRE(rotation.take(make_key(2)) == nullptr);
+  // nothing is prepared anymore
+  BOOST_REQUIRE(rotation.take(make_key(1)) == nullptr);
+
+  // a file still being opened when it is canceled is discarded once it is open
+  recorder.open_time = std::chrono::milliseconds(50);
+  rotation.prepare(make_key(3));
+  while (recorder.open_calls < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  rotation.cancel();
+  rotation.wait_until_idle();
+
+  std::lock_guard<std::mutex> lk(recorder.mutex);
+  BOOST_REQUIRE(recorder.closed.empty());
+  BOOST_REQUIRE_EQUAL(recorder.discarded.size(), 2);
+  BOOST_REQUIRE_EQUAL(recorder.discarded[0], 1);
+  BOOST_REQUIRE_EQUAL(recorder.discarded[1], 3);
+}
+
+BOOST_AUTO_TEST_CASE(OpenFailure)
+{
+  Recorder recorder;
+  recorder.fail = true;
+  FileRotation<TestFile> rotation(recorder.open_fun(), recorder.close_fun());
+
+  // the writer is left to open the file itself, and to report the problem
+  rotation.prepare(make_key(0));
+  BOOST_REQUIRE(rotation.take(make_key(0)) == nullptr);
+  rotation.wait_until_idle();
+  BOOST_REQUIRE(recorder.discarded.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Destruction)
+{
+  Recorder recorder;
+  {
+    FileRotation<TestFile> rotation(recorder.open_fun(), recorder.close_fun());
+    rotation.prepare(make_key(0));
+    rotation.close(std::make_unique<TestFile>(TestFile{ make_key(7), std::this_thread::get_id() }));
+  }
+  // the queued files are closed, and the prepared one is discarded
+  BOOST_REQUIRE((recorder.closed == std::vector<size_t>{ 7 }));
+  BOOST_REQUIRE_EQUAL(recorder.opened.size(), recorder.discarded.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+/**
+ * @file FragmentCompressor_test.cxx Test application that tests and demonstrates
+ * the functionality of the FragmentCompressor class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FragmentCompressor.hpp"
+
+#define BOOST_TEST_MODULE FragmentCompressor_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+using dunedaq::daqdataformats::Fragment;
+using dunedaq::daqdataformats::FragmentType;
+
+namespace {
+// ADC-like samples: a baseline with a little noise, which compresses well
+std::vector<uint16_t> // NOLINT(build/unsigned)
+make_samples(size_t count, unsigned seed)
+{
+  std::mt19937 generator(seed);
+  std::normal_distribution<double> noise(900., 3.);
+  std::vector<uint16_t> samples(count); // NOLINT(build/unsigned)
+  for (auto& sample : samples) {
+    sample = static_cast<uint16_t>(noise(generator)); // NOLINT(build/unsigned)
+  }
+  return samples;
+}
+
+std::unique_ptr<Fragment>
+make_fragment(FragmentType type, const void* payload, size_t size)
+{
+  auto fragment = std::make_unique<Fragment>(payload, size);
+  fragment->set_type(type);
+  return fragment;
+}
+
+bool
+same_bytes(const Fragment& first, const Fragment& second)
+{
+  return first.get_size() == second.get_size() &&
+         std::memcmp(first.get_storage_location(), second.get_storage_location(), first.get_size()) == 0;
+}
+
+FragmentCompressor::Config
+make_config(size_t threads)
+{
+  FragmentCompressor::Config config;
+  config.settings[FragmentType::kWIBEth] = { CompressionCodec::kZlib, 6 };
+  config.settings[FragmentType::kTriggerPrimitive] = { CompressionCodec::kZlib, 1 };
+  config.threads = threads;
+  return config;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FragmentCompressor_test)
+
+BOOST_AUTO_TEST_CASE(TriggerRecordRoundTrip)
+{
+  for (size_t threads : { 0, 3 }) {
+    FragmentCompressor compressor(make_config(threads));
+
+    dunedaq::daqdataformats::TriggerRecord record;
+    std::vector<std::vector<uint16_t>> payloads; // NOLINT(build/unsigned)
+    for (unsigned i = 0; i < 8; ++i) {
+      payloads.push_back(make_samples(20000, i));
+      record.add_fragment(make_fragment(FragmentType::kWIBEth, payloads.back().data(), 40000));
+    }
+    // a type without compression, and a payload too small to be worth it
+    record.add_fragment(make_fragment(FragmentType::kDAPHNE, payloads[0].data(), 40000));
+    record.add_fragment(make_fragment(FragmentType::kWIBEth, payloads[0].data(), 100));
+
+    auto compressed = compressor.compress(record);
+    const auto& originals = record.get_fragments_ref();
+    const auto& results = compressed->get_fragments_ref();
+    BOOST_REQUIRE_EQUAL(results.size(), originals.size());
+    for (size_t i = 0; i < 8; ++i) {
+      BOOST_REQUIRE(FragmentCompressor::is_compressed(*results[i]));
+      BOOST_REQUIRE_LT(results[i]->get_size(), originals[i]->get_size() / 2);
+      BOOST_REQUIRE(results[i]->get_fragment_type() == FragmentType::kWIBEth);
+      BOOST_REQUIRE(same_bytes(*FragmentCompressor::decompress(*results[i]), *originals[i]));
+    }
+    for (size_t i = 8; i < originals.size(); ++i) {
+      BOOST_REQUIRE(!FragmentCompressor::is_compressed(*results[i]));
+      BOOST_REQUIRE_EQUAL(results[i]->get_storage_location(), originals[i]->get_storage_location());
+      BOOST_REQUIRE(same_bytes(*FragmentCompressor::decompress(*results[i]), *originals[i]));
+    }
+
+    auto statistics = compressor.take_statistics();
+    BOOST_REQUIRE_EQUAL(statistics.compressed_fragments, 8);
+    BOOST_REQUIRE_EQUAL(statistics.incompressible_fragments, 0);
+    BOOST_REQUIRE_EQUAL(statistics.input_bytes, 8 * 40000);
+    BOOST_REQUIRE_LT(statistics.output_bytes, statistics.input_bytes / 2);
+    BOOST_REQUIRE_EQUAL(compressor.take_statistics().input_bytes, 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(IncompressibleAndTimeSlice)
+{
+  FragmentCompressor compressor(make_config(1));
+
+  std::mt19937 generator(42);
+  std::vector<uint32_t> noise(5000); // NOLINT(build/unsigned)
+  for (auto& word : noise) {
+    word = generator();
+  }
+  auto samples = make_samples(5000, 7);
+
+  dunedaq::daqdataformats::TimeSliceHeader header;
+  header.timeslice_number = 12;
+  dunedaq::daqdataformats::TimeSlice slice(header);
+  slice.add_fragment(make_fragment(FragmentType::kTriggerPrimitive, noise.data(), noise.size() * sizeof(noise[0])));
+  slice.add_fragment(make_fragment(FragmentType::kTriggerPrimitive, samples.data(), samples.size() * sizeof(samples[0])));
+
+  auto compressed = compressor.compress(slice);
+  BOOST_REQUIRE_EQUAL(compressed->get_header().timeslice_number, 12);
+  // random data is stored as it is
+  BOOST_REQUIRE(!FragmentCompressor::is_compressed(*compressed->get_fragments_ref()[0]));
+  BOOST_REQUIRE(FragmentCompressor::is_compressed(*compressed->get_fragments_ref()[1]));
+  BOOST_REQUIRE(same_bytes(*FragmentCompressor::decompress(*compressed->get_fragments_ref()[1]),
+                           *slice.get_fragments_ref()[1]));
+
+  auto statistics = compressor.take_statistics();
+  BOOST_REQUIRE_EQUAL(statistics.compressed_fragments, 1);
+  BOOST_REQUIRE_EQUAL(statistics.incompressible_fragments, 1);
+}
+
+BOOST_AUTO_TEST_CASE(Codecs)
+{
+  BOOST_REQUIRE(FragmentCompressor::codec_from_string("none") == CompressionCodec::kNone);
+  BOOST_REQUIRE(FragmentCompressor::codec_from_string("zlib") == CompressionCodec::kZlib);
+  BOOST_REQUIRE_THROW(FragmentCompressor::codec_from_string("lzma"), dunedaq::dfmodules::InvalidCompressionConfig);
+  if (FragmentCompressor::codec_available(CompressionCodec::kZstd)) {
+    BOOST_REQUIRE(FragmentCompressor::codec_from_string("zstd") == CompressionCodec::kZstd);
+  } else {
+    BOOST_REQUIRE_THROW(FragmentCompressor::codec_from_string("zstd"), dunedaq::dfmodules::InvalidCompressionConfig);
+  }
+
+  FragmentCompressor compressor(make_config(0));
+  BOOST_REQUIRE_EQUAL(compressor.describe(), "Trigger_Primitive:zlib:1,WIBEth:zlib:6");
+
+  // a corrupted payload is reported
+  auto samples = make_samples(5000, 3);
+  dunedaq::daqdataformats::TriggerRecord record;
+  record.add_fragment(make_fragment(FragmentType::kWIBEth, samples.data(), 10000));
+  auto compressed = compressor.compress(record);
+  const auto& fragment = *compressed->get_fragments_ref()[0];
+  static_cast<char*>(fragment.get_data())[sizeof(CompressedPayloadHeader) + 10] ^= 0x55;
+  BOOST_REQUIRE_THROW(FragmentCompressor::decompress(fragment), dunedaq::dfmodules::FragmentDecompressionFailed);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+/**
+ * @file FreeSpaceTracker_test.cxx Test application that tests and demonstrates
+ * the functionality of the FreeSpaceTracker class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FreeSpaceTracker.hpp"
+
+#define BOOST_TEST_MODULE FreeSpaceTracker_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+#include <string>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+namespace {
+struct FakeFileSystem
+{
+  FreeSpaceTracker::Usage usage{ true, 1000, 4000 };
+  size_t queries{ 0 };
+
+  FreeSpaceTracker::query_fun_t query()
+  {
+    return [this](const std::string&) {
+      ++queries;
+      return usage;
+    };
+  }
+};
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FreeSpaceTracker_test)
+
+BOOST_AUTO_TEST_CASE(Synchronous)
+{
+  FakeFileSystem fs;
+  FreeSpaceTracker tracker(fs.query());
+  tracker.start("/data", FreeSpaceTracker::Config());
+  BOOST_REQUIRE_EQUAL(fs.queries, 1);
+  BOOST_REQUIRE_CLOSE(tracker.free_fraction(), 0.25, 1e-4);
+
+  // without a refresh interval, every check queries the file system
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 1000);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 1000);
+  BOOST_REQUIRE_EQUAL(fs.queries, 3);
+  BOOST_REQUIRE_EQUAL(tracker.sync_refreshes(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Cached)
+{
+  FakeFileSystem fs;
+  FreeSpaceTracker tracker(fs.query());
+  FreeSpaceTracker::Config config;
+  config.refresh_interval = 1h;
+  config.sync_margin = 2.;
+  tracker.start("/data", config);
+  BOOST_REQUIRE_EQUAL(fs.queries, 1);
+
+  // the written bytes are subtracted from the latest measurement
+  BOOST_REQUIRE_EQUAL(tracker.available(100), 1000);
+  tracker.record_written(300);
+  BOOST_REQUIRE_EQUAL(tracker.available(100), 700);
+  tracker.record_written(400);
+  BOOST_REQUIRE_EQUAL(tracker.available(100), 300);
+  BOOST_REQUIRE_EQUAL(fs.queries, 1);
+
+  // close to the requested space, the file system is queried
+  fs.usage.free_bytes = 250;
+  BOOST_REQUIRE_EQUAL(tracker.available(200), 250);
+  BOOST_REQUIRE_EQUAL(fs.queries, 2);
+  BOOST_REQUIRE_EQUAL(tracker.sync_refreshes(), 1);
+
+  // the measurement includes the previous writes
+  tracker.record_written(50);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 200);
+}
+
+BOOST_AUTO_TEST_CASE(Reservations)
+{
+  FakeFileSystem fs;
+  FreeSpaceTracker tracker(fs.query());
+  FreeSpaceTracker::Config config;
+  config.refresh_interval = 1h;
+  config.sync_margin = 1.;
+  tracker.start("/data", config);
+
+  // the preallocated space stays available to the writes, before and after it is measured
+  tracker.reserve(400);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 1000);
+  fs.usage.free_bytes = 600;
+  tracker.refresh();
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 1000);
+  BOOST_REQUIRE_CLOSE(tracker.free_fraction(), 0.25, 1e-4);
+
+  // the writes into the preallocated space are only subtracted once
+  tracker.record_written(300, 300);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 700);
+  tracker.refresh();
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 700);
+  BOOST_REQUIRE_EQUAL(tracker.reserved(), 100);
+
+  // beyond the preallocated space, the writes use the free space
+  tracker.record_written(200, 200);
+  BOOST_REQUIRE_EQUAL(tracker.reserved(), 0);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 500);
+
+  // the released space counts once it is measured
+  tracker.reserve(300);
+  fs.usage.free_bytes = 200;
+  tracker.refresh();
+  tracker.release(300);
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 200);
+  fs.usage.free_bytes = 500;
+  tracker.refresh();
+  BOOST_REQUIRE_EQUAL(tracker.available(10), 500);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidPath)
+{
+  FakeFileSystem fs;
+  fs.usage.valid = false;
+  FreeSpaceTracker tracker(fs.query());
+  tracker.start("/missing", FreeSpaceTracker::Config());
+  BOOST_REQUIRE_LT(tracker.free_fraction(), 0.);
+  BOOST_REQUIRE_EQUAL(tracker.available(1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Statvfs)
+{
+  auto usage = FreeSpaceTracker::query_statvfs("/");
+  BOOST_REQUIRE(usage.valid);
+  BOOST_REQUIRE_LE(usage.free_bytes, usage.total_bytes);
+  BOOST_REQUIRE(!FreeSpaceTracker::query_statvfs("/this/path/does/not/exist").valid);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
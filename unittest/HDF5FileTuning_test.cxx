@@ -0,0 +1,112 @@
+/**
+ * @file HDF5FileTuning_test.cxx Test application that tests and demonstrates
+ * the functionality of the HDF5FileTuning class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/HDF5FileTuning.hpp"
+
+#define BOOST_TEST_MODULE HDF5FileTuning_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <hdf5.h>
+
+#include <filesystem>
+#include <string>
+
+using namespace dunedaq::dfmodules;
+
+BOOST_AUTO_TEST_SUITE(HDF5FileTuning_test)
+
+BOOST_AUTO_TEST_CASE(Properties)
+{
+  HDF5FileTuning tuning;
+  BOOST_REQUIRE(tuning.is_default());
+
+  tuning.metadata_cache_size = 8 * 1024 * 1024;
+  tuning.alignment = 4096;
+  tuning.alignment_threshold = 65536;
+  tuning.metadata_block_size = 1024 * 1024;
+  tuning.libver_low_bound = "v18";
+  BOOST_REQUIRE(!tuning.is_default());
+  BOOST_REQUIRE_EQUAL(tuning.describe(),
+                      "metadata_cache_size=8388608,alignment=4096/65536,metadata_block_size=1048576,"
+                      "libver_low_bound=v18");
+
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  tuning.apply(fapl);
+
+  H5AC_cache_config_t cache_config;
+  cache_config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+  BOOST_REQUIRE(H5Pget_mdc_config(fapl, &cache_config) >= 0);
+  BOOST_REQUIRE_EQUAL(cache_config.initial_size, tuning.metadata_cache_size);
+  BOOST_REQUIRE_EQUAL(cache_config.max_size, tuning.metadata_cache_size);
+
+  hsize_t threshold = 0;
+  hsize_t alignment = 0;
+  BOOST_REQUIRE(H5Pget_alignment(fapl, &threshold, &alignment) >= 0);
+  BOOST_REQUIRE_EQUAL(threshold, 65536);
+  BOOST_REQUIRE_EQUAL(alignment, 4096);
+
+  hsize_t block_size = 0;
+  BOOST_REQUIRE(H5Pget_meta_block_size(fapl, &block_size) >= 0);
+  BOOST_REQUIRE_EQUAL(block_size, 1024 * 1024);
+
+  H5F_libver_t low = H5F_LIBVER_EARLIEST;
+  H5F_libver_t high = H5F_LIBVER_EARLIEST;
+  BOOST_REQUIRE(H5Pget_libver_bounds(fapl, &low, &high) >= 0);
+  BOOST_REQUIRE(low == H5F_LIBVER_V18);
+  BOOST_REQUIRE(high == H5F_LIBVER_LATEST);
+  H5Pclose(fapl);
+}
+
+BOOST_AUTO_TEST_CASE(CoreDriver)
+{
+  // the file is only written to disk when it is closed
+  std::string file_name = (std::filesystem::temp_directory_path() / "hdf5filetuning_test_core.hdf5").string();
+  std::filesystem::remove(file_name);
+
+  HDF5FileTuning tuning;
+  tuning.core_driver = true;
+  tuning.core_driver_increment = 1024 * 1024;
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  tuning.apply(fapl);
+  BOOST_REQUIRE(H5Pget_driver(fapl) == H5FD_CORE);
+
+  hid_t file = H5Fcreate(file_name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  BOOST_REQUIRE(file >= 0);
+  hid_t group = H5Gcreate2(file, "TriggerRecord000001.0000", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE(group >= 0);
+  H5Gclose(group);
+  H5Fclose(file);
+  H5Pclose(fapl);
+
+  file = H5Fopen(file_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  BOOST_REQUIRE(H5Lexists(file, "TriggerRecord000001.0000", H5P_DEFAULT) > 0);
+  H5Fclose(file);
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidValues)
+{
+  HDF5FileTuning tuning;
+  tuning.alignment = 0;
+  BOOST_REQUIRE_THROW(tuning.validate(), dunedaq::dfmodules::InvalidHDF5Tuning);
+
+  tuning = {};
+  tuning.metadata_cache_size = 512;
+  BOOST_REQUIRE_THROW(tuning.validate(), dunedaq::dfmodules::InvalidHDF5Tuning);
+
+  tuning = {};
+  tuning.libver_low_bound = "v2";
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  BOOST_REQUIRE_THROW(tuning.apply(fapl), dunedaq::dfmodules::InvalidHDF5Tuning);
+  H5Pclose(fapl);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
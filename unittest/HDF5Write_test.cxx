@@ -22,6 +22,10 @@
 
 #include "boost/test/unit_test.hpp"
 
+#include <hdf5.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
@@ -29,6 +33,7 @@
 #include <memory>
 #include <regex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -360,4 +365,71 @@ BOOST_AUTO_TEST_CASE(SmallFileSizeLimitDataBlockListWrite)
   BOOST_REQUIRE_EQUAL(file_list.size(), 5);
 }
 
+BOOST_AUTO_TEST_CASE(BackgroundFileRotation)
+{
+  // the files are only opened and closed in the background with a thread-safe HDF5 library
+  hbool_t threadsafe = false;
+  if (H5is_library_threadsafe(&threadsafe) < 0 || !threadsafe) {
+    BOOST_TEST_MESSAGE("The HDF5 library is not thread-safe, the background file rotation is not tested");
+    return;
+  }
+
+  std::string file_path(std::filesystem::temp_directory_path());
+
+  const int trigger_count = 15;
+  const int apa_count = 5;
+  const int link_count = 10;
+  const int fragment_size = 10000;
+
+  // delete any pre-existing files so that we start with a clean slate
+  std::string delete_pattern = "hdf5writetest.*\\.hdf5(\\.writing)?";
+  delete_files_matching_pattern(file_path, delete_pattern);
+
+  // writes a run in files of about 6 events, and returns the names of the files
+  auto write_run = [&](bool background_file_rotation) {
+    CfgFixture cfg("test-session-5-10");
+    auto data_writer_conf = cfg.modCfg->module<dunedaq::appmodel::DataWriterModule>("dwm-01")->get_configuration();
+    auto data_store_conf = data_writer_conf->get_data_store_params();
+
+    auto data_store_conf_obj = data_store_conf->config_object();
+    data_store_conf_obj.set_by_val<std::string>("directory_path", file_path);
+    data_store_conf_obj.set_by_val<int>("max_file_size", 3000000);
+    data_store_conf_obj.set_by_val<bool>("disable_unique_filename_suffix", true);
+    data_store_conf_obj.set_by_val<bool>("background_file_rotation", background_file_rotation);
+
+    auto data_store_ptr = make_data_store(data_store_conf->get_type(), data_store_conf->UID(), cfg.modCfg, "dwm-01");
+    data_store_ptr->prepare_for_run(53, false);
+
+    // the first file of the run is created before its first record
+    std::string writing_pattern = "hdf5writetest.*\\.writing";
+    if (background_file_rotation) {
+      for (int wait = 0; wait < 1000 && get_files_matching_pattern(file_path, writing_pattern).empty(); ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      BOOST_REQUIRE_EQUAL(get_files_matching_pattern(file_path, writing_pattern).size(), 1);
+    }
+
+    for (int trigger_number = 1; trigger_number <= trigger_count; ++trigger_number)
+      data_store_ptr->write(create_trigger_record(trigger_number, fragment_size, apa_count * link_count));
+
+    // the file prepared for after the last one is removed, and the others are closed. A prepared
+    // file that was not taken by the writer would be removed as well, with the records written to it
+    data_store_ptr->finish_with_run(53);
+    BOOST_REQUIRE(get_files_matching_pattern(file_path, writing_pattern).empty());
+    data_store_ptr.reset();
+
+    std::vector<std::string> file_list = get_files_matching_pattern(file_path, "hdf5writetest.*\\.hdf5");
+    std::sort(file_list.begin(), file_list.end());
+    delete_files_matching_pattern(file_path, delete_pattern);
+    delete_files_matching_pattern(file_path, "HardwareMap.*\\.txt");
+    return file_list;
+  };
+
+  // the files have the same names whether they are opened in the background or not
+  auto file_list = write_run(false);
+  BOOST_REQUIRE_EQUAL(file_list.size(), 3);
+  auto background_file_list = write_run(true);
+  BOOST_REQUIRE(background_file_list == file_list);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+/**
+ * @file InhibitPredictor_test.cxx Test application that tests and demonstrates
+ * the functionality of the InhibitPredictor class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/InhibitPredictor.hpp"
+
+#define BOOST_TEST_MODULE InhibitPredictor_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(InhibitPredictor_test)
+
+BOOST_AUTO_TEST_CASE(Reactive)
+{
+  InhibitPredictor predictor;
+  auto t0 = InhibitPredictor::clock_t::now();
+  predictor.reset(t0);
+
+  BOOST_REQUIRE(!predictor.evaluate(false, 10, t0));
+  BOOST_REQUIRE(predictor.evaluate(true, 0, t0 + 1ms));
+  BOOST_REQUIRE(!predictor.evaluate(false, 1, t0 + 2ms));
+  BOOST_REQUIRE(predictor.evaluate(true, 0, t0 + 3ms));
+
+  auto stats = predictor.collect_statistics(t0 + 4ms);
+  BOOST_REQUIRE_EQUAL(stats.transitions, 3);
+  BOOST_REQUIRE_CLOSE(stats.duty_cycle, 0.5, 1e-6);
+
+  // the statistics restart from the collection
+  stats = predictor.collect_statistics(t0 + 8ms);
+  BOOST_REQUIRE_EQUAL(stats.transitions, 0);
+  BOOST_REQUIRE_CLOSE(stats.duty_cycle, 1., 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(DwellTime)
+{
+  InhibitPredictor predictor;
+  InhibitPredictor::Config config;
+  config.min_dwell = 10ms;
+  predictor.configure(config);
+  auto t0 = InhibitPredictor::clock_t::now();
+  predictor.reset(t0);
+
+  // the assertion due to the exhaustion of the slots is immediate
+  BOOST_REQUIRE(predictor.evaluate(true, 0, t0 + 1ms));
+  // the release waits for the dwell time
+  BOOST_REQUIRE(predictor.evaluate(false, 1, t0 + 2ms));
+  BOOST_REQUIRE(predictor.evaluate(false, 1, t0 + 10ms));
+  BOOST_REQUIRE(!predictor.evaluate(false, 1, t0 + 11ms));
+  BOOST_REQUIRE(predictor.evaluate(true, 0, t0 + 12ms));
+
+  BOOST_REQUIRE_EQUAL(predictor.collect_statistics(t0 + 12ms).transitions, 3);
+}
+
+BOOST_AUTO_TEST_CASE(Prediction)
+{
+  InhibitPredictor predictor;
+  InhibitPredictor::Config config;
+  config.horizon = 100ms;
+  config.rate_interval = 100ms;
+  config.smoothing = 1.;
+  predictor.configure(config);
+  auto t0 = InhibitPredictor::clock_t::now();
+  predictor.reset(t0);
+
+  // 1 kHz of decisions, 500 Hz of completions: 20 free slots last 40 ms
+  predictor.record_arrivals(100);
+  predictor.record_completions(50);
+  BOOST_REQUIRE(predictor.evaluate(false, 20, t0 + 100ms));
+  BOOST_REQUIRE_CLOSE(predictor.arrival_rate(), 1000., 1e-6);
+  BOOST_REQUIRE_CLOSE(predictor.completion_rate(), 500., 1e-6);
+
+  // hysteresis: 80 free slots last 160 ms, more than the horizon but less than twice
+  predictor.record_arrivals(100);
+  predictor.record_completions(50);
+  BOOST_REQUIRE(predictor.evaluate(false, 80, t0 + 200ms));
+
+  // the completions catch up
+  predictor.record_arrivals(50);
+  predictor.record_completions(100);
+  BOOST_REQUIRE(!predictor.evaluate(false, 80, t0 + 300ms));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,69 @@
+/**
+ * @file LatencyHistory_test.cxx Test application that tests and demonstrates
+ * the functionality of the LatencyHistory class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/LatencyHistory.hpp"
+
+#define BOOST_TEST_MODULE LatencyHistory_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+
+using namespace dunedaq::dfmodules;
+
+BOOST_AUTO_TEST_SUITE(LatencyHistory_test)
+
+BOOST_AUTO_TEST_CASE(Empty)
+{
+  LatencyHistory history;
+  BOOST_REQUIRE(history.empty());
+  BOOST_REQUIRE_EQUAL(history.mean().count(), 0);
+  BOOST_REQUIRE_EQUAL(history.quantile(0.99).count(), 0);
+  BOOST_REQUIRE_EQUAL(history.average_since(LatencyHistory::clock_t::now()).count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Statistics)
+{
+  LatencyHistory history;
+  auto now = LatencyHistory::clock_t::now();
+  for (int i = 1; i <= 100; ++i) {
+    history.add(now, std::chrono::microseconds(i * 1000));
+  }
+
+  BOOST_REQUIRE_EQUAL(history.size(), 100);
+  BOOST_REQUIRE_EQUAL(history.mean().count(), 50500);
+  BOOST_REQUIRE_CLOSE(static_cast<double>(history.quantile(0.5).count()), 50000., 7);
+  BOOST_REQUIRE_CLOSE(static_cast<double>(history.quantile(0.99).count()), 99000., 7);
+  BOOST_REQUIRE_EQUAL(history.average_since(now).count(), 50500);
+  BOOST_REQUIRE_EQUAL(history.average_since(now + std::chrono::seconds(1)).count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Wrapping)
+{
+  LatencyHistory history;
+  auto now = LatencyHistory::clock_t::now();
+  for (size_t i = 0; i < LatencyHistory::s_capacity; ++i) {
+    history.add(now, std::chrono::microseconds(1000000));
+  }
+  for (size_t i = 0; i < LatencyHistory::s_capacity; ++i) {
+    history.add(now + std::chrono::seconds(1), std::chrono::microseconds(10));
+  }
+
+  // the old entries must have been completely replaced
+  BOOST_REQUIRE_EQUAL(history.size(), LatencyHistory::s_capacity);
+  BOOST_REQUIRE_EQUAL(history.mean().count(), 10);
+  BOOST_REQUIRE_EQUAL(history.quantile(0.99).count(), 10);
+  BOOST_REQUIRE_EQUAL(history.average_since(now).count(), 10);
+
+  history.clear();
+  BOOST_REQUIRE(history.empty());
+  BOOST_REQUIRE_EQUAL(history.mean().count(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,220 @@
+/**
+ * @file RawDataFile_test.cxx Test application that tests and demonstrates
+ * the functionality of the RawDataFileWriter and RawDataFileReader classes.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/RawDataFile.hpp"
+
+#define BOOST_TEST_MODULE RawDataFile_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+std::vector<char>
+make_payload(size_t size, char first)
+{
+  std::vector<char> payload(size);
+  std::iota(payload.begin(), payload.end(), first);
+  return payload;
+}
+
+std::string
+test_file_name(const std::string& name)
+{
+  return (std::filesystem::temp_directory_path() / ("rawdatafile_test_" + name + ".raw")).string();
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(RawDataFile_test)
+
+BOOST_AUTO_TEST_CASE(WriteAndRead)
+{
+  std::string file_name = test_file_name("write_and_read");
+  std::filesystem::remove(file_name);
+
+  // small buffers, so that the records span several of them
+  RawDataFileWriter::Config config;
+  config.buffer_size = kRawFileBlockSize;
+  config.preallocate_bytes = 1024 * 1024;
+  RawDataFileWriter writer(config);
+
+  RawFileHeader header;
+  header.run_number = 53;
+  header.file_index = 2;
+  set_raw_header_field(header.writer_identifier, "dw-01");
+  writer.open(file_name, header);
+  BOOST_REQUIRE(writer.is_open());
+  BOOST_REQUIRE(std::filesystem::exists(file_name + kRawFileWritingSuffix));
+
+  std::vector<std::vector<char>> records;
+  for (size_t i = 0; i < 10; ++i) {
+    auto head = make_payload(64, static_cast<char>(i));
+    auto body = make_payload(1000 * i + 1, static_cast<char>(2 * i));
+    writer.append(RawRecordType::kTriggerRecord, i + 1, 0, { { head.data(), head.size() }, { body.data(), body.size() } });
+    head.insert(head.end(), body.begin(), body.end());
+    records.push_back(head);
+  }
+  writer.append(RawRecordType::kTimeSlice, 7, 1, {});
+  writer.close();
+  BOOST_REQUIRE(!writer.is_open());
+  BOOST_REQUIRE(!std::filesystem::exists(file_name + kRawFileWritingSuffix));
+
+  // the preallocated space is released, and the file is made of whole blocks
+  auto file_size = std::filesystem::file_size(file_name);
+  BOOST_REQUIRE_LT(file_size, config.preallocate_bytes);
+  BOOST_REQUIRE_EQUAL(file_size % kRawFileBlockSize, 0);
+
+  RawDataFileReader reader(file_name);
+  BOOST_REQUIRE_EQUAL(reader.get_header().run_number, 53);
+  BOOST_REQUIRE_EQUAL(reader.get_header().file_index, 2);
+  BOOST_REQUIRE_EQUAL(std::string(reader.get_header().writer_identifier), "dw-01");
+
+  const auto& index = reader.get_index();
+  BOOST_REQUIRE_EQUAL(index.size(), records.size() + 1);
+  for (size_t i = 0; i < records.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(index[i].record_number, i + 1);
+    BOOST_REQUIRE(index[i].record_type == RawRecordType::kTriggerRecord);
+    BOOST_REQUIRE(reader.read(index[i]) == records[i]);
+  }
+  BOOST_REQUIRE(index.back().record_type == RawRecordType::kTimeSlice);
+  BOOST_REQUIRE_EQUAL(index.back().sequence_number, 1);
+  BOOST_REQUIRE_EQUAL(index.back().size, 0);
+
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_CASE(FlushAndCompletion)
+{
+  for (auto engine : { "thread_pool", "io_uring" }) {
+    std::string file_name = test_file_name(std::string("flush_") + engine);
+    std::filesystem::remove(file_name);
+
+    RawDataFileWriter::Config config;
+    config.buffer_size = 4 * kRawFileBlockSize;
+    config.io_engine = engine;
+    config.io_depth = 3;
+    RawDataFileWriter writer(config);
+    writer.open(file_name, RawFileHeader());
+
+    // the records complete once their buffer is written, which a flush forces.
+    // The flushes leave partial blocks, which are written again with the next records
+    std::vector<std::vector<char>> records;
+    for (size_t i = 0; i < 20; ++i) {
+      records.push_back(make_payload(700 * i + 100, static_cast<char>(i)));
+      writer.append(RawRecordType::kTriggerRecord, i, 0, { { records.back().data(), records.back().size() } });
+      BOOST_REQUIRE_LE(writer.get_completed_records(), writer.get_appended_records());
+      if (i % 3 == 0) {
+        writer.flush();
+        for (int wait = 0; wait < 1000 && writer.get_completed_records() < writer.get_appended_records(); ++wait) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        BOOST_REQUIRE_EQUAL(writer.get_completed_records(), writer.get_appended_records());
+      }
+    }
+    writer.close();
+    BOOST_REQUIRE_EQUAL(writer.get_completed_records(), records.size());
+
+    RawDataFileReader reader(file_name);
+    BOOST_REQUIRE_EQUAL(reader.get_index().size(), records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+      BOOST_REQUIRE(reader.read(reader.get_index()[i]) == records[i]);
+    }
+    std::filesystem::remove(file_name);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(UnclosedFile)
+{
+  std::string file_name = test_file_name("unclosed");
+  std::filesystem::remove(file_name);
+
+  {
+    RawDataFileWriter writer(RawDataFileWriter::Config{});
+    writer.open(file_name, RawFileHeader());
+    auto payload = make_payload(100, 0);
+    writer.append(RawRecordType::kTriggerRecord, 1, 0, { { payload.data(), payload.size() } });
+    // the writer is destroyed with the file open: the file is closed properly
+  }
+  BOOST_REQUIRE_EQUAL(RawDataFileReader(file_name).get_index().size(), 1);
+
+  // a file without trailer is rejected
+  std::filesystem::resize_file(file_name, kRawFileBlockSize + 100);
+  BOOST_REQUIRE_THROW(RawDataFileReader{ file_name }, dunedaq::dfmodules::RawDataFileProblem);
+
+  std::filesystem::remove(file_name);
+  BOOST_REQUIRE_THROW(RawDataFileReader{ file_name }, dunedaq::dfmodules::RawDataFileProblem);
+}
+
+BOOST_AUTO_TEST_CASE(FailedWrite)
+{
+  std::string file_name = test_file_name("failed_write");
+  std::filesystem::remove(file_name);
+  std::filesystem::remove(file_name + kRawFileWritingSuffix);
+
+  // the writes beyond the file size limit of the process fail with EFBIG
+  signal(SIGXFSZ, SIG_IGN); // NOLINT(runtime/int)
+  rlimit original_limit;
+  BOOST_REQUIRE_EQUAL(getrlimit(RLIMIT_FSIZE, &original_limit), 0);
+  rlimit limit = original_limit;
+  limit.rlim_cur = 16 * kRawFileBlockSize;
+  BOOST_REQUIRE_EQUAL(setrlimit(RLIMIT_FSIZE, &limit), 0);
+
+  RawDataFileWriter::Config config;
+  config.buffer_size = 4 * kRawFileBlockSize;
+  config.io_engine = "thread_pool";
+  config.io_depth = 2;
+  RawDataFileWriter writer(config);
+  writer.open(file_name, RawFileHeader());
+
+  // the failure is reported by one of the next appends, or at the latest by the flush
+  auto payload = make_payload(3 * kRawFileBlockSize, 0);
+  bool failed = false;
+  for (size_t i = 0; i < 20 && !failed; ++i) {
+    try {
+      writer.append(RawRecordType::kTriggerRecord, i, 0, { { payload.data(), payload.size() } });
+    } catch (const dunedaq::dfmodules::RawDataFileProblem&) {
+      failed = true;
+    }
+  }
+  BOOST_REQUIRE(failed);
+  BOOST_REQUIRE_THROW(writer.flush(), dunedaq::dfmodules::RawDataFileProblem);
+  BOOST_REQUIRE_THROW(
+    writer.append(RawRecordType::kTriggerRecord, 100, 0, { { payload.data(), payload.size() } }),
+    dunedaq::dfmodules::RawDataFileProblem);
+
+  // the records that were not written do not complete, and the file keeps its temporary name
+  BOOST_REQUIRE_THROW(writer.close(), dunedaq::dfmodules::RawDataFileProblem);
+  BOOST_REQUIRE(!writer.is_open());
+  BOOST_REQUIRE_LT(writer.get_completed_records(), writer.get_appended_records());
+  BOOST_REQUIRE(!std::filesystem::exists(file_name));
+  BOOST_REQUIRE(std::filesystem::exists(file_name + kRawFileWritingSuffix));
+  std::filesystem::remove(file_name + kRawFileWritingSuffix);
+
+  // the writer can be used for the next file
+  BOOST_REQUIRE_EQUAL(setrlimit(RLIMIT_FSIZE, &original_limit), 0);
+  auto completed = writer.get_completed_records();
+  writer.open(file_name, RawFileHeader());
+  writer.append(RawRecordType::kTriggerRecord, 1, 0, { { payload.data(), payload.size() } });
+  writer.close();
+  BOOST_REQUIRE_GT(writer.get_completed_records(), completed);
+  BOOST_REQUIRE_EQUAL(RawDataFileReader(file_name).get_index().size(), 1);
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
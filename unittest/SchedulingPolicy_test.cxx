@@ -0,0 +1,202 @@
+/**
+ * @file SchedulingPolicy_test.cxx Test application that tests and demonstrates
+ * the functionality of the SchedulingPolicy classes.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/SchedulingPolicy.hpp"
+
+#define BOOST_TEST_MODULE SchedulingPolicy_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+SchedulingPolicy::data_structure_t
+make_apps(size_t n, size_t busy_threshold = 2)
+{
+  SchedulingPolicy::data_structure_t apps;
+  for (size_t i = 0; i < n; ++i) {
+    auto name = "app_" + std::to_string(i);
+    apps[name] = std::make_shared<TriggerRecordBuilderData>(name, busy_threshold);
+  }
+  return apps;
+}
+
+dunedaq::dfmessages::TriggerDecision
+make_decision(dunedaq::dfmessages::trigger_number_t trigger_number)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.trigger_number = trigger_number;
+  td.run_number = 1;
+  td.trigger_timestamp = 1;
+  td.trigger_type = 1;
+  td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
+  return td;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(SchedulingPolicy_test)
+
+BOOST_AUTO_TEST_CASE(Factory)
+{
+  BOOST_REQUIRE_EQUAL(make_scheduling_policy("round-robin")->name(), "round-robin");
+  BOOST_REQUIRE_EQUAL(make_scheduling_policy("latency-weighted")->name(), "latency-weighted");
+  BOOST_REQUIRE_EQUAL(make_scheduling_policy("least-loaded")->name(), "least-loaded");
+  BOOST_REQUIRE_EXCEPTION(make_scheduling_policy("nonsense"),
+                          UnknownSchedulingPolicy,
+                          [](UnknownSchedulingPolicy const&) { return true; });
+}
+
+BOOST_AUTO_TEST_CASE(RoundRobin)
+{
+  auto apps = make_apps(3);
+  RoundRobinPolicy policy;
+
+  auto first = policy.select(apps, make_decision(1));
+  auto second = policy.select(apps, make_decision(2));
+  auto third = policy.select(apps, make_decision(3));
+  auto fourth = policy.select(apps, make_decision(4));
+  BOOST_REQUIRE(first.app != second.app);
+  BOOST_REQUIRE(second.app != third.app);
+  BOOST_REQUIRE(first.app != third.app);
+  BOOST_REQUIRE(first.app == fourth.app);
+  BOOST_REQUIRE(!fourth.over_busy);
+
+  // applications in error are skipped
+  apps["app_1"]->set_in_error(true);
+  for (int i = 0; i < 6; ++i) {
+    BOOST_REQUIRE(policy.select(apps, make_decision(5 + i)).app->first != "app_1");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(AllBusy)
+{
+  auto apps = make_apps(2, 1);
+  apps["app_0"]->add_assignment(apps["app_0"]->make_assignment(make_decision(1)));
+  apps["app_0"]->add_assignment(apps["app_0"]->make_assignment(make_decision(2)));
+  apps["app_1"]->add_assignment(apps["app_1"]->make_assignment(make_decision(3)));
+
+  for (auto name : { "round-robin", "latency-weighted", "least-loaded" }) {
+    auto policy = make_scheduling_policy(name);
+    auto selection = policy->select(apps, make_decision(4));
+    BOOST_REQUIRE(selection.over_busy);
+    BOOST_REQUIRE_EQUAL(selection.app->first, "app_1");
+  }
+
+  apps["app_0"]->set_in_error(true);
+  apps["app_1"]->set_in_error(true);
+  RoundRobinPolicy policy;
+  BOOST_REQUIRE(policy.select(apps, make_decision(5)).app == apps.cend());
+}
+
+BOOST_AUTO_TEST_CASE(AllQuarantined)
+{
+  auto apps = make_apps(2, 10);
+  LivenessLimits limits;
+  limits.max_token_silence = std::chrono::milliseconds(100);
+  auto start = std::chrono::steady_clock::now();
+  dunedaq::dfmessages::trigger_number_t trigger_number = 0;
+  for (auto& app : apps) {
+    app.second->set_liveness_limits(limits);
+    for (int i = 0; i < 2; ++i) {
+      auto assignment = app.second->make_assignment(make_decision(++trigger_number));
+      assignment->assigned_time = start;
+      app.second->add_assignment(assignment);
+    }
+    BOOST_REQUIRE(app.second->update_liveness(start + std::chrono::milliseconds(200)));
+    BOOST_REQUIRE(app.second->is_quarantined());
+  }
+
+  // nothing can be selected until one of the applications recovers
+  for (auto name : { "round-robin", "latency-weighted", "least-loaded" }) {
+    BOOST_REQUIRE(make_scheduling_policy(name)->select(apps, make_decision(10)).app == apps.cend());
+  }
+
+  // a token alone does not lift the quarantine, the next liveness check does
+  apps["app_1"]->complete_assignment(3, nullptr, start + std::chrono::milliseconds(250));
+  BOOST_REQUIRE(apps["app_1"]->is_quarantined());
+  BOOST_REQUIRE(!apps["app_0"]->update_liveness(start + std::chrono::milliseconds(300)));
+  BOOST_REQUIRE(apps["app_1"]->update_liveness(start + std::chrono::milliseconds(300)));
+  BOOST_REQUIRE(!apps["app_1"]->is_quarantined());
+
+  for (auto name : { "round-robin", "latency-weighted", "least-loaded" }) {
+    auto selection = make_scheduling_policy(name)->select(apps, make_decision(11));
+    BOOST_REQUIRE(selection.app != apps.cend());
+    BOOST_REQUIRE_EQUAL(selection.app->first, "app_1");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(LatencyWeighted)
+{
+  auto apps = make_apps(4, 10);
+  LatencyWeightedPolicy policy;
+  apps["app_2"]->set_in_error(true);
+
+  for (int i = 0; i < 100; ++i) {
+    auto selection = policy.select(apps, make_decision(i));
+    BOOST_REQUIRE(selection.app != apps.cend());
+    BOOST_REQUIRE(!selection.over_busy);
+    BOOST_REQUIRE(selection.app->first != "app_2");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(LeastLoaded)
+{
+  auto apps = make_apps(3, 10);
+  for (auto& app : apps) {
+    app.second->set_byte_thresholds(1000000, 500000);
+  }
+  LeastLoadedPolicy policy;
+
+  // one large decision on app_0, two small ones on app_1
+  apps["app_0"]->add_assignment(apps["app_0"]->make_assignment(make_decision(1), 400000));
+  apps["app_1"]->add_assignment(apps["app_1"]->make_assignment(make_decision(2), 1000));
+  apps["app_1"]->add_assignment(apps["app_1"]->make_assignment(make_decision(3), 1000));
+
+  BOOST_REQUIRE_EQUAL(policy.select(apps, make_decision(4), 1000).app->first, "app_2");
+  apps["app_2"]->set_in_error(true);
+  BOOST_REQUIRE_EQUAL(policy.select(apps, make_decision(4), 1000).app->first, "app_1");
+}
+
+BOOST_AUTO_TEST_CASE(DegradedWriters)
+{
+  auto apps = make_apps(2, 10);
+  WriterHealthLimits limits;
+  limits.max_queue_depth = 5;
+  WriterHealth stalling;
+  stalling.queue_depth = 10;
+  for (auto& app : apps) {
+    app.second->set_writer_health_limits(limits);
+  }
+  apps["app_0"]->update_writer_health(stalling);
+
+  for (auto name : { "round-robin", "latency-weighted", "least-loaded" }) {
+    auto policy = make_scheduling_policy(name);
+    for (int i = 0; i < 10; ++i) {
+      auto selection = policy->select(apps, make_decision(i));
+      BOOST_REQUIRE_EQUAL(selection.app->first, "app_1");
+      BOOST_REQUIRE(!selection.over_busy);
+    }
+  }
+
+  // a degraded application is still used when it is the only one available
+  apps["app_1"]->set_in_error(true);
+  for (auto name : { "round-robin", "latency-weighted", "least-loaded" }) {
+    auto selection = make_scheduling_policy(name)->select(apps, make_decision(11));
+    BOOST_REQUIRE_EQUAL(selection.app->first, "app_0");
+    BOOST_REQUIRE(!selection.over_busy);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -64,6 +64,10 @@ BOOST_AUTO_TEST_CASE(Constructors)
   BOOST_REQUIRE_EQUAL(trbd2.is_busy(), false);
   BOOST_REQUIRE(!trbd2.is_in_error());
 
+  TriggerRecordBuilderData trbd3("test", 10, 5);
+  BOOST_REQUIRE_EQUAL(trbd3.busy_threshold(), 10);
+  BOOST_REQUIRE_EQUAL(trbd3.free_threshold(), 5);
+
   BOOST_REQUIRE_EXCEPTION(TriggerRecordBuilderData("test", 10, 15),
                           DFOThresholdsNotConsistent,
                           [](DFOThresholdsNotConsistent const&) { return true; });
@@ -112,6 +116,10 @@ BOOST_AUTO_TEST_CASE(Assignments)
       .count();
 
   BOOST_REQUIRE_CLOSE(static_cast<double>(trbd_p->average_latency(start_time).count()), static_cast<double>(latency), 5);
+  auto summary = trbd_p->latency_summary();
+  BOOST_REQUIRE_EQUAL(summary.count, 1);
+  BOOST_REQUIRE_CLOSE(static_cast<double>(summary.mean.count()), static_cast<double>(latency), 5);
+  BOOST_REQUIRE_CLOSE(static_cast<double>(summary.p99.count()), static_cast<double>(latency), 7);
 
   auto null_got_assignment = trbd_p->get_assignment(2);
   BOOST_REQUIRE_EQUAL(null_got_assignment, nullptr);
@@ -123,6 +131,8 @@ BOOST_AUTO_TEST_CASE(Assignments)
   auto remnants = trbd_p->flush();
   BOOST_REQUIRE_EQUAL(trbd_p->used_slots(), 0);
   BOOST_REQUIRE_EQUAL(remnants.size(), 1);
+  BOOST_REQUIRE_EQUAL(trbd_p->average_latency(start_time).count(), 0);
+  BOOST_REQUIRE_EQUAL(trbd_p->latency_summary().count, 0);
   
 }
 
@@ -183,6 +193,267 @@ BOOST_AUTO_TEST_CASE(Exceptions)
     trbd.add_assignment(err_assignment), NoSlotsAvailable, [](NoSlotsAvailable const&) { return true; });
 }
 
+BOOST_AUTO_TEST_CASE(Hysteresis)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
+
+  TriggerRecordBuilderData trbd("test", 4, 2);
+  for (size_t i = 1; i <= 4; ++i) {
+    td.trigger_number = i;
+    trbd.add_assignment(trbd.make_assignment(td));
+  }
+  BOOST_REQUIRE(trbd.is_busy());
+
+  // the application stays busy until it goes below the free threshold
+  trbd.complete_assignment(1);
+  BOOST_REQUIRE(trbd.is_busy());
+  trbd.complete_assignment(2);
+  BOOST_REQUIRE(trbd.is_busy());
+  trbd.complete_assignment(3);
+  BOOST_REQUIRE(!trbd.is_busy());
+
+  // and it only becomes busy again at the busy threshold
+  for (size_t i = 5; i <= 6; ++i) {
+    td.trigger_number = i;
+    trbd.add_assignment(trbd.make_assignment(td));
+  }
+  BOOST_REQUIRE(!trbd.is_busy());
+  td.trigger_number = 7;
+  trbd.add_assignment(trbd.make_assignment(td));
+  BOOST_REQUIRE(trbd.is_busy());
+}
+
+BOOST_AUTO_TEST_CASE(Occupancy)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
+  td.trigger_timestamp = 3;
+  td.trigger_type = 4;
+  td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
+
+  auto occupancy = std::make_shared<TRBOccupancy>();
+  TriggerRecordBuilderData trbd("test", 2, 1);
+  TriggerRecordBuilderData other_trbd("other", 2, 1);
+  trbd.set_occupancy_counters(occupancy);
+  other_trbd.set_occupancy_counters(occupancy);
+  BOOST_REQUIRE_EQUAL(occupancy->apps.load(), 2);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 0);
+
+  td.trigger_number = 1;
+  trbd.add_assignment(trbd.make_assignment(td));
+  td.trigger_number = 2;
+  trbd.add_assignment(trbd.make_assignment(td));
+  td.trigger_number = 3;
+  other_trbd.add_assignment(other_trbd.make_assignment(td));
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 1);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 3);
+
+  // in error counts as busy, and it is not counted twice
+  trbd.set_in_error(true);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 1);
+  other_trbd.set_in_error(true);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 2);
+  other_trbd.set_in_error(false);
+  trbd.set_in_error(false);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 1);
+
+  trbd.complete_assignment(1);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 2);
+  trbd.complete_assignment(2);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 1);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 0);
+
+  other_trbd.flush();
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(ByteThresholds)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
+  td.trigger_timestamp = 3;
+  td.trigger_type = 4;
+  td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
+
+  TriggerRecordBuilderData trbd("test", 10);
+  BOOST_REQUIRE_EXCEPTION(trbd.set_byte_thresholds(1000, 2000),
+                          DFOThresholdsNotConsistent,
+                          [](DFOThresholdsNotConsistent const&) { return true; });
+  trbd.set_byte_thresholds(1000, 500);
+
+  td.trigger_number = 1;
+  trbd.add_assignment(trbd.make_assignment(td, 600));
+  BOOST_REQUIRE_EQUAL(trbd.outstanding_bytes(), 600);
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE_CLOSE(trbd.load(), 0.6, 1e-6);
+  BOOST_REQUIRE_CLOSE(trbd.load(200), 0.8, 1e-6);
+
+  // one large decision makes the application busy, well before the slot threshold
+  td.trigger_number = 2;
+  trbd.add_assignment(trbd.make_assignment(td, 600));
+  BOOST_REQUIRE(trbd.is_busy());
+
+  // back to 600 bytes, still above the free threshold
+  trbd.complete_assignment(2);
+  BOOST_REQUIRE(trbd.is_busy());
+  trbd.complete_assignment(1);
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(trbd.outstanding_bytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(WriterHealthReports)
+{
+  TriggerRecordBuilderData trbd("test", 10);
+  WriterHealth health;
+  health.write_latency_us = 50000;
+  health.disk_free_fraction = 0.01;
+  health.queue_depth = 100;
+
+  // no limits, never degraded
+  trbd.update_writer_health(health);
+  BOOST_REQUIRE(!trbd.is_degraded());
+  BOOST_REQUIRE_EQUAL(trbd.writer_health().queue_depth, 100);
+
+  WriterHealthLimits limits;
+  limits.min_disk_free_fraction = 0.05;
+  limits.hold_time = std::chrono::milliseconds(50);
+  trbd.set_writer_health_limits(limits);
+  trbd.update_writer_health(health);
+  BOOST_REQUIRE(trbd.is_degraded());
+  BOOST_REQUIRE(!trbd.is_busy());
+
+  // an unknown free space does not count
+  health.disk_free_fraction = -1.;
+  trbd.update_writer_health(health);
+  BOOST_REQUIRE(!trbd.is_degraded());
+
+  // a degraded report expires
+  health.disk_free_fraction = 0.01;
+  trbd.update_writer_health(health);
+  BOOST_REQUIRE(trbd.is_degraded());
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  BOOST_REQUIRE(!trbd.is_degraded());
+}
+
+BOOST_AUTO_TEST_CASE(Liveness)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
+
+  auto occupancy = std::make_shared<TRBOccupancy>();
+  TriggerRecordBuilderData trbd("test", 10, 5);
+  trbd.set_occupancy_counters(occupancy);
+
+  LivenessLimits limits;
+  limits.max_assignment_age = std::chrono::milliseconds(1000);
+  limits.max_token_silence = std::chrono::milliseconds(300);
+  trbd.set_liveness_limits(limits);
+
+  // nothing outstanding, no progress is expected
+  auto start = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(!trbd.update_liveness(start + std::chrono::seconds(10)));
+  BOOST_REQUIRE(!trbd.is_quarantined());
+
+  td.trigger_number = 1;
+  auto assignment = trbd.make_assignment(td);
+  assignment->assigned_time = start;
+  trbd.add_assignment(assignment);
+  td.trigger_number = 2;
+  assignment = trbd.make_assignment(td);
+  assignment->assigned_time = start + std::chrono::milliseconds(200);
+  trbd.add_assignment(assignment);
+
+  BOOST_REQUIRE(!trbd.update_liveness(start + std::chrono::milliseconds(250)));
+
+  // no tokens since the work became outstanding
+  BOOST_REQUIRE(trbd.update_liveness(start + std::chrono::milliseconds(350)));
+  BOOST_REQUIRE(trbd.quarantine_reason() == QuarantineReason::kTokenSilence);
+  BOOST_REQUIRE(trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 1);
+
+  // a token lifts the silence
+  trbd.complete_assignment(2, nullptr, start + std::chrono::milliseconds(400));
+  BOOST_REQUIRE(trbd.update_liveness(start + std::chrono::milliseconds(450)));
+  BOOST_REQUIRE(!trbd.is_quarantined());
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 0);
+
+  // the first decision is still outstanding and gets too old
+  BOOST_REQUIRE(trbd.update_liveness(start + std::chrono::milliseconds(1100)));
+  BOOST_REQUIRE(trbd.quarantine_reason() == QuarantineReason::kStaleAssignment);
+  BOOST_REQUIRE(!trbd.update_liveness(start + std::chrono::milliseconds(1200)));
+
+  // flushing the assignments ends the quarantine
+  trbd.flush();
+  BOOST_REQUIRE(!trbd.is_quarantined());
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(ThresholdTuning)
+{
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
 
+  auto occupancy = std::make_shared<TRBOccupancy>();
+  TriggerRecordBuilderData trbd("test", 10, 5);
+  trbd.set_occupancy_counters(occupancy);
+  BOOST_REQUIRE_EQUAL(occupancy->slot_capacity.load(), 10);
+
+  dunedaq::dfmodules::ThresholdTuning tuning;
+  tuning.target_delay = std::chrono::milliseconds(500);
+  tuning.min_busy_threshold = 2;
+  tuning.max_busy_threshold = 30;
+  tuning.free_fraction = 0.5;
+
+  // the first call only starts the measurement
+  auto now = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(!trbd.tune_thresholds(tuning, now));
+
+  // 100 completions per second, 50 of them within the target delay
+  auto complete = [&](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      td.trigger_number = i + 1;
+      trbd.add_assignment(trbd.make_assignment(td));
+      trbd.complete_assignment(td.trigger_number);
+    }
+  };
+  complete(100);
+  now += std::chrono::seconds(1);
+  BOOST_REQUIRE(trbd.tune_thresholds(tuning, now));
+  BOOST_REQUIRE_EQUAL(trbd.busy_threshold(), 30); // half way to 50, then bounded
+  BOOST_REQUIRE_EQUAL(trbd.free_threshold(), 15);
+  BOOST_REQUIRE_EQUAL(occupancy->slot_capacity.load(), 30);
+
+  // an idle application keeps its thresholds
+  now += std::chrono::seconds(1);
+  BOOST_REQUIRE(!trbd.tune_thresholds(tuning, now));
+
+  // a slow application gets smaller thresholds, which can make it busy straight away
+  for (size_t i = 0; i < 4; ++i) {
+    td.trigger_number = 1000 + i;
+    trbd.add_assignment(trbd.make_assignment(td));
+  }
+  complete(2);
+  now += std::chrono::seconds(1);
+  BOOST_REQUIRE(trbd.tune_thresholds(tuning, now));
+  BOOST_REQUIRE_EQUAL(trbd.busy_threshold(), 16);
+  now += std::chrono::seconds(1);
+  complete(2);
+  trbd.tune_thresholds(tuning, now);
+  now += std::chrono::seconds(1);
+  complete(2);
+  trbd.tune_thresholds(tuning, now);
+  now += std::chrono::seconds(1);
+  complete(2);
+  trbd.tune_thresholds(tuning, now);
+  BOOST_REQUIRE_EQUAL(trbd.busy_threshold(), 3);
+  BOOST_REQUIRE_EQUAL(trbd.free_threshold(), 2);
+  BOOST_REQUIRE(trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(occupancy->busy_apps.load(), 1);
+  BOOST_REQUIRE_EQUAL(occupancy->slot_capacity.load(), 3);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
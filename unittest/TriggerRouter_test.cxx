@@ -0,0 +1,85 @@
+/**
+ * @file TriggerRouter_test.cxx Test application that tests and demonstrates
+ * the functionality of the TriggerRouter class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/TriggerRouter.hpp"
+#include "dfmodules/TriggerRecordBuilderData.hpp"
+
+#define BOOST_TEST_MODULE TriggerRouter_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <memory>
+#include <string>
+
+using namespace dunedaq::dfmodules;
+
+BOOST_AUTO_TEST_SUITE(TriggerRouter_test)
+
+BOOST_AUTO_TEST_CASE(Classify)
+{
+  TriggerRouter router;
+  BOOST_REQUIRE(router.empty());
+  BOOST_REQUIRE_EQUAL(router.classify(0x1), TriggerRouter::s_no_class);
+
+  TriggerRouter::RoutingClass calibration;
+  calibration.name = "calibration";
+  calibration.trigger_types = 0x6;
+  router.add_class(calibration);
+
+  TriggerRouter::RoutingClass long_window;
+  long_window.name = "long_window";
+  long_window.trigger_types = 0x14;
+  router.add_class(long_window);
+  BOOST_REQUIRE_EQUAL(router.size(), 2);
+
+  BOOST_REQUIRE_EQUAL(router.classify(0x1), TriggerRouter::s_no_class);
+  BOOST_REQUIRE_EQUAL(router.classify(0x2), 0);
+  BOOST_REQUIRE_EQUAL(router.classify(0x10), 1);
+  // the bit shared by the two classes goes to the first one
+  BOOST_REQUIRE_EQUAL(router.classify(0x4), 0);
+  // with several types, the class with the highest priority wins
+  BOOST_REQUIRE_EQUAL(router.classify(0x11), 1);
+  BOOST_REQUIRE_EQUAL(router.classify(0x12), 0);
+  BOOST_REQUIRE_EQUAL(router.classify(dunedaq::dfmessages::TypeDefaults::s_invalid_trigger_type),
+                      TriggerRouter::s_no_class);
+
+  router.clear();
+  BOOST_REQUIRE(router.empty());
+  BOOST_REQUIRE_EQUAL(router.classify(0x2), TriggerRouter::s_no_class);
+}
+
+BOOST_AUTO_TEST_CASE(Applications)
+{
+  TriggerRouter router;
+  TriggerRouter::RoutingClass calibration;
+  calibration.name = "calibration";
+  calibration.trigger_types = 0x2;
+  calibration.destinations = { "fast_1", "fast_2" };
+  router.add_class(calibration);
+
+  // nothing is registered yet
+  BOOST_REQUIRE(router.applications(0)->empty());
+
+  TriggerRouter::data_structure_t apps;
+  apps["fast_1"] = std::make_shared<TriggerRecordBuilderData>("fast_1", 10);
+  apps["slow"] = std::make_shared<TriggerRecordBuilderData>("slow", 10);
+  router.update(apps);
+  auto subset = router.applications(0);
+  BOOST_REQUIRE_EQUAL(subset->size(), 1);
+  BOOST_REQUIRE(subset->count("fast_1"));
+
+  apps["fast_2"] = std::make_shared<TriggerRecordBuilderData>("fast_2", 10);
+  router.update(apps);
+  BOOST_REQUIRE_EQUAL(router.applications(0)->size(), 2);
+  // the previous subset is still valid for its readers
+  BOOST_REQUIRE_EQUAL(subset->size(), 1);
+  BOOST_REQUIRE(router.applications(0)->at("fast_2") == apps["fast_2"]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
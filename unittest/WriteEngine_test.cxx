@@ -0,0 +1,125 @@
+/**
+ * @file WriteEngine_test.cxx Test application that tests and demonstrates
+ * the functionality of the WriteEngine implementations.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/WriteEngine.hpp"
+
+#define BOOST_TEST_MODULE WriteEngine_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+std::string
+test_file_name(const std::string& name)
+{
+  return (std::filesystem::temp_directory_path() / ("writeengine_test_" + name + ".dat")).string();
+}
+
+std::vector<char>
+read_file(const std::string& file_name)
+{
+  std::ifstream file(file_name, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Writes chunks in reverse order of their offsets, several at a time, and checks the file
+void
+check_engine(WriteEngine& engine, const std::string& name)
+{
+  std::string file_name = test_file_name(name);
+  int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  BOOST_REQUIRE(fd >= 0);
+
+  const size_t chunk_size = 10000;
+  const size_t chunk_count = 50;
+  std::vector<std::vector<char>> chunks;
+  for (size_t i = 0; i < chunk_count; ++i) {
+    chunks.emplace_back(chunk_size, static_cast<char>('a' + i % 26));
+  }
+
+  std::atomic<size_t> completions{ 0 };
+  std::atomic<size_t> errors{ 0 };
+  for (size_t i = chunk_count; i-- > 0;) {
+    engine.submit(fd, chunks[i].data(), chunk_size, i * chunk_size, [&](int error) {
+      ++completions;
+      if (error != 0)
+        ++errors;
+    });
+    BOOST_REQUIRE_LE(engine.get_in_flight(), engine.get_queue_depth());
+  }
+  engine.drain();
+  BOOST_REQUIRE_EQUAL(engine.get_in_flight(), 0);
+  BOOST_REQUIRE_EQUAL(completions.load(), chunk_count);
+  BOOST_REQUIRE_EQUAL(errors.load(), 0);
+  ::close(fd);
+
+  auto content = read_file(file_name);
+  BOOST_REQUIRE_EQUAL(content.size(), chunk_size * chunk_count);
+  for (size_t i = 0; i < chunk_count; ++i) {
+    BOOST_REQUIRE(std::equal(chunks[i].begin(), chunks[i].end(), content.begin() + i * chunk_size));
+  }
+  std::filesystem::remove(file_name);
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(WriteEngine_test)
+
+BOOST_AUTO_TEST_CASE(ThreadPool)
+{
+  auto engine = make_write_engine("thread_pool", 4);
+  BOOST_REQUIRE_EQUAL(engine->get_type(), "thread_pool");
+  BOOST_REQUIRE_EQUAL(engine->get_queue_depth(), 4);
+  check_engine(*engine, "thread_pool");
+}
+
+BOOST_AUTO_TEST_CASE(IoUring)
+{
+  // where io_uring is not available, the engine falls back to the thread pool
+  auto engine = make_write_engine("io_uring", 8);
+  BOOST_TEST_MESSAGE("Using the " << engine->get_type() << " write engine");
+  check_engine(*engine, "io_uring");
+
+  auto automatic = make_write_engine("auto", 1);
+  BOOST_REQUIRE_EQUAL(automatic->get_type(), engine->get_type());
+  check_engine(*automatic, "auto");
+}
+
+BOOST_AUTO_TEST_CASE(Errors)
+{
+  BOOST_REQUIRE_THROW(make_write_engine("carrier_pigeon", 1), dunedaq::dfmodules::WriteEngineUnavailable);
+
+  // a write to a read-only file descriptor fails with EBADF
+  std::string file_name = test_file_name("errors");
+  std::ofstream(file_name) << "x";
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  BOOST_REQUIRE(fd >= 0);
+  char data[16] = {};
+  for (auto type : { "thread_pool", "auto" }) {
+    auto engine = make_write_engine(type, 2);
+    std::atomic<int> result{ -1 };
+    engine->submit(fd, data, sizeof(data), 0, [&](int error) { result = error; });
+    engine->drain();
+    BOOST_REQUIRE_EQUAL(result.load(), EBADF);
+  }
+  ::close(fd);
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()